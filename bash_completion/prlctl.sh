@@ -63,14 +63,18 @@ pause reset resume start stop snapshot snapshot-delete \
 snapshot-list snapshot-switch suspend statistics unregister \
 set backup restore backup-list backup-delete reset-uptime \
 move exec console mount umount status problem-report change-sid \
-restart list ct2vm"
-	local actions_without_vmid="create list register server"
+restart list ct2vm wait"
+	local actions_without_vmid="agent apply batch bench create list register server"
 
+	local agent_flags='--socket'
+	local batch_flags='-f --file --jobs'
+	local apply_flags='-f --file --dry-run --parallel'
+	local bench_flags='--mix --parallel --rate --duration -j --json'
 	local capture_flags='--file'
 	local clone_flags='--name'
 	local clone_optional_flags='--template --location'
 	local create_flags='-c --config --location -o --ostype -d --distribution --ostemplate --chipset'
-	local list_flags='-a --all -t --template -o --output -s --sort -i --info -f --full -j --json --vmtype'
+	local list_flags='-a --all -t --template -o --output -s --sort -i --info -f --full --info-fields -j --json --ndjson --vmtype --filter --cache --watch --jobs --ip-jobs --ip-timeout --hosts --hosts-file --host-timeout'
 	local migrate_flags='--location --no-compression'
 	local snapshot_flags='-n --name -d --description'
 	local snapshotlist_flags='-t --tree -i --id'
@@ -80,7 +84,9 @@ restart list ct2vm"
 	local backuplist_flags='-f --full --localvms'
 	local backupdelete_flags='-t --tag'
 	local restore_flags='-t --tag'
-	local statistics_flags='--loop --filter'
+	local statistics_flags='--loop --filter --ndjson --hosts --hosts-file --host-timeout'
+	local status_flags='--hosts --hosts-file --host-timeout'
+	local bulk_flags='-a --all --filter --vmtype --parallel'
 	local set_flags='--cpus --memsize --videosize --description \
 --onboot --name --device-add --device-del --device-set \
 --device-connect --device-disconnect --applyconfig \
@@ -98,7 +104,7 @@ restart list ct2vm"
 	local set_device_serial_flags='--device --output --socket'
 	local move_flags='--location'
 
-	local global_flags='-l -p -v --verbose'
+	local global_flags='-l -p -v --verbose --session-cache --trace-file --timing'
 
 	if [ $COMP_CWORD == 1 ]; then
 		opts="${actions_on_vmid// /$'\n'}\n${actions_without_vmid// /$'\n'}"
@@ -195,6 +201,9 @@ restart list ct2vm"
 		--ha-enable)
 			opts='yes no'
 			;;
+		--state)
+			opts='running stopped suspended paused'
+			;;
 		--path)
 			COMPREPLY=($(compgen -o dirnames -- "${cur}"))
 			return 0
@@ -258,7 +267,7 @@ restart list ct2vm"
 			# user:passwd@server
 			opts=''
 			;;
-		-p|--read-passwd)
+		-p|--read-passwd|--hosts-file|--trace-file)
 			COMPREPLY=($(compgen -A file -- "${cur}"))
 			return 0
 			;;
@@ -280,6 +289,18 @@ restart list ct2vm"
 		*) # processing actions' local options
 
 			case "${COMP_WORDS[1]}" in
+			agent)
+				opts="${agent_flags} ${global_flags}"
+				;;
+			apply)
+				opts="${apply_flags} ${global_flags}"
+				;;
+			bench)
+				opts="${bench_flags} ${global_flags}"
+				;;
+			batch)
+				opts="${batch_flags} ${global_flags}"
+				;;
 			backup)
 				opts="${backup_flags} ${global_flags}" 
 				;;
@@ -312,7 +333,7 @@ restart list ct2vm"
 				[ $COMP_CWORD == 3 ] && opts="${create_flags} ${global_flags}"
 				;;
 			delete)
-				opts="${global_flags}"
+				opts="${bulk_flags} ${global_flags}"
 				;;
 			installtools)
 				opts="${global_flags}"
@@ -350,11 +371,14 @@ restart list ct2vm"
 			reset)
 				opts="${global_flags}"
 				;;
+			restart)
+				opts="${bulk_flags} ${global_flags}"
+				;;
 			reset-uptime)
 				opts="${global_flags}"
 				;;
 			resume)
-				opts="${global_flags}"
+				opts="${bulk_flags} ${global_flags}"
 				;;
 			restore)
 				opts="${restore_flags}"
@@ -367,10 +391,10 @@ restart list ct2vm"
 				fi
 				;;
 			start)
-				opts="${global_flags}"
+				opts="--wait --repair --waves ${bulk_flags} ${global_flags}"
 				;;
 			stop)
-				opts="${global_flags}"
+				opts="${bulk_flags} ${global_flags}"
 				;;
 			snapshot)
 				opts="${snapshot_flags} ${global_flags}" 
@@ -393,16 +417,22 @@ restart list ct2vm"
 				fi
 				;;
 			suspend)
-				opts="${global_flags}"
+				opts="${bulk_flags} ${global_flags}"
 				;;
 			statistics)
 				opts="${statistics_flags} ${global_flags}"
 				;;
+			status)
+				opts="${status_flags} ${global_flags}"
+				;;
 			unregister)
 				opts="${global_flags}"
 				;;
+			wait)
+				opts="$(get_vm_ids) --state ${global_flags}"
+				;;
 			set)
-				opts="${set_flags} ${global_flags}"
+				opts="${set_flags} ${bulk_flags} ${global_flags}"
 				;;
 			*)
 				;;
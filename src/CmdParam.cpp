@@ -58,14 +58,41 @@ static CmdParamData invalid_action;
 	{"timeout", '\0', OptRequireArg, CMD_TIMEOUT},	\
 	{"login", 'l', OptRequireArg, CMD_LOGIN},	\
 	{"read-passwd", 'p', OptRequireArg, CMD_PASSWD}, \
-	{"compat", '\0', OptNoArg, CMD_VZCOMPAT},
+	{"compat", '\0', OptNoArg, CMD_VZCOMPAT},	\
+	{"session-cache", '\0', OptNoArg, CMD_SESSION_CACHE},	\
+	{"trace-file", '\0', OptRequireArg, CMD_TRACE_FILE},	\
+	{"timing", '\0', OptNoArg, CMD_TIMING},
 
+/* The commands which can be run for several servers at once */
+#define OPTION_HOSTS					\
+	{"hosts", '\0', OptRequireArg, CMD_HOSTS},	\
+	{"hosts-file", '\0', OptRequireArg, CMD_HOSTS_FILE}, \
+	{"host-timeout", '\0', OptRequireArg, CMD_HOST_TIMEOUT},
 
 static Option no_options[] = {
 	OPTION_GLOBAL
 	OPTION_END
 };
 
+/* The VEs of a bulk action are selected by these instead of the ID */
+#define OPTION_BULK					\
+	{"all", 'a', OptNoArg, CMD_LIST_ALL},		\
+	{"filter", '\0', OptRequireArg, CMD_LIST_FILTER}, \
+	{"vmtype", '\0', OptRequireArg, CMD_VMTYPE},	\
+	{"parallel", '\0', OptRequireArg, CMD_PARALLEL},
+
+static Option bulk_options[] = {
+	OPTION_GLOBAL
+	OPTION_BULK
+	OPTION_END
+};
+
+static Option status_options[] = {
+	OPTION_GLOBAL
+	OPTION_HOSTS
+	OPTION_END
+};
+
 static Option stop_options[] = {
 	OPTION_GLOBAL
 	{"fast", '\0', OptNoArg, CMD_FAST},
@@ -73,12 +100,14 @@ static Option stop_options[] = {
 	{"acpi", '\0', OptNoArg, CMD_USE_ACPI},
 	{"force", '\0', OptNoArg, CMD_FORCE},
 	{"noforce", '\0', OptNoArg, CMD_NOFORCE},
+	OPTION_BULK
 	OPTION_END
 };
 
 static Option destroy_options[] = {
 	OPTION_GLOBAL
 	{"force", '\0', OptNoArg, CMD_FORCE},
+	OPTION_BULK
 	OPTION_END
 };
 
@@ -362,6 +391,7 @@ static Option set_options[] = {
 	{"password-to-edit",'\0', OptNoArg, CMD_SET_RESTRICT_EDITING},
 	{"autocompact",		'\0', OptRequireArg, CMD_AUTOCOMPACT},
 	{"backup-path", '\0', OptRequireArg, CMD_BACKUP_PATH},
+	OPTION_BULK
         OPTION_END
 };
 
@@ -498,8 +528,17 @@ static Option list_options[] = {
 	{"help", '\0', OptNoArg, CMD_HELP},
 	{"info", 'i', OptNoArg, CMD_INFO},
 	{"json", 'j', OptNoArg, CMD_USE_JSON},
+	{"ndjson", '\0', OptNoArg, CMD_USE_NDJSON},
 	{"full", 'f', OptNoArg, CMD_INFO_FULL},
+	{"info-fields", '\0', OptRequireArg, CMD_INFO_FIELDS},
 	{"list", 'L', OptNoArg, CMD_LIST_ALL_FIELDS},
+	{"jobs", '\0', OptRequireArg, CMD_LIST_JOBS},
+	{"ip-jobs", '\0', OptRequireArg, CMD_LIST_IP_JOBS},
+	{"ip-timeout", '\0', OptRequireArg, CMD_LIST_IP_TIMEOUT},
+	{"filter", '\0', OptRequireArg, CMD_LIST_FILTER},
+	{"cache", '\0', OptNoArg, CMD_LIST_CACHE},
+	{"watch", '\0', OptNoArg, CMD_LIST_WATCH},
+	OPTION_HOSTS
 	OPTION_END
 };
 
@@ -661,6 +700,52 @@ static Option statistics_options[] = {
 	{"all"     , 'a' , OptNoArg     , CMD_LIST_ALL},
 	{"loop"    , 'l' , OptNoArg     , CMD_LOOP},
 	{"filter"  , '\0', OptRequireArg, CMD_PERF_FILTER},
+	{"ndjson"  , '\0', OptNoArg     , CMD_USE_NDJSON},
+	OPTION_HOSTS
+	OPTION_END
+};
+
+static Option monitor_options[] = {
+	OPTION_GLOBAL
+	{"ndjson", '\0', OptNoArg, CMD_USE_NDJSON},
+	{"cache", '\0', OptNoArg, CMD_LIST_CACHE},
+	OPTION_END
+};
+
+static Option agent_options[] = {
+	OPTION_GLOBAL
+	{"socket", '\0', OptRequireArg, CMD_AGENT_SOCKET},
+	OPTION_END
+};
+
+static Option batch_options[] = {
+	OPTION_GLOBAL
+	{"file", 'f', OptRequireArg, CMD_BATCH_FILE},
+	{"jobs", '\0', OptRequireArg, CMD_PARALLEL},
+	OPTION_END
+};
+
+static Option apply_options[] = {
+	OPTION_GLOBAL
+	{"file", 'f', OptRequireArg, CMD_APPLY_FILE},
+	{"dry-run", '\0', OptNoArg, CMD_DRY_RUN},
+	{"parallel", '\0', OptRequireArg, CMD_PARALLEL},
+	OPTION_END
+};
+
+static Option bench_options[] = {
+	OPTION_GLOBAL
+	{"mix", '\0', OptRequireArg, CMD_BENCH_MIX},
+	{"parallel", '\0', OptRequireArg, CMD_PARALLEL},
+	{"rate", '\0', OptRequireArg, CMD_BENCH_RATE},
+	{"duration", '\0', OptRequireArg, CMD_BENCH_DURATION},
+	{"json", 'j', OptNoArg, CMD_USE_JSON},
+	OPTION_END
+};
+
+static Option wait_options[] = {
+	OPTION_GLOBAL
+	{"state", '\0', OptRequireArg, CMD_WAIT_STATE},
 	OPTION_END
 };
 
@@ -703,6 +788,8 @@ static Option start_options[] = {
 	OPTION_GLOBAL
 	{"wait", '\0', OptNoArg, CMD_WAIT},
 	{"repair", '\0', OptNoArg, CMD_REPAIR},
+	{"waves", '\0', OptNoArg, CMD_WAVES},
+	OPTION_BULK
 	OPTION_END
 };
 
@@ -742,6 +829,11 @@ static void usage_vm(const char * argv0)
 	printf(
 "Usage: %s ACTION <ID | NAME> [OPTIONS] [-l user[[:passwd]@server[:port]]\n"
 "Supported actions are:\n"
+"  agent [--socket <path>]\n"
+"  apply [-f,--file <path>] [--dry-run] [--parallel <N>]\n"
+"  bench [--mix list=<N>,config=<N>,info=<N>] [--parallel <N>] [--rate <N>]\n"
+"		[--duration <sec>] [-j,--json]\n"
+"  batch [-f,--file <path>] [--jobs <N>]\n"
 "  backup <ID | NAME> [-s,--storage <user[[:passwd]@server[:port]>] [--description <desc>]\n"
 "    [-f,--full | -i,--incremental] [--no-compression] [--no-tunnel]\n"
 "  backup-list [ID | NAME] [-f,--full] [--vmtype ct|vm|all] [--localvms]\n"
@@ -759,7 +851,9 @@ static void usage_vm(const char * argv0)
 "  enter <ID | NAME>\n"
 "  exec <ID | NAME> [--without-shell] <command> [arg ...]\n"
 "  list [-a,--all] [-t,--template] [--vmtype ct|vm|all] [-L] [-o,--output name[,name...]] [-s,--sort name]\n"
-"  list -i,--info [-f,--full] [-j, --json] [<ID | NAME>] [--vmtype ct|vm|all]\n"
+"       [--filter <expr>] [--cache] [--watch] [--ndjson] [--jobs <N>] [--ip-jobs <N>] [--ip-timeout <sec>]\n"
+"       [{--hosts <host>[,<host>...] | --hosts-file <file>} [--host-timeout <sec>]]\n"
+"  list -i,--info [-f,--full] [-j, --json] [--info-fields key[,key...]] [<ID | NAME>] [--vmtype ct|vm|all]\n"
 "  migrate <[src_node/]ID> <dst_node[/NAME]> [--dst <path>] [--changesid] [--clone|--remove-src] [--no-compression] [--no-tunnel] [--ssh <options>]\n"
 "  pause <ID | NAME>\n"
 "  register <PATH> [--preserve-uuid | --uuid <UUID>] [--regenerate-src-uuid] [--force]\n"
@@ -767,9 +861,12 @@ static void usage_vm(const char * argv0)
 "  resume <ID | NAME>\n"
 "  restart <ID | NAME>\n"
 "  start <ID | NAME> [--repair]\n"
-"  status <ID | NAME>\n"
+"  status <ID | NAME> [{--hosts <host>[,<host>...] | --hosts-file <file>} [--host-timeout <sec>]]\n"
 "  change-sid <ID | NAME>\n"
 "  stop <ID | NAME> [--kill | --noforce]\n"
+"  {start|stop|suspend|resume|restart|delete} {-a,--all | --filter <expr>} [--vmtype ct|vm|all] [--parallel <N>]\n"
+"  set {-a,--all | --filter <expr>} [--vmtype ct|vm|all] [--parallel <N>] <options>\n"
+"  start {-a,--all | --filter <expr>} --waves [--vmtype ct|vm|all] [--parallel <N>]\n"
 "  snapshot <ID | NAME> [-n,--name <name>] [-d,--description <desc>]\n"
 "  snapshot-delete <ID | NAME> -i,--id <snapid> [-c,--children]\n"
 "  snapshot-list <ID | NAME> [-t,--tree] [-i,--id <snapid>]\n"
@@ -777,6 +874,7 @@ static void usage_vm(const char * argv0)
 "  suspend <ID | NAME>\n"
 //"  statistics <ID | NAME> [--loop] [--filter name]\n"
 "  unregister <ID | NAME>\n"
+"  wait <ID | NAME>... --state running|stopped|suspended|paused [--timeout <sec>]\n"
 "  reset-uptime <ID | NAME>\n"
 #ifdef _LIN_
 "  mount <ID | NAME> [{-o ro|rw | --info}]\n"
@@ -785,7 +883,8 @@ static void usage_vm(const char * argv0)
 "  move <vm_id|vm_name> --dst <path>\n"
 "  problem-report <ID | NAME> <-d,--dump [--full]|-s,--send [--proxy [user[:password]@proxyhost[:port]]]> "
 	"[--no-proxy] [--name <your name>] [--email <your E-mail>] [--description <problem description>]\n"
-"  statistics {<ID | NAME> | <-a,--all>} [--filter <filter>] [--loop]\n"
+"  statistics {<ID | NAME> | <-a,--all>} [--filter <filter>] [--loop] [--ndjson]\n"
+"       [{--hosts <host>[,<host>...] | --hosts-file <file>} [--host-timeout <sec>]]\n"
 "  set <ID | NAME>\n"
 "    [--memguarantee <auto|value>] [--mem-hotplug <on|off>]\n"
 "    [--applyconfig <conf>] [--tools-autoupdate <yes|no>]\n"
@@ -1304,6 +1403,39 @@ static int parse_mnt_opt(const std::string &val, int *flags)
 	return 0;
 }
 
+/* list=N,config=N,info=N; the calls which are not given are not made */
+static int parse_bench_mix(const std::string &val, CmdParamData &param)
+{
+	str_list_t items = split(val, ",");
+	unsigned int list = 0, config = 0, info = 0;
+
+	for (str_list_t::const_iterator it = items.begin(); it != items.end(); ++it) {
+		std::string::size_type pos = it->find('=');
+		unsigned int *w;
+
+		if (pos == std::string::npos)
+			return -1;
+		std::string name = it->substr(0, pos);
+		if (name == "list")
+			w = &list;
+		else if (name == "config")
+			w = &config;
+		else if (name == "info")
+			w = &info;
+		else
+			return -1;
+		if (parse_ui(it->substr(pos + 1).c_str(), w))
+			return -1;
+	}
+	if (list + config + info == 0)
+		return -1;
+
+	param.bench_list = list;
+	param.bench_config = config;
+	param.bench_info = info;
+	return 0;
+}
+
 #define CASE_PARSE_OPTION_GLOBAL(val, param)	\
 		case CMD_LOGIN: \
 			if (parse_auth(val, param.login)) { \
@@ -1317,6 +1449,9 @@ static int parse_mnt_opt(const std::string &val, int *flags)
 			if (read_passwd(val.c_str(), param.login.get_passwd_buf())) \
 				return invalid_action; \
 			break; \
+		case CMD_SESSION_CACHE: \
+			param.login.session_cache = true; \
+			break; \
 		case CMD_VERBOSE: \
 			prl_set_log_verbose(atoi(val.c_str())); \
 			break; \
@@ -1326,6 +1461,33 @@ static int parse_mnt_opt(const std::string &val, int *flags)
 		case CMD_TIMEOUT: \
 			g_nJobTimeout = atoi(val.c_str()) * 1000; \
 		break; \
+		case CMD_TRACE_FILE: \
+			trace_enable(val.c_str()); \
+			break; \
+		case CMD_TIMING: \
+			timing_enable(); \
+			break; \
+
+#define CASE_PARSE_OPTION_HOSTS(val, param)	\
+		case CMD_HOSTS: { \
+			str_list_t hosts = split(val, ","); \
+			param.hosts.insert(param.hosts.end(), \
+					hosts.begin(), hosts.end()); \
+			opt.hide_arg(); \
+			break; \
+		} \
+		case CMD_HOSTS_FILE: \
+			param.hosts_file = val; \
+			break; \
+		case CMD_HOST_TIMEOUT: \
+			if (parse_ui(val.c_str(), &param.host_timeout) || \
+					param.host_timeout == 0) { \
+				fprintf(stderr, "An incorrect value for" \
+					" --host-timeout is specified: %s\n", \
+					val.c_str()); \
+				return invalid_action; \
+			} \
+			break; \
 
 
 CmdParamData cmdParam::get_xmlrpc_param(int argc, char **argv, Action action,
@@ -1741,6 +1903,12 @@ if (expr) {								\
 		opt1, opt2);						\
 	return 1;							\
 }
+#define CHECK_BULK(opt)							\
+if (action == VmSetAction && this->id.empty()) {			\
+	fprintf(stderr, "The %s option can not be used with --all"	\
+		" or --filter\n", opt);					\
+	return 1;							\
+}
 
 	switch (id) {
 	case CMD_DEVICE_ADD:
@@ -1781,6 +1949,22 @@ if (expr) {								\
 		CHECK_SYMUL(dev.disconnect,
 			"--disconnect", "--connect")
 		break;
+	/* the values which have to differ between the VEs */
+	case CMD_VM_NAME:
+		CHECK_BULK("--name")
+		break;
+	case CMD_HOSTNAME:
+		CHECK_BULK("--hostname")
+		break;
+	case CMD_IP_ADD:
+		CHECK_BULK("--ipadd")
+		break;
+	case CMD_IP_SET:
+		CHECK_BULK("--ipset")
+		break;
+	case CMD_MAC:
+		CHECK_BULK("--mac")
+		break;
 	case CMD_ATTACH_BACKUP_ID:
 	case CMD_DETACH_BACKUP_ID:
 		if (backup_cmd != None) {
@@ -2106,6 +2290,35 @@ void CmdParamData::set_device_del_flags(unsigned int flags)
 	commit_flags |= flags;
 }
 
+bool is_bulk_action(Action action)
+{
+	switch (action) {
+	case VmStartAction:
+	case VmStopAction:
+	case VmSuspendAction:
+	case VmResumeAction:
+	case VmRestartAction:
+	case VmDestroyAction:
+	case VmSetAction:
+		return true;
+	default:
+		return false;
+	}
+}
+
+ActionNeeds get_action_needs(const CmdParamData &param)
+{
+	if (param.action == InvalidAction)
+		return NEEDS_NOTHING;
+	/* printed from the built-in field table */
+	if (param.action == VmListAction && param.list_all_fields)
+		return NEEDS_NOTHING;
+	if (param.problem_report.stand_alone || param.xmlrpc.action_provided)
+		return NEEDS_SDK;
+
+	return NEEDS_LOGIN;
+}
+
 CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 		const Option *options, int offset)
 
@@ -2119,7 +2332,12 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 	NetParam net;
 
 	param.action = action;
-	if (action != VmListAction)
+	if (is_bulk_action(action) && argv[offset][0] == '-')
+		/* no ID, the VEs are selected by the options */
+		offset--;
+	else if (action != VmListAction && action != VmMonitorAction &&
+			action != VmAgentAction && action != VmBatchAction &&
+			action != VmApplyAction && action != VmBenchAction)
 		param.id = argv[offset];
 
 	GetOptLong opt(argc, argv, options, offset + 1);
@@ -2131,6 +2349,7 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 			return invalid_action;
 		switch (id) {
 		CASE_PARSE_OPTION_GLOBAL(val, param)
+		CASE_PARSE_OPTION_HOSTS(val, param)
 		case CMD_FAST:
 			param.fast = true;
 			break;
@@ -2155,6 +2374,55 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 		case CMD_LIST_SORT:
 			param.list_sort = val;
 			break;
+		case CMD_LIST_FILTER:
+			param.list_filter = val;
+			break;
+		case CMD_LIST_CACHE:
+			param.list_cache = true;
+			break;
+		case CMD_LIST_WATCH:
+			param.list_watch = true;
+			break;
+		case CMD_INFO_FIELDS:
+			param.info_fields = val;
+			break;
+		case CMD_AGENT_SOCKET:
+			param.agent_socket = val;
+			break;
+		case CMD_BATCH_FILE:
+			param.batch_file = val;
+			break;
+		case CMD_APPLY_FILE:
+			param.apply_file = val;
+			break;
+		case CMD_DRY_RUN:
+			param.dry_run = true;
+			break;
+		case CMD_BENCH_MIX:
+			if (parse_bench_mix(val, param)) {
+				fprintf(stderr, "An incorrect value for"
+					" --mix is specified: %s\n",
+					val.c_str());
+				return invalid_action;
+			}
+			break;
+		case CMD_BENCH_RATE:
+			if (parse_ui(val.c_str(), &param.bench_rate)) {
+				fprintf(stderr, "An incorrect value for"
+					" --rate is specified: %s\n",
+					val.c_str());
+				return invalid_action;
+			}
+			break;
+		case CMD_BENCH_DURATION:
+			if (parse_ui(val.c_str(), &param.bench_duration) ||
+					param.bench_duration == 0) {
+				fprintf(stderr, "An incorrect value for"
+					" --duration is specified: %s\n",
+					val.c_str());
+				return invalid_action;
+			}
+			break;
 		case CMD_LIST_STOPPED:
 			param.list_stopped = true;
 			break;
@@ -2164,6 +2432,42 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 		case CMD_LIST_ALL_FIELDS:
 			param.list_all_fields = true;
 			break;
+		case CMD_LIST_JOBS:
+			if (parse_ui(val.c_str(), &param.list_jobs) ||
+					param.list_jobs == 0) {
+				fprintf(stderr, "An incorrect value for"
+					" --jobs is specified: %s\n",
+					val.c_str());
+				return invalid_action;
+			}
+			break;
+		case CMD_PARALLEL:
+			if (parse_ui(val.c_str(), &param.parallel) ||
+					param.parallel == 0) {
+				fprintf(stderr, "An incorrect value for"
+					" --%s is specified: %s\n",
+					param.action == VmBatchAction ? "jobs" :
+					"parallel", val.c_str());
+				return invalid_action;
+			}
+			break;
+		case CMD_LIST_IP_JOBS:
+			if (parse_ui(val.c_str(), &param.list_ip_jobs) ||
+					param.list_ip_jobs == 0) {
+				fprintf(stderr, "An incorrect value for"
+					" --ip-jobs is specified: %s\n",
+					val.c_str());
+				return invalid_action;
+			}
+			break;
+		case CMD_LIST_IP_TIMEOUT:
+			if (parse_ui(val.c_str(), &param.list_ip_timeout)) {
+				fprintf(stderr, "An incorrect value for"
+					" --ip-timeout is specified: %s\n",
+					val.c_str());
+				return invalid_action;
+			}
+			break;
 		case CMD_INFO:
 			param.info = true;
 			break;
@@ -2173,6 +2477,10 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 		case CMD_USE_JSON:
 			param.use_json = true;
 			break;
+		case CMD_USE_NDJSON:
+			param.use_json = true;
+			param.use_ndjson = true;
+			break;
 		case CMD_CONFIG:
 			param.config_sample = val;
 			break;
@@ -2222,7 +2530,8 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 			} else if (val == "vm" || val == "v") {
 				param.vmtype = PVTF_VM;
 			} else if ((val == "all" || val == "a") &&
-				(param.action == VmListAction || param.action == VmBackupListAction)) {
+				(param.action == VmListAction || param.action == VmBackupListAction ||
+				 is_bulk_action(param.action))) {
 				param.vmtype = PVTF_VM | PVTF_CT;
 			} else {
 				 fprintf(stderr, "An incorrect value for"
@@ -3394,6 +3703,9 @@ CmdParamData cmdParam::get_param(int argc, char **argv, Action action,
 		case CMD_REPAIR:
 			param.start_mode = PSM_VM_START_FOR_REPAIR;
 			break;
+		case CMD_WAVES:
+			param.start_waves = true;
+			break;
 		case CMD_DESTROY_HDD:
 			device_del_flags |= PVCF_DESTROY_HDD_BUNDLE;
 			break;
@@ -3497,6 +3809,61 @@ static int get_security_level(const std::string name, unsigned int *level)
 	return 0;
 }
 
+CmdParamData cmdParam::get_wait_param(int argc, char **argv, Action action,
+		const Option *options, int offset)
+{
+	std::string val;
+
+	CmdParamData param;
+
+	param.action = action;
+	for (; offset < argc && argv[offset][0] != '-'; offset++)
+		param.wait_ids.push_back(argv[offset]);
+	if (param.wait_ids.empty()) {
+		fprintf(stderr, "Incorrect wait usage.\n");
+		return invalid_action;
+	}
+
+	GetOptLong opt(argc, argv, options, offset);
+	while (1) {
+		int id = opt.parse(val);
+		if (id == -1) // the end mark
+			break;
+		switch (id) {
+		CASE_PARSE_OPTION_GLOBAL(val, param)
+		case CMD_WAIT_STATE:
+			if (val == "running")
+				param.wait_state = VMS_RUNNING;
+			else if (val == "stopped")
+				param.wait_state = VMS_STOPPED;
+			else if (val == "suspended")
+				param.wait_state = VMS_SUSPENDED;
+			else if (val == "paused")
+				param.wait_state = VMS_PAUSED;
+			else {
+				fprintf(stderr, "An incorrect value is specified"
+						" for --state: %s\n", val.c_str());
+				return invalid_action;
+			}
+			break;
+		case GETOPTUNKNOWN:
+			fprintf(stderr, "Unrecognized option: %s\n",
+					opt.get_next());
+			return invalid_action;
+		case GETOPTERROR:
+		default:
+			return invalid_action;
+		}
+	}
+
+	if (param.wait_state == VMS_UNKNOWN) {
+		fprintf(stderr, "The --state option has to be specified.\n");
+		return invalid_action;
+	}
+
+	return param;
+}
+
 CmdParamData cmdParam::get_migrate_param(int argc, char **argv, Action action,
 		const Option *options, int offset)
 {
@@ -3905,12 +4272,16 @@ CmdParamData cmdParam::get_statistics_param(int argc, char **argv, Action action
 			break;
 		switch (id) {
 		CASE_PARSE_OPTION_GLOBAL(val, param)
+		CASE_PARSE_OPTION_HOSTS(val, param)
 		case CMD_LOOP:
 			param.statistics.loop = true;
 			break;
 		case CMD_PERF_FILTER:
 			param.statistics.filter = val;
 			break;
+		case CMD_USE_NDJSON:
+			param.use_ndjson = true;
+			break;
 		case CMD_LIST_ALL:
 			param.list_all = true;
 			break;
@@ -4026,6 +4397,16 @@ CmdParamData cmdParam::get_vm(int argc, char **argv)
 		 return get_param(argc, argv, VmListAction, list_options, 1);
 	else if (!strcmp(argv[1], "backup-list"))
 		return get_backup_list_param(argc, argv, VmBackupListAction, backup_list_options, 1);
+	else if (!strcmp(argv[1], "monitor"))
+		return get_param(argc, argv, VmMonitorAction, monitor_options, 1);
+	else if (!strcmp(argv[1], "agent"))
+		return get_param(argc, argv, VmAgentAction, agent_options, 1);
+	else if (!strcmp(argv[1], "batch"))
+		return get_param(argc, argv, VmBatchAction, batch_options, 1);
+	else if (!strcmp(argv[1], "apply"))
+		return get_param(argc, argv, VmApplyAction, apply_options, 1);
+	else if (!strcmp(argv[1], "bench"))
+		return get_param(argc, argv, VmBenchAction, bench_options, 1);
 
 	if (argc < 3) {
 		fprintf(stderr, "Invalid usage\n");
@@ -4052,9 +4433,9 @@ CmdParamData cmdParam::get_vm(int argc, char **argv)
 	} else if (!strcmp(argv[1], "set")) {
 		return get_param(argc, argv, VmSetAction, set_options, 2);
 	} else if (!strcmp(argv[1], "suspend")) {
-		return get_param(argc, argv, VmSuspendAction, no_options, 2);
+		return get_param(argc, argv, VmSuspendAction, bulk_options, 2);
 	} else if (!strcmp(argv[1], "resume")) {
-		return get_param(argc, argv, VmResumeAction, no_options, 2);
+		return get_param(argc, argv, VmResumeAction, bulk_options, 2);
 	} else if (!strcmp(argv[1], "pause")) {
 		return get_param(argc, argv, VmPauseAction, no_options, 2);
 	} else if (!strcmp(argv[1], "create")) {
@@ -4072,7 +4453,7 @@ CmdParamData cmdParam::get_vm(int argc, char **argv)
 	} else if (!strcmp(argv[1], "reset")) {
 		return get_param(argc, argv, VmResetAction, no_options, 2);
 	} else if (!strcmp(argv[1], "restart")) {
-		return get_param(argc, argv, VmRestartAction, no_options, 2);
+		return get_param(argc, argv, VmRestartAction, bulk_options, 2);
 	} else if (!strcmp(argv[1], "installtools")) {
 		return get_param(argc, argv, VmInstallToolsAction, no_options, 2);
 	} else if (!strcmp(argv[1], "capture") || !strcmp(argv[1], "screenshot")) {
@@ -4092,6 +4473,8 @@ CmdParamData cmdParam::get_vm(int argc, char **argv)
 	} else if (!strcmp(argv[1], "migrate")) {
 		return get_migrate_param(argc, argv, VmMigrateAction,
 			migrate_options, 2);
+	} else if (!strcmp(argv[1], "wait")) {
+		return get_wait_param(argc, argv, VmWaitAction, wait_options, 2);
 	} else if (!strcmp(argv[1], "update-qemu")) {
 		return get_param(argc, argv, VmUpdateVmAction, no_options, 2);
 	} else if (!strcmp(argv[1], "move")) {
@@ -4120,15 +4503,13 @@ CmdParamData cmdParam::get_vm(int argc, char **argv)
 	} else if (!strcmp(argv[1], "auth")) {
 		return get_param(argc, argv, VmAuthAction, auth_options, 2);
 	} else if (!strcmp(argv[1], "status")) {
-		return get_param(argc, argv, VmStatusAction, no_options, 2);
+		return get_param(argc, argv, VmStatusAction, status_options, 2);
 	} else if (!strcmp(argv[1], "reinstall")) {
 		return get_param(argc, argv, VmReinstallAction,
 								reinstall_options, 2);
 	}
 	else if (!strcmp(argv[1], "ct2vm")) {
 		return get_param(argc, argv, CtConvertVm, no_options, 2);
-	} else if (!strcmp(argv[i], "monitor")) {
-		return get_param(argc, argv, VmMonitorAction, no_options, 2);
 	} else if (!strcmp(argv[i], "server")) {
 		// sergeyt@:  very strange code
 		++i;
@@ -114,6 +114,11 @@ enum Action {
 	VmConvertAction,
 	VmReinstallAction,
 	VmMonitorAction,
+	VmAgentAction,
+	VmBatchAction,
+	VmWaitAction,
+	VmApplyAction,
+	VmBenchAction,
 
 	CtConvertVm,
 
@@ -135,8 +140,10 @@ public:
 	std::string user;
 	std::string server;
 	int port;
+	/* reattach to the session of the previous run */
+	bool session_cache;
 
-	LoginInfo() : port(0) {};
+	LoginInfo() : port(0), session_cache(false) {};
 
 	std::string &get_passwd_buf() {
 		passwds_stack.push_back( std::string() );
@@ -603,6 +610,12 @@ struct FeaturesParam {
 };
 
 #define NUMCAP 33
+#define DEFAULT_LIST_JOBS 4
+#define DEFAULT_PARALLEL 4
+#define DEFAULT_LIST_IP_JOBS 16
+#define DEFAULT_LIST_IP_TIMEOUT 60
+#define DEFAULT_HOST_TIMEOUT 30
+#define DEFAULT_BENCH_DURATION 10
 
 struct CapParam {
 	cap_t mask_on;
@@ -819,8 +832,47 @@ public:
 	bool list_name;
 	bool info;
 	bool use_json;
+	bool use_ndjson;
 	bool list_all_fields;
 	std::string list_sort;
+	std::string list_filter;
+	bool list_cache;
+	bool list_watch;
+	std::string info_fields;
+	unsigned int list_jobs;
+	unsigned int list_ip_jobs;
+	unsigned int list_ip_timeout;
+
+	/* the VEs the bulk actions, batch, apply and bench run at a time */
+	unsigned int parallel;
+
+	/* agent param */
+	std::string agent_socket;
+
+	/* batch param */
+	std::string batch_file;
+
+	/* apply param */
+	std::string apply_file;
+
+	/* bench param: the weights of the calls in the mix */
+	unsigned int bench_list;
+	unsigned int bench_config;
+	unsigned int bench_info;
+	/* calls per second, 0 - as fast as --parallel allows */
+	unsigned int bench_rate;
+	unsigned int bench_duration;
+
+	/* multi-host param */
+	str_list_t hosts;
+	std::string hosts_file;
+	unsigned int host_timeout;
+	/* the command is run for one host of a multi-host run */
+	bool host_child;
+
+	/* wait param */
+	str_list_t wait_ids;
+	VIRTUAL_MACHINE_STATE wait_state;
 
 	/* VM param */
 	boost::optional<unsigned> cpu_cores;
@@ -942,6 +994,8 @@ public:
 	int mnt_info;
 	int start_mode;
 	int start_opts;
+	/* start the VEs in the order of their HA priority */
+	bool start_waves;
 	int apply_iponly;
 
 	/* XML RPC options*/
@@ -987,7 +1041,22 @@ public:
 		list_name(false),
 		info(false),
 		use_json(false),
+		use_ndjson(false),
 		list_all_fields(false),
+		list_cache(false),
+		list_watch(false),
+		list_jobs(DEFAULT_LIST_JOBS),
+		list_ip_jobs(DEFAULT_LIST_IP_JOBS),
+		list_ip_timeout(DEFAULT_LIST_IP_TIMEOUT),
+		parallel(DEFAULT_PARALLEL),
+		bench_list(1),
+		bench_config(1),
+		bench_info(1),
+		bench_rate(0),
+		bench_duration(DEFAULT_BENCH_DURATION),
+		host_timeout(DEFAULT_HOST_TIMEOUT),
+		host_child(false),
+		wait_state(VMS_UNKNOWN),
 		cpuunits(0),
 		ioprio((unsigned int) -1),
 		iolimit((unsigned int) -1),
@@ -1050,6 +1119,7 @@ public:
 		mnt_info(0),
 		start_mode(PSM_VM_START),
 		start_opts(0),
+		start_waves(false),
 		apply_iponly(-1),
 		ha_enable(-1),
 		ha_prio(-1),
@@ -1080,6 +1150,17 @@ private:
 	bool validate_encryption() const;
 };
 
+/* The actions which can be run for the VMs selected by --all or --filter */
+bool is_bulk_action(Action action);
+
+/* What has to be set up before the action is run */
+enum ActionNeeds {
+	NEEDS_NOTHING,		/* no SDK at all */
+	NEEDS_SDK,		/* the SDK without a login */
+	NEEDS_LOGIN,
+};
+ActionNeeds get_action_needs(const CmdParamData &param);
+
 struct Option;
 class cmdParam
 {
@@ -1093,6 +1174,8 @@ private:
 		const Option *options, int offset);
 	CmdParamData get_disp_param(int argc, char **argv, Action action,
 		const Option *options, int offset);
+	CmdParamData get_wait_param(int argc, char **argv, Action action,
+		const Option *options, int offset);
 	CmdParamData get_migrate_param(int argc, char **argv, Action action,
 		const Option *options, int offset);
 	CmdParamData get_backup_param(int argc, char **argv, Action action,
@@ -1135,6 +1218,9 @@ enum cmdOptions {
 	CMD_VERBOSE,
 	CMD_TIMEOUT,
 	CMD_LOGIN,
+	CMD_SESSION_CACHE,
+	CMD_TRACE_FILE,
+	CMD_TIMING,
 	CMD_PRESERVE_UUID,
 	CMD_REGENERATE_SRC_UUID,
 	CMD_LIST_FIELD,
@@ -1145,6 +1231,24 @@ enum cmdOptions {
 	CMD_LIST_STOPPED,
 	CMD_LIST_NAME,
 	CMD_LIST_ALL_FIELDS,
+	CMD_LIST_JOBS,
+	CMD_LIST_IP_JOBS,
+	CMD_LIST_IP_TIMEOUT,
+	CMD_LIST_FILTER,
+	CMD_LIST_CACHE,
+	CMD_LIST_WATCH,
+	CMD_INFO_FIELDS,
+	CMD_AGENT_SOCKET,
+	CMD_BATCH_FILE,
+	CMD_HOSTS,
+	CMD_HOSTS_FILE,
+	CMD_HOST_TIMEOUT,
+	CMD_PARALLEL,
+	CMD_APPLY_FILE,
+	CMD_DRY_RUN,
+	CMD_BENCH_MIX,
+	CMD_BENCH_RATE,
+	CMD_BENCH_DURATION,
 
 	CMD_CONFIG,
 	CMD_LOCATION,
@@ -1155,6 +1259,7 @@ enum cmdOptions {
 	CMD_UUID,
 	CMD_INFO,
 	CMD_USE_JSON,
+	CMD_USE_NDJSON,
 	CMD_INFO_FULL,
 
 	CMD_DEVICE_ADD,
@@ -1441,6 +1546,8 @@ enum cmdOptions {
 	CMD_QUOTAUGIDLIMIT,
 	CMD_WAIT,
 	CMD_REPAIR,
+	CMD_WAVES,
+	CMD_WAIT_STATE,
 
 	CMD_XMLRPC_MNG_URL,
 	CMD_XMLRPC_USER_LOGIN,
@@ -54,6 +54,9 @@ static struct LogParam _g_log = {
 
 #define LOG_BUF_SIZE    8192
 
+/* Tells which VE the message is about when several are run at once */
+static thread_local char _log_prefix[128];
+
 static void logger_ap(int level, int err_no, const char *format, va_list ap)
 {
 	char buf[LOG_BUF_SIZE];
@@ -66,7 +69,11 @@ static void logger_ap(int level, int err_no, const char *format, va_list ap)
 	}
 	if (_g_log.enable) {
 		if (!_g_log.quiet && _g_log.verbose >= level) {
-			fprintf((level < 0 ? stderr : stdout), "%s\n", buf);
+			if (_log_prefix[0])
+				fprintf((level < 0 ? stderr : stdout), "%s: %s\n",
+						_log_prefix, buf);
+			else
+				fprintf((level < 0 ? stderr : stdout), "%s\n", buf);
 			fflush(level < 0 ? stderr : stdout);
 		}
 	}
@@ -96,6 +103,11 @@ int prl_get_log_verbose()
 	return (_g_log.verbose);
 }
 
+void prl_set_log_prefix(const char *prefix)
+{
+	snprintf(_log_prefix, sizeof(_log_prefix), "%s", prefix ? prefix : "");
+}
+
 int prl_set_log_enable(int enable)
 {
 	int tmp;
@@ -42,5 +42,7 @@ int prl_set_log_verbose(int verbose);
 int prl_set_log_enable(int enable);
 int prl_err(int err, const char *format, ...);
 int prl_get_log_verbose();
+/* Prefix the messages of the calling thread, NULL to reset */
+void prl_set_log_prefix(const char *prefix);
 
 #endif
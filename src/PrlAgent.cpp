@@ -0,0 +1,532 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PrlTypes.h"
+#include "Utils.h"
+#include "CmdParam.h"
+#include "Logger.h"
+#include "PrlSrv.h"
+#include "PrlList.h"
+#include "PrlCleanup.h"
+#include "PrlAgent.h"
+#include "PrlHosts.h"
+
+/* stdin, stdout and stderr */
+#define AGENT_NFDS	3
+
+struct AgentCtx
+{
+	AgentCtx() : sock(-1), stop(false), hook(NULL), verbose(0)
+	{
+		for (int i = 0; i < AGENT_NFDS; i++)
+			std_fds[i] = -1;
+	}
+
+	int sock;
+	std::atomic<bool> stop;
+	/* the hooks registered after this one belong to the request */
+	const PrlHook *hook;
+	int verbose;
+	/* the agent own stdin, stdout and stderr */
+	int std_fds[AGENT_NFDS];
+};
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = (char *) buf;
+
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char *) buf;
+
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void close_fds(int *fds)
+{
+	for (int i = 0; i < AGENT_NFDS; i++) {
+		if (fds[i] != -1)
+			close(fds[i]);
+		fds[i] = -1;
+	}
+}
+
+static int send_fds(int sock, const void *buf, size_t len, const int *fds)
+{
+	char ctl[CMSG_SPACE(AGENT_NFDS * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(ctl, 0, sizeof(ctl));
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(AGENT_NFDS * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, AGENT_NFDS * sizeof(int));
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) len ? 0 : -1;
+}
+
+static int recv_fds(int sock, void *buf, size_t len, int *fds)
+{
+	char ctl[CMSG_SPACE(AGENT_NFDS * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	for (int i = 0; i < AGENT_NFDS; i++)
+		fds[i] = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+
+	while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 &&
+			errno == EINTR)
+		;
+	if (n == -1)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+				cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		if (cmsg->cmsg_len == CMSG_LEN(AGENT_NFDS * sizeof(int)))
+			memcpy(fds, CMSG_DATA(cmsg), AGENT_NFDS * sizeof(int));
+	}
+
+	if (n != (ssize_t) len || (msg.msg_flags & MSG_CTRUNC) ||
+			fds[0] == -1) {
+		close_fds(fds);
+		return -1;
+	}
+	return 0;
+}
+
+static const char *get_agent_socket()
+{
+	const char *path = getenv(AGENT_SOCKET_ENV);
+
+	return path != NULL ? path : AGENT_SOCKET;
+}
+
+static int agent_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool agent_can_forward(const CmdParamData &param)
+{
+	/* a remote login may ask for the password */
+	if (!param.login.server.empty() || is_multi_host(param))
+		return false;
+	/* the spans and timings are recorded by this process */
+	if (trace_enabled() || timing_enabled())
+		return false;
+
+	switch (param.action) {
+	case InvalidAction:
+	case VmAgentAction:
+	/* the interactive and endless commands */
+	case VmEnterAction:
+	case VmConsoleAction:
+	case VmExecAction:
+	case VmMonitorAction:
+	/* the load has to come from this process */
+	case VmBenchAction:
+	/* these may log in to another server */
+	case VmMigrateAction:
+	case VmBackupAction:
+	case VmRestoreAction:
+	case VmBackupListAction:
+	case VmBackupDeleteAction:
+		return false;
+	case VmListAction:
+		return !param.list_watch;
+	case VmPerfStatsAction:
+		return !param.statistics.loop;
+	default:
+		return true;
+	}
+}
+
+static void agent_cancel(void *data)
+{
+	char c = AGENT_CANCEL;
+
+	prl_log(0, "\nCanceling the command...");
+	if (send(*(int *) data, &c, 1, MSG_NOSIGNAL) != 1)
+		prl_log(L_DEBUG, "Unable to cancel the command: %m");
+}
+
+/* Run the command by the agent if it is running.
+ * Returns -1 if the command has to be run directly.
+ */
+int agent_forward(int argc, char **argv, int &exitcode)
+{
+	const char *path = get_agent_socket();
+	int fds[AGENT_NFDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+	char cwd[PATH_MAX];
+	AgentRequest req;
+	std::string data;
+	int sock, ret;
+
+	if (*path == '\0' || (sock = agent_connect(path)) == -1)
+		return -1;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		strcpy(cwd, "/");
+	data.append(cwd, strlen(cwd) + 1);
+	for (int i = 0; i < argc; i++)
+		data.append(argv[i], strlen(argv[i]) + 1);
+
+	req.magic = AGENT_MAGIC;
+	req.argc = argc;
+	req.len = data.size();
+	if (data.size() > AGENT_MAX_REQUEST ||
+			send_fds(sock, &req, sizeof(req), fds) ||
+			write_all(sock, data.data(), data.size())) {
+		prl_log(L_DEBUG, "Unable to pass the command to the agent");
+		close(sock);
+		return -1;
+	}
+	prl_log(L_DEBUG, "The command is run by the agent at %s", path);
+
+	const PrlHook *h = get_cleanup_ctx().register_hook(agent_cancel, &sock);
+	ret = read_all(sock, &exitcode, sizeof(exitcode));
+	get_cleanup_ctx().unregister_hook(h);
+	close(sock);
+
+	if (ret)
+		exitcode = prlerr2exitcode(prl_err(-1, "The connection to the"
+					" agent at %s is lost", path));
+	return 0;
+}
+
+static int agent_listen(const std::string &path)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd, ret;
+
+	if (path.size() >= sizeof(addr.sun_path))
+		return prl_err(-1, "The socket path is too long: %s",
+				path.c_str());
+
+	if ((fd = agent_connect(path.c_str())) != -1) {
+		close(fd);
+		return prl_err(-1, "The agent is already running at %s",
+				path.c_str());
+	}
+	/* the socket of a dead agent */
+	unlink(path.c_str());
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return prl_err(-1, "socket: %m");
+
+	/* the commands are run with the agent credentials */
+	mask = umask(0177);
+	ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(mask);
+	if (ret) {
+		prl_err(-1, "Unable to bind to %s: %m", path.c_str());
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, SOMAXCONN)) {
+		prl_err(-1, "listen: %m");
+		close(fd);
+		unlink(path.c_str());
+		return -1;
+	}
+
+	return fd;
+}
+
+static void stop_agent(void *data)
+{
+	AgentCtx *ctx = (AgentCtx *) data;
+
+	ctx->stop = true;
+	/* wake up accept() */
+	shutdown(ctx->sock, SHUT_RDWR);
+}
+
+/* Cancel the command if the client asks for it or goes away */
+static void agent_watch_client(int sock, int stop_fd, const PrlHook *mark)
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_fd;
+	pfd[1].events = POLLIN;
+
+	while (poll(pfd, 2, -1) == -1 && errno == EINTR)
+		;
+	if (pfd[1].revents || !pfd[0].revents)
+		return;
+
+	PrlCleanup::do_cleanup_after(mark);
+}
+
+int PrlSrv::agent_run(int sock, int argc, char **argv, AgentCtx &ctx)
+{
+	int stop_fd[2];
+	int ret;
+
+	prl_set_log_verbose(ctx.verbose);
+	g_vzcompat_mode = false;
+	g_nJobTimeout = JOB_INFINIT_WAIT_TIMEOUT;
+
+	cmdParam cmd;
+	CmdParamData param = cmd.get_vm(argc, argv);
+	param.original_id = param.id;
+	normalize_uuid(param.original_id, param.id);
+
+	if (!agent_can_forward(param))
+		return prl_err(-1, "The command can not be run by the agent");
+	/* the agent keeps the list cache up to date */
+	if (param.action == VmListAction && m_list_cache != NULL)
+		param.list_cache = true;
+
+	if (pipe2(stop_fd, O_CLOEXEC))
+		return prl_err(-1, "pipe: %m");
+	std::thread watcher(agent_watch_client, sock, stop_fd[0], ctx.hook);
+
+	ret = get_error(param.action, run_action(param));
+
+	close(stop_fd[1]);
+	watcher.join();
+	close(stop_fd[0]);
+
+	return ret;
+}
+
+int PrlSrv::agent_request(int sock, AgentCtx &ctx)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int fds[AGENT_NFDS];
+	std::vector<char *> argv;
+	AgentRequest req;
+	int ret, exitcode;
+
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return prl_err(-1, "getsockopt(SO_PEERCRED): %m");
+	if (cred.uid != geteuid())
+		return prl_err(-1, "The request of the user %d is rejected",
+				cred.uid);
+
+	if (recv_fds(sock, &req, sizeof(req), fds))
+		return prl_err(-1, "Unable to receive the request");
+	if (req.magic != AGENT_MAGIC || req.argc < 2 ||
+			req.len == 0 || req.len > AGENT_MAX_REQUEST) {
+		close_fds(fds);
+		return prl_err(-1, "Invalid request");
+	}
+
+	std::string data(req.len, '\0');
+	if (read_all(sock, &data[0], data.size()) ||
+			data[data.size() - 1] != '\0') {
+		close_fds(fds);
+		return prl_err(-1, "Unable to receive the request");
+	}
+	for (size_t pos = 0; pos < data.size(); pos += strlen(&data[pos]) + 1)
+		argv.push_back(&data[pos]);
+	/* the working directory comes first */
+	if (argv.size() != req.argc + 1) {
+		close_fds(fds);
+		return prl_err(-1, "Invalid request");
+	}
+	argv.push_back(NULL);
+
+	/* the command talks to the client terminal */
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < AGENT_NFDS; i++)
+		dup2(fds[i], i);
+	close_fds(fds);
+
+	if (chdir(argv[0]))
+		ret = prl_err(-1, "Unable to change the directory to %s: %m",
+				argv[0]);
+	else
+		ret = agent_run(sock, req.argc, &argv[1], ctx);
+
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < AGENT_NFDS; i++)
+		dup2(ctx.std_fds[i], i);
+	if (chdir("/"))
+		prl_log(L_DEBUG, "chdir(/): %m");
+
+	/* nothing of the request is kept but the session */
+	get_cleanup_ctx().unregister_after(ctx.hook);
+	prl_set_log_verbose(ctx.verbose);
+	reset_caches();
+
+	exitcode = prlerr2exitcode(ret);
+	if (write_all(sock, &exitcode, sizeof(exitcode)))
+		prl_log(L_DEBUG, "Unable to send the exit code: %m");
+
+	return 0;
+}
+
+int PrlSrv::agent(const CmdParamData &param)
+{
+	std::string path = param.agent_socket.empty() ?
+		AGENT_SOCKET : param.agent_socket;
+	PrlListCache cache(get_uuid());
+	AgentCtx ctx;
+	int ret = 0;
+
+	/* a client may go away at any time */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int i = 0; i < AGENT_NFDS; i++) {
+		ctx.std_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, AGENT_NFDS);
+		if (ctx.std_fds[i] == -1) {
+			ret = prl_err(-1, "Unable to duplicate the descriptor"
+					" %d: %m", i);
+			close_fds(ctx.std_fds);
+			return ret;
+		}
+	}
+
+	if ((ctx.sock = agent_listen(path)) == -1) {
+		close_fds(ctx.std_fds);
+		return -1;
+	}
+
+	if (cache.lock_monitor() == 0) {
+		m_list_cache = &cache;
+		reg_event_callback(server_event_handler_cache, this);
+	}
+
+	ctx.verbose = prl_get_log_verbose();
+	ctx.hook = get_cleanup_ctx().register_hook(stop_agent, &ctx);
+
+	prl_log(0, "The agent is listening at %s", path.c_str());
+	while (!ctx.stop) {
+		int sock = accept4(ctx.sock, NULL, NULL, SOCK_CLOEXEC);
+
+		if (sock == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (!ctx.stop)
+				ret = prl_err(-1, "accept: %m");
+			break;
+		}
+		agent_request(sock, ctx);
+		close(sock);
+	}
+
+	get_cleanup_ctx().unregister_hook(ctx.hook);
+	if (m_list_cache != NULL) {
+		unreg_event_callback(server_event_handler_cache, this);
+		m_list_cache = NULL;
+	}
+	close(ctx.sock);
+	unlink(path.c_str());
+	close_fds(ctx.std_fds);
+
+	return ret;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef __PRLAGENT_H__
+#define __PRLAGENT_H__
+
+#define AGENT_SOCKET		"/run/prlctl.sock"
+/* Overrides the agent socket path, an empty value disables the agent */
+#define AGENT_SOCKET_ENV	"PRLCTL_AGENT_SOCKET"
+
+#define AGENT_MAGIC		0x50524c41
+#define AGENT_MAX_REQUEST	(1024 * 1024)
+/* Sent by the client to cancel the running command */
+#define AGENT_CANCEL		'c'
+
+/* The request header, followed by the client working directory and
+ * the command line arguments, all NUL-terminated. The client stdin,
+ * stdout and stderr are passed along with the header. The agent replies
+ * with the command exit code.
+ */
+struct AgentRequest
+{
+	unsigned int magic;
+	unsigned int argc;
+	unsigned int len;
+};
+
+class CmdParamData;
+
+bool agent_can_forward(const CmdParamData &param);
+int agent_forward(int argc, char **argv, int &exitcode);
+
+#endif // __PRLAGENT_H__
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "PrlTypes.h"
+#include "Utils.h"
+#include "CmdParam.h"
+#include "Logger.h"
+#include "PrlSrv.h"
+#include "PrlVm.h"
+
+struct ApplyKey
+{
+	const char *name;
+	int id;
+};
+
+/* The set options whose current values can be compared with the wanted
+ * ones, named as on the command line.
+ */
+static const ApplyKey apply_keys[] = {
+	{"cpus", CMD_CPUS},
+	{"cpu-sockets", CMD_CPU_SOCKETS},
+	{"memsize", CMD_MEMSIZE},
+	{"cpuunits", CMD_CPUUNITS},
+	{"cpulimit", CMD_CPULIMIT},
+	{"cpumask", CMD_CPUMASK},
+	{"nodemask", CMD_NODEMASK},
+	{"ioprio", CMD_IOPRIO},
+	{"iolimit", CMD_IOLIMIT},
+	{"iopslimit", CMD_IOPSLIMIT},
+	{"description", CMD_DESC},
+	{"hostname", CMD_HOSTNAME},
+	{"autostart-delay", CMD_AUTOSTART_DELAY},
+	{"ha-enable", CMD_HA_ENABLE},
+	{"ha-prio", CMD_HA_PRIO},
+	{NULL, 0}
+};
+
+typedef std::vector<std::pair<const ApplyKey *, std::string> > apply_opts_t;
+
+struct ApplyVm
+{
+	ApplyVm() : ret(0) {}
+
+	std::string id;
+	/* the options in the order of the spec */
+	apply_opts_t opts;
+	CmdParamData want;
+	std::string name;
+	/* "option current -> wanted" of the options which differ */
+	str_list_t delta;
+	int ret;
+};
+
+static const ApplyKey *find_apply_key(const std::string &name)
+{
+	for (const ApplyKey *k = apply_keys; k->name != NULL; ++k)
+		if (name == k->name)
+			return k;
+	return NULL;
+}
+
+/* Parse the options the way "prlctl set <id> --opt val..." does */
+static int parse_set(const std::string &id, const apply_opts_t &opts,
+		CmdParamData &param)
+{
+	std::vector<std::string> args;
+	std::vector<char *> argv;
+	cmdParam cmd;
+
+	args.push_back("prlctl");
+	args.push_back("set");
+	args.push_back(id);
+	for (apply_opts_t::const_iterator it = opts.begin(); it != opts.end(); ++it) {
+		args.push_back(std::string("--") + it->first->name);
+		args.push_back(it->second);
+	}
+	for (size_t i = 0; i < args.size(); i++)
+		argv.push_back(&args[i][0]);
+	argv.push_back(NULL);
+
+	param = cmd.get_vm(argv.size() - 1, &argv[0]);
+	if (param.action == InvalidAction)
+		return -1;
+	param.original_id = param.id;
+	normalize_uuid(param.original_id, param.id);
+
+	return 0;
+}
+
+static std::string ui2str(unsigned int ui)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%u", ui);
+	return buf;
+}
+
+static std::string cpulimit2str(const PRL_CPULIMIT_DATA &cpulimit)
+{
+	return ui2str(cpulimit.value) +
+		(cpulimit.type == PRL_CPULIMIT_MHZ ? "Mhz" : "%");
+}
+
+/* The value of the option the VM has now */
+static std::string get_current(PrlVm *vm, int id)
+{
+	PRL_CPULIMIT_DATA cpulimit;
+	unsigned int ui = 0;
+	std::string str;
+
+	switch (id) {
+	case CMD_CPUS:
+		return ui2str(vm->get_cpu_cores());
+	case CMD_CPU_SOCKETS:
+		return ui2str(vm->get_cpu_sockets());
+	case CMD_MEMSIZE:
+		return ui2str(vm->get_memsize());
+	case CMD_CPUUNITS:
+		return vm->get_cpuunits(&ui) ? "" : ui2str(ui);
+	case CMD_CPULIMIT:
+		memset(&cpulimit, 0, sizeof(cpulimit));
+		return vm->get_cpulimit(&cpulimit) ? "" : cpulimit2str(cpulimit);
+	case CMD_CPUMASK:
+		return vm->get_cpumask();
+	case CMD_NODEMASK:
+		vm->get_nodemask(str);
+		return str;
+	case CMD_IOPRIO:
+		return vm->get_ioprio(&ui) ? "" : ui2str(ui);
+	case CMD_IOLIMIT:
+		return vm->get_iolimit(&ui) ? "" : ui2str(ui);
+	case CMD_IOPSLIMIT:
+		return vm->get_iopslimit(&ui) ? "" : ui2str(ui);
+	case CMD_DESC:
+		return vm->get_desc();
+	case CMD_HOSTNAME:
+		return vm->get_hostname();
+	case CMD_AUTOSTART_DELAY:
+		return ui2str(vm->get_autostart_delay());
+	case CMD_HA_ENABLE:
+		return vm->get_ha_enable() ? "yes" : "no";
+	case CMD_HA_PRIO:
+		return ui2str(vm->get_ha_prio());
+	default:
+		return "";
+	}
+}
+
+/* The parsed wanted value of the option, in the form of get_current() */
+static std::string get_wanted(const CmdParamData &param, int id)
+{
+	switch (id) {
+	case CMD_CPUS:
+		return ui2str(param.cpu_cores.get_value_or(0));
+	case CMD_CPU_SOCKETS:
+		return ui2str(param.cpu_sockets.get_value_or(0));
+	case CMD_MEMSIZE:
+		return ui2str(param.memsize);
+	case CMD_CPUUNITS:
+		return ui2str(param.cpuunits);
+	case CMD_CPULIMIT:
+		return cpulimit2str(param.cpulimit);
+	case CMD_CPUMASK:
+		return param.cpumask == "all" ? "" : param.cpumask;
+	case CMD_NODEMASK:
+		return param.nodemask == "all" ? "" : param.nodemask;
+	case CMD_IOPRIO:
+		return ui2str(param.ioprio);
+	case CMD_IOLIMIT:
+		return ui2str(param.iolimit);
+	case CMD_IOPSLIMIT:
+		return ui2str(param.iopslimit);
+	case CMD_DESC:
+		return param.desc.get_value_or("");
+	case CMD_HOSTNAME:
+		return param.hostname;
+	case CMD_AUTOSTART_DELAY:
+		return ui2str(param.autostart_delay);
+	case CMD_HA_ENABLE:
+		return param.ha_enable ? "yes" : "no";
+	case CMD_HA_PRIO:
+		return ui2str((unsigned int) param.ha_prio);
+	default:
+		return "";
+	}
+}
+
+static std::string quote_value(const std::string &val)
+{
+	if (val.empty() || val.find(' ') != std::string::npos)
+		return "\"" + val + "\"";
+	return val;
+}
+
+/* The spec is a JSON object with the wanted set options of every VE:
+ *	{ "<ID | NAME>": { "<option>": "<value>", ... }, ... }
+ */
+static int read_apply_spec(const std::string &file, std::vector<ApplyVm> &vms)
+{
+	boost::property_tree::ptree t;
+	const char *name = file.empty() ? "-" : file.c_str();
+	int ret = 0;
+
+	try {
+		if (file.empty() || file == "-") {
+			boost::property_tree::json_parser::read_json(std::cin, t);
+		} else {
+			std::ifstream is(file.c_str());
+
+			if (!is)
+				return prl_err(-1, "Unable to open %s: %m", name);
+			boost::property_tree::json_parser::read_json(is, t);
+		}
+	} catch (const boost::property_tree::json_parser::json_parser_error &e) {
+		return prl_err(-1, "%s:%lu: %s", name, e.line(),
+				e.message().c_str());
+	}
+
+	BOOST_FOREACH(const boost::property_tree::ptree::value_type &v, t) {
+		ApplyVm vm;
+
+		vm.id = v.first;
+		if (vm.id.empty() || v.second.empty()) {
+			ret = prl_err(-1, "%s: every virtual environment has to be"
+					" an object of options", name);
+			continue;
+		}
+		BOOST_FOREACH(const boost::property_tree::ptree::value_type &o,
+				v.second) {
+			const ApplyKey *k = find_apply_key(o.first);
+
+			if (k == NULL) {
+				ret = prl_err(-1, "%s: %s: the %s option can not be"
+						" applied", name, vm.id.c_str(),
+						o.first.c_str());
+				continue;
+			}
+			if (!o.second.empty()) {
+				ret = prl_err(-1, "%s: %s: the value of %s has to be"
+						" a string or a number", name,
+						vm.id.c_str(), o.first.c_str());
+				continue;
+			}
+			vm.opts.push_back(std::make_pair(k, o.second.data()));
+		}
+		if (ret == 0 && parse_set(vm.id, vm.opts, vm.want))
+			ret = prl_err(-1, "%s: %s: invalid options", name,
+					vm.id.c_str());
+		vms.push_back(vm);
+	}
+
+	return ret;
+}
+
+/* Bring the VEs to the configuration of the spec. Only the options which
+ * differ from the current values are set, and the VEs without any
+ * difference are not committed at all.
+ */
+int PrlSrv::apply(const CmdParamData &param)
+{
+	std::vector<ApplyVm> vms;
+	std::mutex lock;
+	unsigned int done = 0;
+	int ret;
+
+	/* nothing is changed unless the whole spec is valid */
+	if ((ret = read_apply_spec(param.apply_file, vms)))
+		return ret;
+	if (vms.empty()) {
+		fprintf(stdout, "No virtual environments are specified\n");
+		return 0;
+	}
+
+	/* the per-VE messages do not tell which VE they are about */
+	int verbose = prl_get_log_verbose();
+	if (verbose == L_NORMAL)
+		prl_set_log_verbose(L_ERR);
+
+	auto print = [&](const ApplyVm &a) {
+		std::lock_guard<std::mutex> g(lock);
+		fprintf(stdout, "[%u/%u] %s: ", ++done, (unsigned int) vms.size(),
+				a.name.empty() ? a.id.c_str() : a.name.c_str());
+		if (a.ret)
+			fprintf(stdout, "failed\n");
+		else if (a.delta.empty())
+			fprintf(stdout, "up to date\n");
+		else
+			fprintf(stdout, "%s %s\n", param.dry_run ? "would change" :
+					"changed", boost::algorithm::join(a.delta, ", ").c_str());
+		fflush(stdout);
+	};
+
+	/* the configs of all the VEs are requested at once */
+	std::vector<std::string> ids;
+	std::vector<PrlVm *> found;
+	std::vector<int> rets;
+
+	for (size_t i = 0; i < vms.size(); i++)
+		ids.push_back(vms[i].want.id);
+	if ((ret = get_vm_configs(ids, found, PGVC_SEARCH_BY_UUID |
+				PGVC_SEARCH_BY_NAME, &rets))) {
+		prl_set_log_verbose(verbose);
+		return ret;
+	}
+
+	std::vector<std::unique_ptr<PrlVm> > holders(found.begin(), found.end());
+	std::vector<unsigned int> commit;
+	std::vector<CmdParamData> deltas(vms.size());
+
+	for (size_t i = 0; i < vms.size(); i++) {
+		ApplyVm &a = vms[i];
+		PrlVm *vm = found[i];
+		apply_opts_t changed;
+
+		prl_set_log_prefix(a.id.c_str());
+		a.ret = rets[i];
+		if (a.ret == 0 && vm == NULL)
+			a.ret = prl_err(-1, "The virtual environment does not exist.");
+		if (a.ret == 0) {
+			a.name = vm->get_name();
+			for (apply_opts_t::const_iterator it = a.opts.begin();
+					it != a.opts.end(); ++it) {
+				std::string cur = get_current(vm, it->first->id);
+				std::string want = get_wanted(a.want, it->first->id);
+
+				if (cur == want)
+					continue;
+				changed.push_back(*it);
+				a.delta.push_back(std::string(it->first->name) + " " +
+						quote_value(cur) + " -> " +
+						quote_value(want));
+			}
+		}
+		if (a.ret == 0 && !changed.empty() && !param.dry_run)
+			a.ret = parse_set(a.id, changed, deltas[i]);
+		prl_set_log_prefix(NULL);
+
+		if (a.ret == 0 && !changed.empty() && !param.dry_run)
+			commit.push_back(i);
+		else
+			print(a);
+	}
+
+	/* a commit takes several jobs, so each runs on a worker of its own */
+	run_parallel(commit.size(), param.parallel, [&](unsigned int n) {
+		unsigned int i = commit[n];
+		ApplyVm &a = vms[i];
+		PrlVm *vm = holders[i].get();
+
+		prl_set_log_prefix(a.id.c_str());
+		if ((a.ret = vm->update_state()) == 0)
+			a.ret = run_vm_action(vm, deltas[i]);
+		prl_set_log_prefix(NULL);
+		print(a);
+	});
+
+	prl_set_log_verbose(verbose);
+
+	unsigned int changed = 0, uptodate = 0, failed = 0;
+	for (size_t i = 0; i < vms.size(); i++) {
+		if (vms[i].ret) {
+			failed++;
+			if (ret == 0)
+				ret = vms[i].ret;
+		} else if (vms[i].delta.empty())
+			uptodate++;
+		else
+			changed++;
+	}
+	fprintf(stdout, "%u virtual environments %s, %u up to date, %u failed\n",
+			changed, param.dry_run ? "to change" : "changed",
+			uptodate, failed);
+
+	return ret;
+}
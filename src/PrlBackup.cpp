@@ -420,6 +420,7 @@ int PrlSrv::do_vm_abackup(const PrlVm& vm, const BackupParam& param)
 	PRL_UINT32 n;
 	std::string err;
 	PrlHandle hResult;
+	TraceSpan span("abackup", vm.get_uuid());
 
 	PrlHandle j(PrlVm_BeginBackup(vm.get_handle(), PBMBF_CREATE_MAP));
 	if ((ret = get_job_result(j, hResult.get_ptr(), &n))) {
@@ -461,7 +462,10 @@ int PrlSrv::do_vm_abackup(const PrlVm& vm, const BackupParam& param)
 		if (bmap.get() == NULL)
 			break;
 
-		rc = store(hDisk, i, bmap.get(), param.path);
+		{
+			TraceSpan s("store");
+			rc = store(hDisk, i, bmap.get(), param.path);
+		}
 		if (rc)
 			break;
 		ret = 0;
@@ -0,0 +1,771 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "PrlTypes.h"
+#include "Utils.h"
+#include "CmdParam.h"
+#include "Logger.h"
+#include "PrlSrv.h"
+#include "PrlVm.h"
+#include "PrlCleanup.h"
+#include "PrlHosts.h"
+#include "PrlJobMux.h"
+
+/* How long the VEs of a wave may take to report the running state
+ * after their start is done, unless --timeout is given */
+#define WAVE_RUN_TIMEOUT	60
+
+struct BatchLine
+{
+	BatchLine() : no(0), ret(0), done(false) {}
+
+	unsigned int no;
+	CmdParamData param;
+	/* the VM of a line run in parallel */
+	std::shared_ptr<PrlVm> vm;
+	int ret;
+	bool done;
+};
+
+/* The state the action puts a VE in, VMS_UNKNOWN if there is no such */
+static VIRTUAL_MACHINE_STATE action_state(Action action)
+{
+	switch (action) {
+	case VmStartAction:
+	case VmResumeAction:
+		return VMS_RUNNING;
+	case VmStopAction:
+		return VMS_STOPPED;
+	case VmSuspendAction:
+		return VMS_SUSPENDED;
+	default:
+		return VMS_UNKNOWN;
+	}
+}
+
+/* Runs the one-job actions of the VEs, up to max of them at a time. The
+ * jobs are started from the calling thread and waited for by the waiters
+ * of a PrlJobMux, so no thread is held by a VE waiting for the dispatcher.
+ */
+class VmJobRunner : private boost::noncopyable
+{
+public:
+	/* Gets the exit code of the action and whether it is skipped; returns
+	 * true if the slot of the action is taken over by the next one started
+	 * with start() */
+	typedef std::function<bool (int, bool)> done_t;
+
+	/* skip_done: the VEs already in the state the action puts them in
+	 * are skipped */
+	VmJobRunner(PrlSrv &srv, unsigned int max, bool skip_done = false) :
+		m_srv(srv),
+		m_running(0),
+		m_max(max),
+		m_skip_done(skip_done),
+		m_mux(max)
+	{
+	}
+
+	~VmJobRunner()
+	{
+		wait();
+		for (PRL_EVENT_HANDLER_PTR fn : m_handlers)
+			m_srv.unreg_event_callback(fn);
+	}
+
+	/* Wait for a free slot and start the action in it */
+	void run(PrlVm *vm, const CmdParamData &param, const done_t &done)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return m_running < m_max; });
+			m_running++;
+		}
+		start(vm, param, done);
+	}
+
+	/* Start the action in the slot of the one whose done() calls it */
+	void start(PrlVm *vm, const CmdParamData &param, const done_t &done)
+	{
+		const CmdParamData *p = &param;
+		PrlHandle hJob;
+		int rc;
+
+		prl_set_log_prefix(vm->get_name().c_str());
+		if ((rc = vm->update_state()) == 0) {
+			if (m_skip_done &&
+					vm->get_state() == action_state(param.action)) {
+				prl_set_log_prefix(NULL);
+				finish(done, 0, true);
+				return;
+			}
+			reg_event_handler(param);
+			rc = vm->action_job(param, hJob.get_ptr());
+		}
+		prl_set_log_prefix(NULL);
+		if (rc) {
+			finish(done, get_error(param.action, rc));
+			return;
+		}
+		m_mux.submit(hJob.get_handle(), [this, vm, p, done](PRL_HANDLE,
+					PRL_RESULT ret, const std::string &err) {
+			prl_set_log_prefix(vm->get_name().c_str());
+			int rc = vm->action_done(*p, ret, err);
+			prl_set_log_prefix(NULL);
+			finish(done, get_error(p->action, rc));
+		});
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] { return m_running == 0; });
+	}
+
+private:
+	/* the server events of the action are registered once for all
+	 * the VEs and kept until the runner is gone */
+	void reg_event_handler(const CmdParamData &param)
+	{
+		PRL_EVENT_HANDLER_PTR fn = PrlVm::action_event_handler(param);
+
+		if (fn == NULL)
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_handlers.insert(fn).second)
+			m_srv.reg_event_callback(fn);
+	}
+
+	void finish(const done_t &done, int rc, bool skipped = false)
+	{
+		if (done(rc, skipped))
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running--;
+		m_cond.notify_all();
+	}
+
+	PrlSrv &m_srv;
+	std::set<PRL_EVENT_HANDLER_PTR> m_handlers;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	unsigned int m_running;
+	unsigned int m_max;
+	bool m_skip_done;
+	/* the last one, its waiters use the members above */
+	PrlJobMux m_mux;
+};
+
+/* Split the line into arguments the way the shell does it for the
+ * simple cases: blanks, '' and "" quoting, \ escapes and # comments.
+ */
+static int split_args(const std::string &line, str_list_t &args)
+{
+	std::string arg;
+	bool in_arg = false;
+	char quote = 0;
+
+	for (size_t i = 0; i < line.size(); i++) {
+		char c = line[i];
+
+		if (quote) {
+			if (c == quote)
+				quote = 0;
+			else if (c == '\\' && quote == '"' && i + 1 < line.size())
+				arg += line[++i];
+			else
+				arg += c;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			in_arg = true;
+		} else if (c == '\\' && i + 1 < line.size()) {
+			arg += line[++i];
+			in_arg = true;
+		} else if (isspace((unsigned char) c)) {
+			if (in_arg)
+				args.push_back(arg);
+			arg.clear();
+			in_arg = false;
+		} else if (c == '#' && !in_arg) {
+			break;
+		} else {
+			arg += c;
+			in_arg = true;
+		}
+	}
+	if (quote)
+		return -1;
+	if (in_arg)
+		args.push_back(arg);
+
+	return 0;
+}
+
+static int batch_parse(str_list_t &args, unsigned int no, CmdParamData &param)
+{
+	std::vector<char *> argv;
+	cmdParam cmd;
+
+	argv.push_back((char *) "prlctl");
+	for (str_list_t::iterator it = args.begin(); it != args.end(); ++it) {
+		/* these exit right after the parsing */
+		if (*it == "--help" || *it == "--version")
+			return prl_err(-1, "Line %u: %s can not be used in batch",
+					no, it->c_str());
+		argv.push_back(&(*it)[0]);
+	}
+	argv.push_back(NULL);
+
+	param = cmd.get_vm(argv.size() - 1, &argv[0]);
+	if (param.action == InvalidAction)
+		return prl_err(-1, "Line %u: invalid command", no);
+	param.original_id = param.id;
+	normalize_uuid(param.original_id, param.id);
+
+	switch (param.action) {
+	case VmAgentAction:
+	case VmBatchAction:
+	case VmMonitorAction:
+	case VmEnterAction:
+	case VmConsoleAction:
+		return prl_err(-1, "Line %u: the %s command can not be used"
+				" in batch", no, args.front().c_str());
+	default:
+		break;
+	}
+	/* all the lines are run within one session */
+	if (!param.login.server.empty())
+		return prl_err(-1, "Line %u: the -l option can not be used"
+				" in batch", no);
+	if (is_multi_host(param))
+		return prl_err(-1, "Line %u: the --hosts option can not be used"
+				" in batch", no);
+
+	return 0;
+}
+
+/* The commands which are safe to run for different VMs at once */
+static bool batch_parallel(const CmdParamData &param)
+{
+	/* --all and --filter run in parallel by themselves */
+	if (param.id.empty())
+		return false;
+
+	switch (param.action) {
+	case VmStartAction:
+	case VmStopAction:
+	case VmResetAction:
+	case VmRestartAction:
+	case VmSuspendAction:
+	case VmResumeAction:
+	case VmPauseAction:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void batch_report(const BatchLine &l)
+{
+	if (!l.done)
+		return;
+	fprintf(stdout, "Line %u: exit code %d\n", l.no, prlerr2exitcode(l.ret));
+	fflush(stdout);
+}
+
+/* Run the lines [begin, end) which are all batch_parallel(): the lines
+ * of the same VM one after another, the different VMs in parallel.
+ */
+static void batch_run(PrlSrv &srv, std::vector<BatchLine> &lines,
+		size_t begin, size_t end, unsigned int jobs,
+		const std::atomic<bool> &stop)
+{
+	std::vector<std::vector<size_t> > groups;
+	std::map<std::string, size_t> vm_group;
+
+	std::vector<std::string> ids;
+	std::vector<PrlVm *> found;
+	std::vector<int> rets;
+
+	for (size_t i = begin; i < end; i++)
+		ids.push_back(lines[i].param.id);
+	int ret = srv.get_vm_configs(ids, found, PGVC_SEARCH_BY_UUID |
+			PGVC_SEARCH_BY_NAME, &rets);
+	if (ret)
+		found.assign(ids.size(), NULL);
+	for (size_t i = begin; i < end; i++) {
+		BatchLine &l = lines[i];
+
+		l.vm.reset(found[i - begin]);
+		l.ret = ret ? ret : rets[i - begin];
+		if (l.ret == 0 && !l.vm)
+			l.ret = prl_err(-1, "The %s virtual machine does not exist.",
+					l.param.id.c_str());
+		if (l.ret)
+			l.done = true;
+	}
+
+	/* a VM may be referred to by both its ID and name */
+	for (size_t i = begin; i < end; i++) {
+		if (lines[i].done)
+			continue;
+
+		std::string uuid = lines[i].vm->get_uuid();
+		std::map<std::string, size_t>::iterator it = vm_group.find(uuid);
+
+		if (it == vm_group.end()) {
+			it = vm_group.insert(std::make_pair(uuid, groups.size())).first;
+			groups.push_back(std::vector<size_t>());
+		}
+		groups[it->second].push_back(i);
+	}
+
+	/* the next line of the VM is started in the slot of the previous one */
+	VmJobRunner runner(srv, jobs);
+	std::function<void (size_t, size_t)> run_line = [&](size_t g, size_t k) {
+		size_t i = groups[g][k];
+		VmJobRunner::done_t done = [&, g, k, i](int rc, bool) {
+			lines[i].ret = rc;
+			lines[i].done = true;
+			if (stop || k + 1 == groups[g].size())
+				return false;
+			run_line(g, k + 1);
+			return true;
+		};
+
+		if (k == 0)
+			runner.run(lines[i].vm.get(), lines[i].param, done);
+		else
+			runner.start(lines[i].vm.get(), lines[i].param, done);
+	};
+	for (size_t g = 0; g < groups.size() && !stop; g++)
+		run_line(g, 0);
+	runner.wait();
+
+	for (size_t i = begin; i < end; i++)
+		lines[i].vm.reset();
+}
+
+static void stop_batch(void *data)
+{
+	*(std::atomic<bool> *) data = true;
+}
+
+int PrlSrv::batch(const CmdParamData &param)
+{
+	std::vector<BatchLine> lines;
+	std::atomic<bool> stop(false);
+	FILE *fp = stdin;
+	char *buf = NULL;
+	size_t size = 0;
+	ssize_t n;
+	unsigned int no = 0;
+	int ret = 0;
+
+	if (!param.batch_file.empty() && param.batch_file != "-") {
+		fp = fopen(param.batch_file.c_str(), "r");
+		if (fp == NULL)
+			return prl_err(-1, "Unable to open %s: %m",
+					param.batch_file.c_str());
+	}
+
+	/* nothing is run unless all the lines are valid */
+	while ((n = getline(&buf, &size, fp)) != -1) {
+		str_list_t args;
+		BatchLine l;
+
+		l.no = ++no;
+		if (split_args(std::string(buf, n), args)) {
+			ret = prl_err(-1, "Line %u: unterminated quote", no);
+			continue;
+		}
+		if (!args.empty() && args.front() == "prlctl")
+			args.pop_front();
+		if (args.empty())
+			continue;
+		if (batch_parse(args, no, l.param)) {
+			ret = -1;
+			continue;
+		}
+		lines.push_back(l);
+	}
+	free(buf);
+	if (fp != stdin)
+		fclose(fp);
+	if (ret)
+		return ret;
+
+	const PrlHook *h = get_cleanup_ctx().register_hook(stop_batch, &stop);
+
+	for (size_t i = 0; i < lines.size() && !stop;) {
+		size_t end = i + 1;
+
+		if (batch_parallel(lines[i].param)) {
+			while (end < lines.size() && batch_parallel(lines[end].param))
+				end++;
+			batch_run(*this, lines, i, end, param.parallel, stop);
+		} else {
+			lines[i].ret = get_error(lines[i].param.action,
+					run_action(lines[i].param));
+			lines[i].done = true;
+			m_VmList.del();
+		}
+
+		for (; i < end; i++) {
+			batch_report(lines[i]);
+			if (lines[i].ret && ret == 0)
+				ret = lines[i].ret;
+		}
+	}
+
+	get_cleanup_ctx().unregister_hook(h);
+
+	if (stop && ret == 0)
+		ret = prl_err(-1, "The batch is canceled");
+
+	return ret;
+}
+
+/* Gets the index of the VE, the exit code of its action and whether the
+ * VE is skipped as already in the state the action puts it in */
+typedef std::function<void (unsigned int, int, bool)> bulk_report_t;
+
+struct WaveWatch
+{
+	WaveWatch() : stop(false) {}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	/* the VEs of the current wave which are not running yet */
+	std::set<std::string> pending;
+	bool stop;
+};
+
+static int wave_event_handler(PRL_HANDLE hEvent, void *data)
+{
+	PrlHandle h(hEvent);
+	PrlHandle hParam;
+	WaveWatch *w = reinterpret_cast<WaveWatch *>(data);
+	PRL_HANDLE_TYPE type;
+	PRL_EVENT_TYPE evt_type;
+	PRL_CHAR buf[256];
+	PRL_UINT32 buflen = sizeof(buf);
+	int s;
+
+	if (PrlHandle_GetType(h.get_handle(), &type) || type != PHT_EVENT)
+		return 0;
+	if (PrlEvent_GetType(h.get_handle(), &evt_type) ||
+			evt_type != PET_DSP_EVT_VM_STATE_CHANGED)
+		return 0;
+	if (PrlEvent_GetParamByName(h.get_handle(), EVT_PARAM_VMINFO_VM_STATE,
+				hParam.get_ptr()) ||
+			PrlEvtPrm_ToInt32(hParam, &s) ||
+			(VIRTUAL_MACHINE_STATE)s != VMS_RUNNING)
+		return 0;
+	if (PrlEvent_GetIssuerId(h.get_handle(), buf, &buflen))
+		return 0;
+
+	std::lock_guard<std::mutex> lock(w->mutex);
+	if (w->pending.erase(buf))
+		w->cond.notify_all();
+
+	return 0;
+}
+
+static void stop_waves(void *data)
+{
+	WaveWatch *w = reinterpret_cast<WaveWatch *>(data);
+
+	std::lock_guard<std::mutex> lock(w->mutex);
+	w->stop = true;
+	w->cond.notify_all();
+}
+
+/* Start the VEs in waves of the same HA priority, the highest first.
+ * A wave is started when all the VEs of the previous one are reported
+ * running by the state events, the autostart delay of a VE is counted
+ * from the start of its wave.
+ */
+static int start_waves(PrlSrv &srv, const CmdParamData &param,
+		const std::vector<PrlVm *> &vms, const bulk_report_t &report)
+{
+	typedef std::map<unsigned int, std::vector<unsigned int>,
+			std::greater<unsigned int> > wave_map_t;
+	wave_map_t waves;
+	std::vector<unsigned int> delay(vms.size());
+	WaveWatch w;
+	unsigned int run_timeout = g_nJobTimeout == JOB_INFINIT_WAIT_TIMEOUT ?
+			WAVE_RUN_TIMEOUT : g_nJobTimeout / 1000;
+	int ret;
+
+	for (unsigned int i = 0; i < vms.size(); i++) {
+		waves[vms[i]->get_ha_prio()].push_back(i);
+		delay[i] = vms[i]->get_autostart_delay();
+	}
+
+	if ((ret = srv.reg_event_callback(wave_event_handler, &w)))
+		return ret;
+	const PrlHook *h = get_cleanup_ctx().register_hook(stop_waves, &w);
+
+	unsigned int no = 0;
+	for (wave_map_t::iterator it = waves.begin(); it != waves.end(); ++it) {
+		std::vector<unsigned int> &wave = it->second;
+		/* 0 - not started, 1 - started, 2 - failed, 3 - skipped */
+		std::vector<int> res(wave.size(), 0);
+
+		/* the workers pick the VEs in the order they are due */
+		std::stable_sort(wave.begin(), wave.end(),
+			[&](unsigned int a, unsigned int b) {
+				return delay[a] < delay[b];
+			});
+
+		{
+			std::lock_guard<std::mutex> lock(w.mutex);
+			if (w.stop)
+				break;
+			w.pending.clear();
+			for (unsigned int i : wave)
+				w.pending.insert(vms[i]->get_uuid());
+		}
+		fprintf(stdout, "Wave %u of %u: priority %u, %u virtual"
+				" environments\n", ++no, (unsigned int) waves.size(),
+				it->first, (unsigned int) wave.size());
+		fflush(stdout);
+
+		std::chrono::steady_clock::time_point begin =
+				std::chrono::steady_clock::now();
+
+		auto failed = [&](unsigned int n, int rc) {
+			res[n] = 2;
+			{
+				std::lock_guard<std::mutex> lock(w.mutex);
+				w.pending.erase(vms[wave[n]]->get_uuid());
+			}
+			report(wave[n], rc, false);
+		};
+
+		VmJobRunner runner(srv, param.parallel);
+		for (unsigned int n = 0; n < wave.size(); n++) {
+			PrlVm *vm = vms[wave[n]];
+			int rc;
+
+			{
+				std::unique_lock<std::mutex> lock(w.mutex);
+
+				w.cond.wait_until(lock, begin +
+						std::chrono::seconds(delay[wave[n]]),
+						[&] { return w.stop; });
+				if (w.stop)
+					break;
+			}
+			prl_set_log_prefix(vm->get_name().c_str());
+			rc = vm->update_state();
+			prl_set_log_prefix(NULL);
+			if (rc) {
+				failed(n, rc);
+			} else if (vm->get_state() == VMS_RUNNING) {
+				/* no event is coming for it */
+				{
+					std::lock_guard<std::mutex> lock(w.mutex);
+					w.pending.erase(vm->get_uuid());
+				}
+				res[n] = 3;
+				report(wave[n], 0, true);
+			} else {
+				runner.run(vm, param, [&, n](int rc, bool) {
+					res[n] = 1;
+					if (rc)
+						failed(n, rc);
+					return false;
+				});
+			}
+		}
+		runner.wait();
+
+		std::set<std::string> pending;
+		{
+			std::unique_lock<std::mutex> lock(w.mutex);
+
+			w.cond.wait_for(lock, std::chrono::seconds(run_timeout),
+					[&] { return w.stop || w.pending.empty(); });
+			pending.swap(w.pending);
+		}
+
+		for (unsigned int n = 0; n < wave.size(); n++) {
+			PrlVm *vm = vms[wave[n]];
+
+			if (res[n] != 1)
+				continue;
+			if (pending.count(vm->get_uuid())) {
+				if (w.stop)
+					continue;
+				/* the event may have been missed */
+				if (vm->update_state() == 0 &&
+						vm->get_state() == VMS_RUNNING) {
+					report(wave[n], 0, false);
+				} else {
+					report(wave[n], prl_err(-1, "%s has not reached"
+						" the running state in %u seconds",
+						vm->get_name().c_str(),
+						run_timeout), false);
+				}
+				continue;
+			}
+			report(wave[n], 0, false);
+		}
+	}
+
+	get_cleanup_ctx().unregister_hook(h);
+	srv.unreg_event_callback(wave_event_handler, &w);
+
+	return 0;
+}
+
+/* Run the action for the VEs selected by --all or --filter, up to
+ * --parallel of them at a time. The result of every VE is printed as soon
+ * as it is known, the failed ones are listed at the end.
+ */
+int PrlSrv::bulk_action(const CmdParamData &param)
+{
+	std::vector<PrlVm *> vms;
+	std::atomic<bool> stop(false);
+	std::mutex lock;
+	unsigned int done = 0, skipped = 0;
+	int ret;
+
+	if (!param.list_all && param.list_filter.empty())
+		return prl_err(-1, "The virtual environments have to be selected"
+				" by the ID, --all or --filter");
+	/* removing all the VEs by a typo is too easy */
+	if (param.action == VmDestroyAction && param.list_filter.empty())
+		return prl_err(-1, "The virtual environments to delete have to"
+				" be selected with --filter");
+
+	if ((ret = select_vms(param, vms)))
+		return ret;
+	if (vms.empty()) {
+		fprintf(stdout, "No virtual environments are selected\n");
+		return 0;
+	}
+
+	std::vector<int> rets(vms.size(), 0);
+	/* the per-VE messages do not tell which VE they are about */
+	int verbose = prl_get_log_verbose();
+	if (verbose == L_NORMAL)
+		prl_set_log_verbose(L_ERR);
+
+	const PrlHook *h = get_cleanup_ctx().register_hook(stop_batch, &stop);
+
+	bulk_report_t report = [&](unsigned int i, int rc, bool skip) {
+		std::lock_guard<std::mutex> g(lock);
+		rets[i] = rc;
+		if (skip)
+			skipped++;
+		if (skip)
+			fprintf(stdout, "[%u/%u] %s: skipped, already %s\n", ++done,
+					(unsigned int) vms.size(),
+					vms[i]->get_name().c_str(),
+					vmstate2str(vms[i]->get_state()));
+		else
+			fprintf(stdout, "[%u/%u] %s: %s\n", ++done,
+					(unsigned int) vms.size(),
+					vms[i]->get_name().c_str(),
+					rc ? "failed" : "done");
+		fflush(stdout);
+	};
+
+	int err = 0;
+	if (param.action == VmStartAction && param.start_waves)
+		err = start_waves(*this, param, vms, report);
+	else if (PrlVm::is_job_action(param)) {
+		VmJobRunner runner(*this, param.parallel, true);
+
+		for (unsigned int i = 0; i < vms.size() && !stop; i++)
+			runner.run(vms[i], param, [&, i](int rc, bool skip) {
+				report(i, rc, skip);
+				return false;
+			});
+		runner.wait();
+	} else
+		/* set and delete --force take several jobs for every VE */
+		run_parallel(vms.size(), param.parallel, [&](unsigned int i) {
+			PrlVm *vm = vms[i];
+			int rc;
+
+			if (stop)
+				return;
+			prl_set_log_prefix(vm->get_name().c_str());
+			if ((rc = vm->update_state()) == 0)
+				rc = get_error(param.action, run_vm_action(vm, param));
+			prl_set_log_prefix(NULL);
+			report(i, rc, false);
+		});
+
+	get_cleanup_ctx().unregister_hook(h);
+	prl_set_log_verbose(verbose);
+
+	unsigned int failed = 0;
+	for (unsigned int i = 0; i < vms.size(); i++) {
+		if (!rets[i])
+			continue;
+		if (failed++ == 0)
+			fprintf(stdout, "Failed:\n");
+		fprintf(stdout, "  %s %s (exit code %d)\n",
+				vms[i]->get_uuid().c_str(),
+				vms[i]->get_name().c_str(),
+				prlerr2exitcode(rets[i]));
+		if (ret == 0)
+			ret = rets[i];
+	}
+	fprintf(stdout, "%u of %u virtual environments done, %u failed",
+			done - failed - skipped, (unsigned int) vms.size(), failed);
+	if (skipped)
+		fprintf(stdout, ", %u skipped", skipped);
+	if (done < vms.size())
+		fprintf(stdout, ", %u not started",
+				(unsigned int) vms.size() - done);
+	fprintf(stdout, "\n");
+
+	if (err && ret == 0)
+		ret = err;
+	if (stop && ret == 0)
+		ret = prl_err(-1, "The operation is canceled");
+
+	return ret;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PrlTypes.h"
+#include "Utils.h"
+#include "CmdParam.h"
+#include "Logger.h"
+#include "PrlSrv.h"
+#include "PrlVm.h"
+#include "PrlOutFormatter.h"
+
+enum BenchOp {
+	BENCH_LIST,
+	BENCH_CONFIG,
+	BENCH_INFO,
+	BENCH_OPS
+};
+
+static const char *bench_op_name[BENCH_OPS] = {"list", "config", "info"};
+
+struct BenchStat
+{
+	BenchStat() : errors(0) {}
+
+	/* the latencies, us */
+	std::vector<long long> lat;
+	unsigned int errors;
+};
+
+/* nearest-rank percentile of the sorted values */
+static long long bench_percentile(const std::vector<long long> &v,
+		unsigned int p)
+{
+	if (v.empty())
+		return 0;
+
+	size_t i = (v.size() * p + 99) / 100;
+	return v[i ? i - 1 : 0];
+}
+
+/* The GetVmInfo request; update_state() only reads the cached config */
+static int bench_vm_info(PrlVm *vm)
+{
+	PrlHandle hJob(PrlVm_GetState(vm->get_handle()));
+	PrlHandle hResult;
+	PRL_UINT32 count;
+
+	return get_job_result(hJob.get_handle(), hResult.get_ptr(), &count);
+}
+
+static void print_bench_plain(const CmdParamData &param, unsigned int jobs,
+		double elapsed, const BenchStat *stat)
+{
+	fprintf(stdout, "Duration %.1f s, parallel %u, rate ", elapsed, jobs);
+	if (param.bench_rate)
+		fprintf(stdout, "%u/s\n", param.bench_rate);
+	else
+		fprintf(stdout, "unlimited\n");
+	fprintf(stdout, "%-8s %8s %8s %10s %10s %10s %10s %10s\n", "OP", "CALLS",
+			"ERRORS", "CALLS/S", "P50 MS", "P90 MS", "P99 MS", "MAX MS");
+	for (unsigned int op = 0; op <= BENCH_OPS; op++) {
+		const BenchStat &s = stat[op];
+
+		if (s.lat.empty())
+			continue;
+		fprintf(stdout, "%-8s %8u %8u %10.1f %10.3f %10.3f %10.3f %10.3f\n",
+				op == BENCH_OPS ? "total" : bench_op_name[op],
+				(unsigned int) s.lat.size(), s.errors,
+				s.lat.size() / elapsed,
+				bench_percentile(s.lat, 50) / 1000.0,
+				bench_percentile(s.lat, 90) / 1000.0,
+				bench_percentile(s.lat, 99) / 1000.0,
+				s.lat.back() / 1000.0);
+	}
+}
+
+static void print_bench_json(const CmdParamData &param, unsigned int jobs,
+		double elapsed, const BenchStat *stat)
+{
+	std::unique_ptr<PrlOutFormatter> f(get_formatter(true));
+
+	f->open_object();
+	f->add("duration_ms", (int) (elapsed * 1000));
+	f->add("parallel", (int) jobs);
+	f->add("rate", (int) param.bench_rate);
+	for (unsigned int op = 0; op <= BENCH_OPS; op++) {
+		const BenchStat &s = stat[op];
+
+		if (s.lat.empty())
+			continue;
+		f->open(op == BENCH_OPS ? "total" : bench_op_name[op]);
+		f->add("calls", (int) s.lat.size());
+		f->add("errors", (int) s.errors);
+		f->add("calls_per_sec", (int) (s.lat.size() / elapsed + 0.5));
+		f->add("p50_us", (int) bench_percentile(s.lat, 50));
+		f->add("p90_us", (int) bench_percentile(s.lat, 90));
+		f->add("p99_us", (int) bench_percentile(s.lat, 99));
+		f->add("max_us", (int) s.lat.back());
+		f->close();
+	}
+	f->close_object();
+	fputs(f->get_buffer().c_str(), stdout);
+}
+
+/* Drive the mix of GetVmList/GetVmConfig/GetVmInfo calls from --parallel
+ * workers for --duration seconds. With --rate the calls are issued on a
+ * fixed schedule and the latency is counted from the time a call was due,
+ * so a slow dispatcher is not hidden by the workers falling behind.
+ */
+int PrlSrv::bench(const CmdParamData &param)
+{
+	const unsigned int weight[BENCH_OPS] = {
+		param.bench_list, param.bench_config, param.bench_info
+	};
+	std::vector<BenchOp> slots;
+	PrlList<PrlVm *> list;
+	int ret;
+
+	for (unsigned int op = 0; op < BENCH_OPS; op++)
+		slots.insert(slots.end(), weight[op], (BenchOp) op);
+
+	if ((ret = get_vm_list(list, PVTF_VM | PVTF_CT, PGVLF_FILL_AUTOGENERATED)))
+		return ret;
+	std::vector<PrlVm *> vms(list.begin(), list.end());
+	if (vms.empty() && (param.bench_config || param.bench_info)) {
+		list.del();
+		return prl_err(-1, "There are no virtual environments for"
+				" the config and info calls");
+	}
+
+	unsigned int jobs = param.parallel;
+	std::vector<std::vector<BenchStat> > stats(jobs,
+			std::vector<BenchStat>(BENCH_OPS));
+	std::atomic<unsigned long long> next(0);
+	std::chrono::steady_clock::time_point begin =
+			std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point end =
+			begin + std::chrono::seconds(param.bench_duration);
+
+	run_parallel(jobs, jobs, [&](unsigned int w) {
+		for (;;) {
+			unsigned long long n = next++;
+			std::chrono::steady_clock::time_point start =
+					std::chrono::steady_clock::now();
+
+			if (param.bench_rate) {
+				start = begin + std::chrono::microseconds(
+						n * 1000000 / param.bench_rate);
+				if (start >= end)
+					break;
+				std::this_thread::sleep_until(start);
+			} else if (start >= end) {
+				break;
+			}
+
+			BenchOp op = slots[n % slots.size()];
+			/* every VE gets every kind of the calls */
+			PrlVm *vm = vms.empty() ? NULL :
+					vms[(n / slots.size()) % vms.size()];
+			int rc;
+
+			if (op == BENCH_LIST) {
+				PrlList<PrlVm *> l;
+
+				rc = get_vm_list(l, PVTF_VM | PVTF_CT,
+						PGVLF_FILL_AUTOGENERATED);
+				l.del();
+			} else if (op == BENCH_CONFIG) {
+				PrlVm *v = NULL;
+
+				rc = get_vm_config(vm->get_uuid(), &v, false,
+						PGVC_SEARCH_BY_UUID);
+				delete v;
+			} else {
+				rc = bench_vm_info(vm);
+			}
+
+			BenchStat &s = stats[w][op];
+			s.lat.push_back(std::chrono::duration_cast<
+					std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - start).count());
+			if (rc)
+				s.errors++;
+		}
+	});
+
+	double elapsed = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - begin).count();
+	/* the last one is the total */
+	BenchStat stat[BENCH_OPS + 1];
+
+	for (unsigned int w = 0; w < jobs; w++) {
+		for (unsigned int op = 0; op < BENCH_OPS; op++) {
+			const BenchStat &s = stats[w][op];
+
+			stat[op].lat.insert(stat[op].lat.end(), s.lat.begin(), s.lat.end());
+			stat[op].errors += s.errors;
+			stat[BENCH_OPS].lat.insert(stat[BENCH_OPS].lat.end(),
+					s.lat.begin(), s.lat.end());
+			stat[BENCH_OPS].errors += s.errors;
+		}
+	}
+	for (unsigned int op = 0; op <= BENCH_OPS; op++)
+		std::sort(stat[op].lat.begin(), stat[op].lat.end());
+
+	if (param.use_json)
+		print_bench_json(param, jobs, elapsed, stat);
+	else
+		print_bench_plain(param, jobs, elapsed, stat);
+	list.del();
+
+	return 0;
+}
@@ -99,6 +99,34 @@ void PrlCleanup::unregister_last()
 	pthread_mutex_unlock(&m_mutex);
 }
 
+/* Drop the hooks registered after the given one */
+void PrlCleanup::unregister_after(const PrlHook *h)
+{
+	pthread_mutex_lock(&m_mutex);
+
+	if (m_hooks) {
+		while (!m_hooks->empty() && &m_hooks->back() != h)
+			m_hooks->pop_back();
+	}
+
+	pthread_mutex_unlock(&m_mutex);
+}
+
+/* Run the hooks registered after the given one */
+void PrlCleanup::do_cleanup_after(const PrlHook *h)
+{
+	pthread_mutex_lock(&m_mutex);
+
+	if (m_hooks) {
+		hookList::reverse_iterator it = m_hooks->rbegin(),
+			eit = m_hooks->rend();
+		for (; it != eit && &(*it) != h; ++it)
+			it->fn(it->data);
+	}
+
+	pthread_mutex_unlock(&m_mutex);
+}
+
 void PrlCleanup::do_cleanup()
 {
 	pthread_mutex_lock(&m_mutex);
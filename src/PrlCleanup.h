@@ -59,8 +59,10 @@ public:
 	static void unregister_hook(const PrlHook *h);
 	static void register_cancel(PRL_HANDLE h);
 	static void unregister_last();
+	static void unregister_after(const PrlHook *h);
 	static void *monitor(void *);
 	static void do_cleanup();
+	static void do_cleanup_after(const PrlHook *h);
 	static void join();
 	static void run(int sig);
 	static int set_cleanup_handler();
@@ -31,13 +31,17 @@
 #include "CmdParam.h"
 #include "PrlCleanup.h"
 #include "Utils.h"
+#include "PrlAgent.h"
+#include "PrlHosts.h"
 
 #include <string.h>
 
 int main(int argc, char **argv)
 {
 	int ret = 1;
+	bool sdk = false;
 
+	profile_phase("parse");
 	cmdParam cmd;
 	PrlSrv *srv = new PrlSrv();
 	PrlCleanup::set_cleanup_handler();
@@ -60,8 +64,33 @@ int main(int argc, char **argv)
 
 	if (param.action != InvalidAction)
 	{
-		if (init_sdk_lib())
-			return 1;
+		if (agent_can_forward(param)) {
+			profile_phase("agent");
+			if (agent_forward(argc, argv, ret) == 0) {
+				PrlCleanup::join();
+				delete srv;
+				profile_report();
+				return ret;
+			}
+		}
+
+		/* the hosts are queried by the child processes */
+		if (is_multi_host(param)) {
+			ret = hosts_run(param);
+			PrlCleanup::join();
+			delete srv;
+			trace_write();
+			timing_report();
+			return prlerr2exitcode(ret);
+		}
+
+		/* the cheap requests are answered without the dispatcher */
+		if (get_action_needs(param) != NEEDS_NOTHING) {
+			profile_phase("sdk init");
+			if (init_sdk_lib())
+				return 1;
+			sdk = true;
+		}
 
 		ret = srv->run_action(param);
 	}
@@ -69,9 +98,16 @@ int main(int argc, char **argv)
 	PrlCleanup::join();
 
 	ret = get_error(param.action, ret);
+	profile_phase("logoff");
 	delete srv;
 
-	deinit_sdk_lib();
+	if (sdk) {
+		profile_phase("sdk deinit");
+		deinit_sdk_lib();
+	}
+	profile_report();
+	trace_write();
+	timing_report();
 
 	return prlerr2exitcode(ret);
 }
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+
+#include "PrlTypes.h"
+#include "Utils.h"
+#include "CmdParam.h"
+#include "Logger.h"
+#include "PrlSrv.h"
+#include "PrlList.h"
+#include "PrlCleanup.h"
+#include "PrlHosts.h"
+
+/* A host of a multi-host run. Every host is queried by a process of its
+ * own, so that a host which does not reply can be killed on the timeout
+ * without leaving the SDK calls hanging in the other ones.
+ */
+struct HostRun
+{
+	HostRun() : pid(-1), ret(0), timed_out(false)
+	{
+		fd[0] = fd[1] = -1;
+	}
+
+	LoginInfo login;
+	pid_t pid;
+	/* the command stdout and stderr */
+	int fd[2];
+	std::string out[2];
+	int ret;
+	bool timed_out;
+};
+
+bool is_multi_host(const CmdParamData &param)
+{
+	return !param.hosts.empty() || !param.hosts_file.empty();
+}
+
+/* One host per line, blank lines and # comments are skipped */
+static int read_hosts_file(const std::string &path, str_list_t &hosts)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size = 0;
+
+	if ((fp = fopen(path.c_str(), "r")) == NULL)
+		return prl_err(-1, "Unable to open %s: %m", path.c_str());
+
+	while (getline(&buf, &size, fp) != -1) {
+		std::string line(buf);
+
+		line = line.substr(0, line.find('#'));
+		boost::trim(line);
+		if (!line.empty())
+			hosts.push_back(line);
+	}
+	free(buf);
+	fclose(fp);
+
+	return 0;
+}
+
+static void host_child(std::vector<HostRun> &hosts, size_t n,
+		CmdParamData param, int out, int err)
+{
+	HostRun &h = hosts[n];
+	LoginInfo login;
+	std::string passwd;
+	bool ok;
+	int fd, ret;
+
+	/* the parent only waits for the command to finish */
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+
+	/* nobody is there to answer the password prompt */
+	if ((fd = open("/dev/null", O_RDONLY)) != -1) {
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+	dup2(out, STDOUT_FILENO);
+	dup2(err, STDERR_FILENO);
+	close(out);
+	close(err);
+	for (size_t i = 0; i < n; i++) {
+		close(hosts[i].fd[0]);
+		close(hosts[i].fd[1]);
+	}
+
+	/* the host password goes first, then the --read-passwd one */
+	passwd = h.login.get_passwd_from_stack(ok);
+	if (!ok)
+		passwd = param.login.get_passwd_from_stack(ok);
+	if (ok)
+		login.get_passwd_buf() = passwd;
+	login.user = h.login.user;
+	login.server = h.login.server;
+	login.port = h.login.port;
+	login.session_cache = param.login.session_cache;
+	param.login = login;
+	param.host_child = true;
+	/* the list rows are merged by the parent */
+	if (param.action == VmListAction)
+		param.use_json = param.use_ndjson = false;
+
+	if (init_sdk_lib())
+		_exit(1);
+
+	PrlSrv *srv = new PrlSrv();
+	ret = get_error(param.action, srv->run_action(param));
+	delete srv;
+
+	deinit_sdk_lib();
+	/* every host has a trace file of its own */
+	trace_write("." + h.login.server);
+	timing_report();
+
+	fflush(stdout);
+	fflush(stderr);
+	_exit(prlerr2exitcode(ret));
+}
+
+static int host_start(std::vector<HostRun> &hosts, size_t n,
+		const CmdParamData &param)
+{
+	HostRun &h = hosts[n];
+	int out[2], err[2];
+
+	if (pipe(out) < 0)
+		return prl_err(-1, "pipe: %m");
+	if (pipe(err) < 0) {
+		close(out[0]);
+		close(out[1]);
+		return prl_err(-1, "pipe: %m");
+	}
+
+	/* the buffered output must not be written twice */
+	fflush(stdout);
+	fflush(stderr);
+	if ((h.pid = fork()) < 0) {
+		close(out[0]); close(out[1]);
+		close(err[0]); close(err[1]);
+		return prl_err(-1, "fork: %m");
+	} else if (h.pid == 0) {
+		close(out[0]);
+		close(err[0]);
+		host_child(hosts, n, param, out[1], err[1]);
+	}
+
+	close(out[1]);
+	close(err[1]);
+	h.fd[0] = out[0];
+	h.fd[1] = err[0];
+
+	return 0;
+}
+
+static void host_close(HostRun &h)
+{
+	for (int i = 0; i < 2; i++) {
+		if (h.fd[i] != -1)
+			close(h.fd[i]);
+		h.fd[i] = -1;
+	}
+}
+
+static bool host_reap(HostRun &h, int flags)
+{
+	int status;
+
+	if (h.pid == -1)
+		return true;
+	if (waitpid(h.pid, &status, flags) <= 0)
+		return false;
+
+	h.pid = -1;
+	if (h.timed_out)
+		h.ret = prlerr2exitcode(PRL_ERR_TIMEOUT);
+	else if (WIFEXITED(status))
+		h.ret = WEXITSTATUS(status);
+	else
+		h.ret = prlerr2exitcode(-1);
+
+	return true;
+}
+
+static void stop_hosts(void *data)
+{
+	if (write(*(int *) data, "", 1) == -1)
+		prl_log(L_DEBUG, "Unable to stop the hosts: %m");
+}
+
+/* Read the hosts output until all of them finish or the timeout
+ * expires; the late ones are killed.
+ */
+static void hosts_wait(std::vector<HostRun> &hosts, unsigned int timeout,
+		int stop_fd)
+{
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+	bool stopped = false;
+
+	while (1) {
+		std::vector<struct pollfd> fds;
+		std::vector<std::pair<size_t, int> > src;
+		bool running = false;
+
+		for (size_t i = 0; i < hosts.size(); i++) {
+			for (int j = 0; j < 2; j++) {
+				if (hosts[i].fd[j] == -1)
+					continue;
+				struct pollfd pfd = {hosts[i].fd[j], POLLIN, 0};
+				fds.push_back(pfd);
+				src.push_back(std::make_pair(i, j));
+			}
+			/* the output is closed, the exit status is coming */
+			if (hosts[i].fd[0] == -1 && hosts[i].fd[1] == -1 &&
+					!host_reap(hosts[i], WNOHANG))
+				running = true;
+		}
+		if (fds.empty() && !running)
+			break;
+
+		long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - std::chrono::steady_clock::now()).count();
+		if (left <= 0) {
+			for (size_t i = 0; i < hosts.size(); i++) {
+				if (hosts[i].pid == -1)
+					continue;
+				prl_log(L_INFO, "%s: timed out",
+						hosts[i].login.server.c_str());
+				hosts[i].timed_out = true;
+				kill(hosts[i].pid, SIGKILL);
+				host_close(hosts[i]);
+			}
+			break;
+		}
+		if (running && left > 100)
+			left = 100;
+
+		if (!stopped) {
+			struct pollfd pfd = {stop_fd, POLLIN, 0};
+			fds.push_back(pfd);
+		}
+		if (poll(fds.data(), fds.size(), left) < 0) {
+			if (errno == EINTR)
+				continue;
+			/* the hosts are killed right away */
+			prl_err(-1, "poll: %m");
+			deadline = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		if (!stopped && fds.back().revents) {
+			/* let the hosts cancel their jobs, the timeout still applies */
+			stopped = true;
+			for (size_t i = 0; i < hosts.size(); i++)
+				if (hosts[i].pid != -1)
+					kill(hosts[i].pid, SIGTERM);
+		}
+		for (size_t k = 0; k < src.size(); k++) {
+			HostRun &h = hosts[src[k].first];
+			int j = src[k].second;
+			char buf[4096];
+			ssize_t n;
+
+			if (!fds[k].revents)
+				continue;
+			n = read(h.fd[j], buf, sizeof(buf));
+			if (n > 0) {
+				h.out[j].append(buf, n);
+			} else if (n == 0 || errno != EINTR) {
+				close(h.fd[j]);
+				h.fd[j] = -1;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < hosts.size(); i++)
+		host_reap(hosts[i], 0);
+}
+
+/* The server name goes before every line of the host output. The NDJSON
+ * objects have the host field written by the host child already.
+ */
+static void print_host_lines(FILE *fp, const HostRun &h, const std::string &out,
+		bool ndjson)
+{
+	str_list_t lines = split(out, "\n");
+
+	for (str_list_t::const_iterator it = lines.begin(); it != lines.end(); ++it) {
+		if (ndjson && (*it)[0] == '{')
+			fprintf(fp, "%s\n", it->c_str());
+		else
+			fprintf(fp, "%-20s %s\n", h.login.server.c_str(), it->c_str());
+	}
+}
+
+static bool host_cmp(const HostRun *h1, const HostRun *h2)
+{
+	return h1->login.server < h2->login.server;
+}
+
+int hosts_run(const CmdParamData &param)
+{
+	CmdParamData p(param);
+	std::vector<HostRun> hosts;
+	std::vector<const HostRun *> sorted;
+	int stop_fd[2];
+	int ret = 0;
+
+	if (!param.login.server.empty())
+		return prl_err(-1, "The --login option can not be used"
+				" along with --hosts");
+	if (param.action == VmListAction &&
+			(param.info || param.list_watch || param.list_all_fields))
+		return prl_err(-1, "The --info, --watch and -L options can not"
+				" be used along with --hosts");
+	if (param.action == VmPerfStatsAction && param.statistics.loop)
+		return prl_err(-1, "The --loop option can not be used along"
+				" with --hosts");
+
+	if (!param.hosts_file.empty() &&
+			read_hosts_file(param.hosts_file, p.hosts))
+		return -1;
+	if (p.hosts.empty())
+		return prl_err(-1, "No hosts are specified");
+
+	for (str_list_t::const_iterator it = p.hosts.begin();
+			it != p.hosts.end(); ++it) {
+		HostRun h;
+
+		if (parse_auth(*it, h.login))
+			return prl_err(-1, "An incorrect host is specified: %s",
+					it->c_str());
+		hosts.push_back(h);
+	}
+
+	if (pipe(stop_fd) < 0)
+		return prl_err(-1, "pipe: %m");
+	const PrlHook *hook = get_cleanup_ctx().register_hook(stop_hosts,
+			&stop_fd[1]);
+
+	/* all the hosts are queried at once, each one within the timeout */
+	for (size_t i = 0; i < hosts.size(); i++) {
+		if (host_start(hosts, i, p)) {
+			hosts[i].ret = prlerr2exitcode(-1);
+			hosts.resize(i + 1);
+			break;
+		}
+	}
+	hosts_wait(hosts, p.host_timeout, stop_fd[0]);
+
+	get_cleanup_ctx().unregister_hook(hook);
+	close(stop_fd[0]);
+	close(stop_fd[1]);
+
+	for (size_t i = 0; i < hosts.size(); i++)
+		sorted.push_back(&hosts[i]);
+	std::stable_sort(sorted.begin(), sorted.end(), host_cmp);
+
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const HostRun &h = *sorted[i];
+
+		print_host_lines(stderr, h, h.out[1], false);
+		if (h.timed_out)
+			prl_err(-1, "%s: no reply within %u seconds",
+					h.login.server.c_str(), p.host_timeout);
+		else if (h.ret)
+			prl_err(-1, "%s: failed with exit code %d",
+					h.login.server.c_str(), h.ret);
+	}
+
+	if (p.action == VmListAction) {
+		str_list_t rows;
+
+		/* the partial output of a failed host is dropped */
+		for (size_t i = 0; i < hosts.size(); i++) {
+			if (hosts[i].ret)
+				continue;
+			str_list_t lines = split(hosts[i].out[0], "\n");
+			rows.insert(rows.end(), lines.begin(), lines.end());
+		}
+		ret = print_host_rows(p, rows);
+	} else {
+		for (size_t i = 0; i < sorted.size(); i++)
+			print_host_lines(stdout, *sorted[i], sorted[i]->out[0],
+					p.use_ndjson);
+	}
+
+	for (size_t i = 0; i < hosts.size() && ret == 0; i++)
+		ret = hosts[i].ret;
+
+	return ret;
+}
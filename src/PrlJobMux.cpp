@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include <system_error>
+#include "PrlJobMux.h"
+#include "Utils.h"
+#include "Logger.h"
+
+PrlJobMux::PrlJobMux(unsigned int threads) :
+	m_max_threads(threads),
+	m_next(0),
+	m_pending(0),
+	m_stop(false)
+{
+}
+
+PrlJobMux::~PrlJobMux()
+{
+	wait_all();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_queued.notify_all();
+	for (auto &t : m_threads)
+		t.join();
+}
+
+unsigned int PrlJobMux::submit(PRL_HANDLE hJob, const job_done_t &done,
+		unsigned int timeout)
+{
+	PRL_RESULT ret;
+	Job job;
+
+	if (timeout == JOB_INFINIT_WAIT_TIMEOUT)
+		timeout = g_nJobTimeout;
+	job.handle = hJob;
+	job.done = done;
+	job.infinite = (timeout == JOB_INFINIT_WAIT_TIMEOUT);
+	job.begin = std::chrono::steady_clock::now();
+	job.deadline = job.begin +
+			std::chrono::milliseconds(job.infinite ? 0 : timeout);
+	job.vm = trace_vm();
+	job.finished = false;
+	job.ret = 0;
+
+	if ((ret = PrlHandle_AddRef(hJob))) {
+		job.handle = PRL_INVALID_HANDLE;
+		job.finished = true;
+		job.ret = ret;
+		job.err = "PrlHandle_AddRef: " + get_error_str(ret);
+		if (done)
+			done(hJob, job.ret, job.err);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	unsigned int id = m_next++;
+
+	if (job.finished) {
+		if (!done)
+			m_jobs[id] = job;
+		return id;
+	}
+
+	m_jobs[id] = job;
+	m_queue.push_back(id);
+	m_pending++;
+	/* one waiter per job in flight, up to the bound */
+	if (m_threads.size() < m_max_threads && m_threads.size() < m_pending)
+		start_waiter();
+	m_queued.notify_one();
+
+	return id;
+}
+
+void PrlJobMux::start_waiter()
+{
+	try {
+		m_threads.emplace_back(&PrlJobMux::worker, this);
+	} catch (const std::system_error &e) {
+		/* await() and wait_all() do the waiting then */
+		prl_log(L_DEBUG, "Unable to start a job waiter: %s", e.what());
+	}
+}
+
+/* Wait for the first queued job until it is done or its timeout expires.
+ * Returns false if there is nothing to do.
+ */
+bool PrlJobMux::run_one(std::unique_lock<std::mutex> &lock)
+{
+	if (m_queue.empty())
+		return false;
+
+	unsigned int id = m_queue.front();
+	m_queue.pop_front();
+	/* handle, infinite and deadline are not changed after submit() */
+	Job &job = m_jobs[id];
+	lock.unlock();
+
+	unsigned int timeout = JOB_INFINIT_WAIT_TIMEOUT;
+	if (!job.infinite) {
+		long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+				job.deadline - std::chrono::steady_clock::now()).count();
+		timeout = left > 0 ? (unsigned int) left : 0;
+	}
+
+	std::string err;
+	PRL_RESULT ret = PrlJob_Wait(job.handle, timeout);
+	record_job(job.handle, job.begin, job.vm);
+	if (ret)
+		err = "PrlJob_Wait: " + get_error_str(ret);
+	else
+		ret = get_done_job_retcode(job.handle, err);
+	if (job.done)
+		job.done(job.handle, ret, err);
+	PrlHandle_Free(job.handle);
+
+	lock.lock();
+	if (job.done) {
+		m_jobs.erase(id);
+	} else {
+		job.handle = PRL_INVALID_HANDLE;
+		job.finished = true;
+		job.ret = ret;
+		job.err = err;
+	}
+	m_pending--;
+	m_finished.notify_all();
+
+	return true;
+}
+
+void PrlJobMux::worker()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (;;) {
+		m_queued.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (!run_one(lock))
+			return;
+	}
+}
+
+PRL_RESULT PrlJobMux::await(unsigned int id, std::string &err)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	std::map<unsigned int, Job>::iterator it = m_jobs.find(id);
+
+	if (it == m_jobs.end()) {
+		err = "No such job";
+		return PRL_ERR_INVALID_ARG;
+	}
+	while (!it->second.finished) {
+		if (m_threads.empty())
+			run_one(lock);
+		else
+			m_finished.wait(lock);
+	}
+
+	PRL_RESULT ret = it->second.ret;
+	err = it->second.err;
+	m_jobs.erase(it);
+
+	return ret;
+}
+
+void PrlJobMux::wait_all()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (m_pending != 0) {
+		if (m_threads.empty())
+			run_one(lock);
+		else
+			m_finished.wait(lock);
+	}
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2015-2017, Parallels International GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef __PRLJOBMUX_H__
+#define __PRLJOBMUX_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PrlTypes.h"
+
+/* The default bound of the waiter pool */
+#define JOB_MUX_THREADS	16
+
+/* Called on a waiter thread once the job is finished, with the same
+ * return code and error string get_job_retcode() would give.
+ */
+typedef std::function<void (PRL_HANDLE hJob, PRL_RESULT ret,
+		const std::string &err)> job_done_t;
+
+/* Keeps any number of dispatcher jobs in flight. Every job is waited for
+ * by a waiter of a bounded pool which blocks in PrlJob_Wait() until the
+ * job is done, so a job is completed as soon as the dispatcher answers.
+ * With more jobs in flight than waiters the rest are queued and picked
+ * by the first waiter which is free.
+ */
+class PrlJobMux : private boost::noncopyable
+{
+public:
+	explicit PrlJobMux(unsigned int threads = JOB_MUX_THREADS);
+	~PrlJobMux();
+
+	/* Takes a reference of the job, the caller still owns its handle.
+	 * The timeout is the one of get_job_retcode().
+	 */
+	unsigned int submit(PRL_HANDLE hJob, const job_done_t &done = job_done_t(),
+			unsigned int timeout = JOB_INFINIT_WAIT_TIMEOUT);
+	/* Wait for a job submitted without the callback, can be done once */
+	PRL_RESULT await(unsigned int id, std::string &err);
+	void wait_all();
+
+private:
+	struct Job {
+		PRL_HANDLE handle;
+		job_done_t done;
+		bool infinite;
+		std::chrono::steady_clock::time_point deadline;
+		std::chrono::steady_clock::time_point begin;
+		std::string vm;
+		bool finished;
+		PRL_RESULT ret;
+		std::string err;
+	};
+
+	void worker();
+	bool run_one(std::unique_lock<std::mutex> &lock);
+	void start_waiter();
+
+	std::mutex m_mutex;
+	std::condition_variable m_queued;
+	std::condition_variable m_finished;
+	std::deque<unsigned int> m_queue;
+	std::map<unsigned int, Job> m_jobs;
+	std::vector<std::thread> m_threads;
+	unsigned int m_max_threads;
+	unsigned int m_next;
+	unsigned int m_pending;
+	bool m_stop;
+};
+
+#endif // __PRLJOBMUX_H__
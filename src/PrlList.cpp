@@ -29,8 +29,21 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <algorithm>
 #include <vector>
+#include <set>
+#include <chrono>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -41,12 +54,24 @@
 #include "CmdParam.h"
 #include "Logger.h"
 #include "PrlOutFormatter.h"
+#include "PrlList.h"
+#include "PrlCleanup.h"
 
 #define PVTF_ALL (PVTF_VM | PVTF_CT)
 #define PVTF_HIDE (1<<(PACF_MAX+3))
 #define PVTF_NET_IP (1<<(PACF_MAX+4))
 #define PVTF_FULL (1<<(PACF_MAX+5))
 
+/* VM data the field getters rely on, loaded once per row by fetch_vm_data() */
+#define FD_STATE		0x1
+#define FD_DEVICES		0x2
+#define FD_GUEST_IP		0x4
+
+/* How the field values compare when sorting */
+#define SORT_STR		0
+#define SORT_NUM		1
+#define SORT_IP			2
+
 typedef std::list<int> IntList;
 
 struct FieldVm
@@ -57,13 +82,16 @@ struct FieldVm
 	const char *fmt;
 
 	std::string (*get_fn)(PrlVm *vm);
-	bool (*sort_fn)(const PrlVm *val1, const PrlVm *val2);
+	int sort_type;
+	unsigned int deps;
 
 public:
 	int find(const char *name) const;
 	IntList get_field_order(const char *fields);
+	unsigned int get_deps(IntList &order);
 	void print_hdr(IntList &order);
-	void print(PrlVm *vm, IntList &list, PrlOutFormatter &f);
+	void eval(PrlVm *vm, IntList &order, str_list_t &values);
+	void print(const str_list_t &values, IntList &order, PrlOutFormatter &f);
 	unsigned get_PGVLF(const std::string &fields, bool tmpl, bool info);
 };
 
@@ -74,23 +102,27 @@ static const char *default_vzcompat_field_order = "status,ip,name";
 static const char *default_vzcompat_name_field_order = "uuid,numproc,status,ip,name";
 static const char *default_template_order = "uuid,dist,type,name";
 static const char *default_user_order = "name,mng_settings,def_vm_home";
-static bool last_field;
+/* Rows are evaluated by several threads, each needs its own copy */
+static thread_local bool last_field;
 
-
-static inline bool uuid_sort_fn(const PrlVm *val1, const PrlVm *val2)
+struct VmRow
 {
-	return (val1->get_uuid().compare(val2->get_uuid()) < 0);
-}
+	VmRow() : show(false), loaded(0), probe(false), guest_ip_rc(-1) {}
+
+	bool show;
+	/* FD_* data fetched so far */
+	unsigned int loaded;
+	str_list_t values;
+	/* The guest has to be asked for its addresses */
+	bool probe;
+	/* Addresses reported by the guest, valid if guest_ip_rc == 0 */
+	int guest_ip_rc;
+	ip_list_t guest_ips;
+};
 
-inline bool name_sort_fn(const PrlVm *val1, const PrlVm *val2)
-{
-	return (val1->get_name().compare(val2->get_name()) < 0);
-}
+/* The row the current thread evaluates */
+static thread_local const VmRow *cur_row;
 
-inline bool home_sort_fn(const PrlVm *val1, const PrlVm *val2)
-{
-	return (val1->get_home().compare(val2->get_home()) < 0);
-}
 
 static std::string handle_empty_str(const std::string &in)
 {
@@ -159,6 +191,15 @@ static std::string get_hostname(PrlVm *vm)
 	return handle_empty_str(vm->get_hostname());
 }
 
+/* The server the VMs are listed from */
+static std::string list_host;
+
+static std::string get_host(PrlVm *vm)
+{
+	(void)vm;
+	return list_host;
+}
+
 // Sort ip in the order: IPv4, IPv6, IPv6Link-Local
 static ip_list_t SortNetAddresses(ip_list_t &in)
 {
@@ -181,13 +222,9 @@ static ip_list_t SortNetAddresses(ip_list_t &in)
 	return ips;
 }
 
-static std::string _get_ip(PrlVm *vm, bool print_real)
+static bool get_configured_ips(PrlVm *vm, ip_list_t &ips)
 {
-	std::string out;
 	bool net_dev_exists = false;
-	ip_list_t ips;
-
-	vm->get_vm_info();
 
 	BOOST_FOREACH(PrlDevNet *net, vm->get_net_devs()) {
 		ip_list_t _ips;
@@ -196,18 +233,18 @@ static std::string _get_ip(PrlVm *vm, bool print_real)
 			ips.insert(ips.end(), _ips.begin(), _ips.end());
 		}
 	}
+	return net_dev_exists;
+}
 
-	if (print_real)
-	{
-		ip_list_t _ips;
-		if (net_dev_exists &&
-		    vm->get_state() == VMS_RUNNING &&
-		    vm->get_real_ip(_ips, 60 * 1000) == 0)
-		{
-			ips.clear();
-			ips.insert(ips.end(), _ips.begin(), _ips.end());
-		}
-	}
+static std::string _get_ip(PrlVm *vm, bool print_real)
+{
+	std::string out;
+	ip_list_t ips;
+
+	get_configured_ips(vm, ips);
+
+	if (print_real && cur_row != NULL && cur_row->guest_ip_rc == 0)
+		ips = cur_row->guest_ips;
 
 	ips = SortNetAddresses(ips);
 
@@ -235,8 +272,6 @@ static std::string get_ip(PrlVm *vm)
 
 static std::string get_mac(PrlVm *vm)
 {
-	vm->get_vm_info();
-
 	std::string out;
 	BOOST_FOREACH(PrlDevNet *net, vm->get_net_devs()) {
 		if (net != NULL) {
@@ -249,8 +284,6 @@ static std::string get_mac(PrlVm *vm)
 
 static std::string get_netif(PrlVm *vm)
 {
-	vm->get_vm_info();
-
 	std::string out;
 	BOOST_FOREACH(PrlDevNet *net, vm->get_net_devs()) {
 		if (net != NULL) {
@@ -322,43 +355,39 @@ static std::string get_ha_prio(PrlVm *vm)
 	return ui2string(vm->get_ha_prio());
 }
 
-static inline bool ha_prio_sort_fn(const PrlVm *val1, const PrlVm *val2)
-{
-	return (val1->get_ha_prio() < val2->get_ha_prio());
-}
-
 static FieldVm vm_field_tbl[] = {
-{"uuid",	"UUID", PVTF_ALL, "%-39s ", get_id, uuid_sort_fn},
-{"id" ,		"UUID", PVTF_ALL | PVTF_HIDE, "%-39s ", get_id, uuid_sort_fn},
-{"ctid" ,	"UUID", PVTF_ALL | PVTF_HIDE, "%-39s ", get_id, uuid_sort_fn},
-{"veid" ,	"UUID", PVTF_ALL | PVTF_HIDE, "%-39s ", get_id, uuid_sort_fn},
-{"envid" ,	"ENVID", PVTF_ALL, "%-10s ", get_ctid, 0},
-{"home" ,	"HOME", PVTF_ALL, "%-32s ", get_home, home_sort_fn},
-{"private" ,	"HOME", PVTF_ALL|PVTF_HIDE, "%-32s ", get_home, home_sort_fn},
-{"type",	"T", PVTF_ALL, "%-2s ", get_type, 0},
-{"name",	"NAME", PVTF_ALL, "%-32s ", get_name, name_sort_fn},
-
-{"status",	"STATUS", PVTF_ALL|PVTF_FULL, "%-12s ", get_status, 0},
-{"dist",	"DIST", PVTF_ALL|PVTF_FULL, "%-15s ", get_dist, 0},
-{"owner",	"OWNER", PVTF_ALL|PVTF_FULL, "%-32s ", get_owner, 0},
-{"system-flags","SYSTEM_FLAGS", PVTF_VM|PVTF_FULL, "%-32s ", get_system_flags, 0},
-{"description",	"DESCRIPTION", PVTF_ALL|PVTF_FULL, "%-32s ", get_description, 0},
-
-{"numproc",	"NPROC", PVTF_CT|PVTF_HIDE|PVTF_FULL, "%9s ", get_empty, 0},
-{"ip",		"IP_ADDR", PVTF_ALL|PVTF_FULL, "%-15s ", get_ip, 0},
-{"ip_configured","IP_ADDR", PVTF_ALL|PVTF_NET_IP, "%-15s ", get_ip_configured, 0},
-{"hostname",	"HOSTNAME", PVTF_ALL|PVTF_FULL, "%-32s ", get_hostname, 0},
-{"netif",	"NETIF", PVTF_ALL|PVTF_FULL, "%-16s ", get_netif, 0},
-{"mac",		"MAC", PVTF_ALL|PVTF_FULL, "%-36s ", get_mac, 0},
-{"ostemplate",	"OSTEMPLATE", PVTF_ALL|PVTF_HIDE|PVTF_FULL, "%-24s ", get_ostemplate, 0},
-{"features",	"FEATURES", PVTF_ALL|PVTF_FULL, "%-256s ", get_features, 0},
-{"location",	"LOCATION", PVTF_ALL|PVTF_FULL, "%-39s ", get_location, 0},
-{"iolimit",	"IOLIMIT", PVTF_ALL|PVTF_FULL, "%-10s ", get_iolimit, 0},
-{"netdev",	"NETDEV", PVTF_ALL|PVTF_FULL, "%-14s ", get_netdev, 0},
-{"ha_enable", "HA_ENABLE", PVTF_ALL|PVTF_FULL, "%-9s ", get_ha_enable, 0},
-{"ha_prio", "HA_PRIO", PVTF_ALL|PVTF_FULL, "%-10s ", get_ha_prio, ha_prio_sort_fn},
-{"-",		"-", PVTF_ALL, "%-10s ", get_empty, 0},
-{0, 0, PVTF_ALL, 0, 0, 0},
+{"uuid",	"UUID", PVTF_ALL, "%-39s ", get_id, SORT_STR, 0},
+{"id" ,		"UUID", PVTF_ALL | PVTF_HIDE, "%-39s ", get_id, SORT_STR, 0},
+{"ctid" ,	"UUID", PVTF_ALL | PVTF_HIDE, "%-39s ", get_id, SORT_STR, 0},
+{"veid" ,	"UUID", PVTF_ALL | PVTF_HIDE, "%-39s ", get_id, SORT_STR, 0},
+{"envid" ,	"ENVID", PVTF_ALL, "%-10s ", get_ctid, SORT_STR, 0},
+{"home" ,	"HOME", PVTF_ALL, "%-32s ", get_home, SORT_STR, 0},
+{"private" ,	"HOME", PVTF_ALL|PVTF_HIDE, "%-32s ", get_home, SORT_STR, 0},
+{"type",	"T", PVTF_ALL, "%-2s ", get_type, SORT_STR, 0},
+{"name",	"NAME", PVTF_ALL, "%-32s ", get_name, SORT_STR, 0},
+
+{"status",	"STATUS", PVTF_ALL|PVTF_FULL, "%-12s ", get_status, SORT_STR, FD_STATE},
+{"dist",	"DIST", PVTF_ALL|PVTF_FULL, "%-15s ", get_dist, SORT_STR, 0},
+{"owner",	"OWNER", PVTF_ALL|PVTF_FULL, "%-32s ", get_owner, SORT_STR, 0},
+{"system-flags","SYSTEM_FLAGS", PVTF_VM|PVTF_FULL, "%-32s ", get_system_flags, SORT_STR, 0},
+{"description",	"DESCRIPTION", PVTF_ALL|PVTF_FULL, "%-32s ", get_description, SORT_STR, 0},
+
+{"numproc",	"NPROC", PVTF_CT|PVTF_HIDE|PVTF_FULL, "%9s ", get_empty, SORT_STR, 0},
+{"ip",		"IP_ADDR", PVTF_ALL|PVTF_FULL, "%-15s ", get_ip, SORT_IP, FD_DEVICES|FD_STATE|FD_GUEST_IP},
+{"ip_configured","IP_ADDR", PVTF_ALL|PVTF_NET_IP, "%-15s ", get_ip_configured, SORT_IP, FD_DEVICES},
+{"hostname",	"HOSTNAME", PVTF_ALL|PVTF_FULL, "%-32s ", get_hostname, SORT_STR, 0},
+{"host",	"HOST", PVTF_ALL, "%-20s ", get_host, SORT_STR, 0},
+{"netif",	"NETIF", PVTF_ALL|PVTF_FULL, "%-16s ", get_netif, SORT_STR, FD_DEVICES},
+{"mac",		"MAC", PVTF_ALL|PVTF_FULL, "%-36s ", get_mac, SORT_STR, FD_DEVICES},
+{"ostemplate",	"OSTEMPLATE", PVTF_ALL|PVTF_HIDE|PVTF_FULL, "%-24s ", get_ostemplate, SORT_STR, 0},
+{"features",	"FEATURES", PVTF_ALL|PVTF_FULL, "%-256s ", get_features, SORT_STR, 0},
+{"location",	"LOCATION", PVTF_ALL|PVTF_FULL, "%-39s ", get_location, SORT_STR, 0},
+{"iolimit",	"IOLIMIT", PVTF_ALL|PVTF_FULL, "%-10s ", get_iolimit, SORT_NUM, 0},
+{"netdev",	"NETDEV", PVTF_ALL|PVTF_FULL, "%-14s ", get_netdev, SORT_STR, FD_DEVICES},
+{"ha_enable", "HA_ENABLE", PVTF_ALL|PVTF_FULL, "%-9s ", get_ha_enable, SORT_STR, 0},
+{"ha_prio", "HA_PRIO", PVTF_ALL|PVTF_FULL, "%-10s ", get_ha_prio, SORT_NUM, 0},
+{"-",		"-", PVTF_ALL, "%-10s ", get_empty, SORT_STR, 0},
+{0, 0, PVTF_ALL, 0, 0, 0, 0},
 
 };
 
@@ -416,6 +445,20 @@ IntList FieldVm::get_field_order(const char *fields)
 	return list;
 }
 
+unsigned int FieldVm::get_deps(IntList &order)
+{
+	unsigned int deps = 0;
+
+	BOOST_FOREACH(int id, order)
+		deps |= this[id].deps;
+
+	/* the guest is only asked if it is running and has a network */
+	if (deps & FD_GUEST_IP)
+		deps |= FD_DEVICES | FD_STATE;
+
+	return deps;
+}
+
 void FieldVm::print_hdr(IntList &order)
 {
 	// Print Header
@@ -433,24 +476,427 @@ void FieldVm::print_hdr(IntList &order)
 	fprintf(stdout, "\n");
 }
 
-void FieldVm::print(PrlVm *vm, IntList &order, PrlOutFormatter &f)
+void FieldVm::eval(PrlVm *vm, IntList &order, str_list_t &values)
 {
 	IntList::const_iterator it = order.begin(),
 				eit = order.end();
+	values.clear();
 	last_field = false;
 	while (it != eit) {
 		int id = *it;
 
+		if (++it == eit)
+			last_field = true;
+
+		values.push_back(this[id].get_fn(vm));
+	}
+}
+
+void FieldVm::print(const str_list_t &values, IntList &order, PrlOutFormatter &f)
+{
+	IntList::const_iterator it = order.begin(),
+				eit = order.end();
+	str_list_t::const_iterator v = values.begin();
+	last_field = false;
+	for (; it != eit && v != values.end(); ++v) {
+		int id = *it;
+
 		if (++it == eit)
 			last_field = true;
 
 		if (!strcmp(this[id].name, "uuid"))
 			f.tbl_add_uuid(this[id].name, get_fmt(this[id].fmt),
-							this[id].get_fn(vm).c_str());
+							v->c_str());
 		else
 			f.tbl_add_item(this[id].name, get_fmt(this[id].fmt),
-							this[id].get_fn(vm).c_str());
+							v->c_str());
+	}
+}
+
+/* Load everything the row fields need before any getter runs */
+static void fetch_vm_data(PrlVm *vm, unsigned int deps, VmRow &row)
+{
+	deps &= ~row.loaded;
+	row.loaded |= deps;
+
+	if (deps & FD_DEVICES)
+		vm->get_dev_info();
+	if ((deps & FD_STATE) && vm->get_state() == VMS_UNKNOWN)
+		vm->update_state();
+	if (deps & FD_GUEST_IP) {
+		ip_list_t ips;
+		row.probe = get_configured_ips(vm, ips) &&
+				vm->get_state() == VMS_RUNNING;
+	}
+}
+
+/* Ask the running guests for their addresses, up to param.list_ip_jobs
+ * at a time. All the probes share one deadline: the guests that did not
+ * answer in time are shown with the configured addresses.
+ */
+static void probe_guest_ips(std::vector<PrlVm *> &vm_list,
+		std::vector<VmRow> &rows, const CmdParamData &param)
+{
+	std::vector<unsigned int> probes;
+
+	for (unsigned int i = 0; i < rows.size(); ++i)
+		if (rows[i].show && rows[i].probe)
+			probes.push_back(i);
+
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() +
+		std::chrono::seconds(param.list_ip_timeout);
+
+	run_parallel(probes.size(), param.list_ip_jobs, [&](unsigned int i) {
+		VmRow &row = rows[probes[i]];
+		long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+
+		if (left <= 0) {
+			prl_log(L_DEBUG, "No time left to query the guest %s",
+					vm_list[probes[i]]->get_uuid().c_str());
+			return;
+		}
+		row.guest_ip_rc = vm_list[probes[i]]->get_real_ip(row.guest_ips, left);
+	});
+}
+
+enum {
+	FLT_EQ,
+	FLT_NE,
+	FLT_MATCH,
+	FLT_NOMATCH,
+	FLT_LT,
+	FLT_LE,
+	FLT_GT,
+	FLT_GE,
+};
+
+static const struct {
+	const char *str;
+	int op;
+} filter_ops[] = {
+	/* two character operators go first */
+	{"!=", FLT_NE},
+	{"!~", FLT_NOMATCH},
+	{"<=", FLT_LE},
+	{">=", FLT_GE},
+	{"=", FLT_EQ},
+	{"~", FLT_MATCH},
+	{"<", FLT_LT},
+	{">", FLT_GT},
+	{NULL, 0},
+};
+
+/* The filter costs: the predicates are checked from the cheapest one */
+#define FLT_COST_CONFIG		0
+#define FLT_COST_STATE		1
+#define FLT_COST_DEVICES	2
+#define FLT_COST_GUEST		3
+
+struct VmFilter
+{
+	int field;
+	int op;
+	std::string value;
+	unsigned int deps;
+	unsigned int cost;
+};
+typedef std::vector<VmFilter> VmFilterList;
+
+static unsigned int get_filter_cost(unsigned int deps)
+{
+	if (deps & FD_GUEST_IP)
+		return FLT_COST_GUEST;
+	if (deps & FD_DEVICES)
+		return FLT_COST_DEVICES;
+	if (deps & FD_STATE)
+		return FLT_COST_STATE;
+	return FLT_COST_CONFIG;
+}
+
+static bool filter_cost_cmp(const VmFilter &f1, const VmFilter &f2)
+{
+	return f1.cost < f2.cost;
+}
+
+/* Parse the --filter expression, e.g. "status=running,name~web-*,ha_prio>5",
+ * into the list of predicates sorted by cost.
+ */
+static int compile_filter(const std::string &expr, VmFilterList &filter)
+{
+	std::vector<std::string> v;
+
+	boost::split(v, expr, boost::is_any_of(","));
+	BOOST_FOREACH(const std::string &s, v) {
+		VmFilter flt;
+		std::string::size_type pos;
+		int i;
+
+		if (s.empty())
+			continue;
+
+		pos = s.find_first_of("=!~<>");
+		if (pos == std::string::npos || pos == 0) {
+			fprintf(stderr, "Invalid filter expression: %s\n",
+					s.c_str());
+			return 1;
+		}
+		flt.field = vm_field_tbl->find(s.substr(0, pos).c_str());
+		if (flt.field < 0) {
+			fprintf(stderr, "%s is an invalid field name in"
+				" this query.\n", s.substr(0, pos).c_str());
+			return 1;
+		}
+		for (i = 0; filter_ops[i].str != NULL; i++)
+			if (!s.compare(pos, strlen(filter_ops[i].str),
+						filter_ops[i].str))
+				break;
+		if (filter_ops[i].str == NULL) {
+			fprintf(stderr, "Invalid filter expression: %s\n",
+					s.c_str());
+			return 1;
+		}
+		flt.op = filter_ops[i].op;
+		flt.value = s.substr(pos + strlen(filter_ops[i].str));
+
+		IntList order;
+		order.push_back(flt.field);
+		flt.deps = vm_field_tbl->get_deps(order);
+		flt.cost = get_filter_cost(flt.deps);
+
+		filter.push_back(flt);
 	}
+	std::stable_sort(filter.begin(), filter.end(), filter_cost_cmp);
+
+	return 0;
+}
+
+static unsigned int get_filter_deps(const VmFilterList &filter)
+{
+	unsigned int deps = 0;
+
+	BOOST_FOREACH(const VmFilter &flt, filter)
+		deps |= flt.deps;
+
+	return deps;
+}
+
+static bool is_number(const std::string &str, double *val)
+{
+	char *end;
+
+	if (str.empty())
+		return false;
+	*val = strtod(str.c_str(), &end);
+	return *end == '\0';
+}
+
+static bool match_value(const VmFilter &flt, const std::string &str)
+{
+	double v1, v2;
+	int cmp;
+
+	switch (flt.op) {
+	case FLT_EQ:
+	case FLT_NE:
+		return boost::iequals(str, flt.value);
+	case FLT_MATCH:
+	case FLT_NOMATCH:
+		return !fnmatch(flt.value.c_str(), str.c_str(), FNM_CASEFOLD);
+	}
+
+	/* numbers are compared as numbers, and strings as strings */
+	bool num1 = is_number(str, &v1);
+	bool num2 = is_number(flt.value, &v2);
+	if (num1 && num2)
+		cmp = v1 < v2 ? -1 : v1 > v2;
+	else if (!num1 && !num2)
+		cmp = str.compare(flt.value);
+	else
+		return false;
+
+	switch (flt.op) {
+	case FLT_LT:
+		return cmp < 0;
+	case FLT_LE:
+		return cmp <= 0;
+	case FLT_GT:
+		return cmp > 0;
+	case FLT_GE:
+		return cmp >= 0;
+	}
+	return false;
+}
+
+/* A field may hold several values (ip, mac, netif), the predicate
+ * holds if any of them matches, the negated one if none does.
+ */
+static bool match_filter(const VmFilter &flt, std::string str)
+{
+	bool neg = (flt.op == FLT_NE || flt.op == FLT_NOMATCH);
+
+	boost::trim(str);
+	if (match_value(flt, str))
+		return !neg;
+
+	str_list_t values = split(str);
+	if (values.size() > 1) {
+		for (str_list_t::const_iterator it = values.begin();
+				it != values.end(); ++it)
+			if (match_value(flt, *it))
+				return !neg;
+	}
+	return neg;
+}
+
+/* Check the predicates of cost from min_cost to max_cost, fetching only
+ * the data each of them needs. The row is dropped on the first mismatch,
+ * so the rest of the data is never fetched for it.
+ */
+static bool filter_vm(PrlVm *vm, const VmFilterList &filter,
+		unsigned int min_cost, unsigned int max_cost, VmRow &row)
+{
+	BOOST_FOREACH(const VmFilter &flt, filter) {
+		if (flt.cost < min_cost || flt.cost > max_cost)
+			continue;
+
+		fetch_vm_data(vm, flt.deps, row);
+		cur_row = &row;
+		/* get all the values of the multi-value fields */
+		last_field = true;
+		std::string str = vm_field_tbl[flt.field].get_fn(vm);
+		cur_row = NULL;
+
+		if (!match_filter(flt, str))
+			return false;
+	}
+	return true;
+}
+
+/* The guest addresses are checked separately, after the guests are probed */
+static bool is_vm_listed(PrlVm *vm, const CmdParamData &param,
+		const VmFilterList &filter, VmRow &row)
+{
+	bool tmpl = vm->is_template();
+	/* Skip all non template if -t specified */
+	if (param.tmpl && !tmpl)
+		return false;
+	/* Do not show templates by default */
+	if (!param.tmpl && param.id.empty() && tmpl)
+		return false;
+
+	if (!filter_vm(vm, filter, FLT_COST_CONFIG, FLT_COST_CONFIG, row))
+		return false;
+
+	/* --filter lists the VMs in any state unless -S is specified */
+	if (!param.info) {
+		if (param.id.empty() && !param.list_all && !param.tmpl &&
+				(param.list_filter.empty() || param.list_stopped)) {
+			vm->update_state();
+			row.loaded |= FD_STATE;
+			if (param.list_stopped) {
+				if (vm->get_state() != VMS_STOPPED)
+					return false;
+			} else if (vm->get_state() != VMS_RUNNING)
+				return false;
+		}
+	}
+
+	return filter_vm(vm, filter, FLT_COST_STATE, FLT_COST_DEVICES, row);
+}
+
+/* The sort key of a row: it is computed once, and the rows are sorted by
+ * the keys rather than calling the getters on every comparison.
+ */
+struct SortKey
+{
+	SortKey() : idx(0), none(false), num(0) {}
+
+	unsigned int idx;
+	/* the value is missing, such rows go last */
+	bool none;
+	double num;
+	std::string str;
+};
+
+static bool sort_key_less(const SortKey &k1, const SortKey &k2)
+{
+	if (k1.num != k2.num)
+		return k1.num < k2.num;
+	return k1.str < k2.str;
+}
+
+/* Sort the keys in the ascending or, with rev, the descending order; the
+ * missing values go last either way */
+static void sort_keys(std::vector<SortKey> &keys, bool rev)
+{
+	std::stable_sort(keys.begin(), keys.end(),
+		[rev](const SortKey &k1, const SortKey &k2) {
+			if (k1.none != k2.none)
+				return k2.none;
+			return rev ? sort_key_less(k2, k1) : sort_key_less(k1, k2);
+		});
+}
+
+static void get_sort_key(const std::string &val, int type, SortKey &key)
+{
+	switch (type) {
+	case SORT_NUM: {
+		char *end;
+
+		key.num = strtod(val.c_str(), &end);
+		key.none = (end == val.c_str());
+		break;
+	}
+	case SORT_IP: {
+		/* IPv4 addresses are mapped to IPv6 ones to compare them all */
+		unsigned char addr[16] = {};
+		std::string ip = val.substr(0, val.find_first_of("/ "));
+
+		if (inet_pton(AF_INET6, ip.c_str(), addr) != 1) {
+			addr[10] = addr[11] = 0xff;
+			if (inet_pton(AF_INET, ip.c_str(), addr + 12) != 1)
+				key.none = true;
+		}
+		key.str.assign((const char *)addr, sizeof(addr));
+		break;
+	}
+	default:
+		key.str = val;
+	}
+}
+
+/* Fill order with the row indexes in the sort order. If the rows are
+ * prepared already, only the listed ones get a key.
+ */
+static void sort_rows(std::vector<PrlVm *> &vm_list, std::vector<VmRow> &rows,
+		int sort_fld, bool sort_rev, bool prepared, unsigned int jobs,
+		std::vector<unsigned int> &order)
+{
+	std::vector<SortKey> keys(vm_list.size());
+	IntList fld(1, sort_fld);
+	unsigned int deps = vm_field_tbl->get_deps(fld);
+
+	run_parallel(keys.size(), jobs, [&](unsigned int i) {
+		keys[i].idx = i;
+		if (prepared && !rows[i].show) {
+			keys[i].none = true;
+			return;
+		}
+
+		fetch_vm_data(vm_list[i], deps, rows[i]);
+		cur_row = &rows[i];
+		last_field = false;
+		std::string val = vm_field_tbl[sort_fld].get_fn(vm_list[i]);
+		cur_row = NULL;
+
+		get_sort_key(val, vm_field_tbl[sort_fld].sort_type, keys[i]);
+	});
+
+	sort_keys(keys, sort_rev);
+	for (unsigned int i = 0; i < keys.size(); ++i)
+		order[i] = keys[i].idx;
 }
 
 unsigned FieldVm::get_PGVLF(const std::string &fields, bool tmpl, bool info)
@@ -478,28 +924,630 @@ unsigned FieldVm::get_PGVLF(const std::string &fields, bool tmpl, bool info)
 	return flags;
 }
 
-int PrlSrv::list_vm(const CmdParamData &param)
+#define LIST_CACHE_MAGIC	"prlctl-list-cache 1"
+
+PrlListCache::PrlListCache(const std::string &srv_uuid) :
+	complete(false), seq(0), m_monitor_fd(-1)
 {
-	PRL_RESULT ret;
-	const char *order_str = 0;
-	int sort_fld;
-	bool sort_rev = false;
-	IntList field_order;
-	std::unique_ptr<PrlOutFormatter> f(get_formatter(param.use_json));
+	std::string id(srv_uuid);
 
-	if (param.list_all_fields) {
-		FieldVm *field;
-		field = vm_field_tbl;
-		while (field->name) {
-			if (!(field->type & PVTF_HIDE) && field->type & param.vmtype)
-				printf("%-20s %s\n", field->name, field->hdr);
-			++field;
+	boost::trim_if(id, boost::is_any_of("{}"));
+	m_path = std::string(LIST_CACHE_DIR) + "/" + id;
+}
+
+PrlListCache::~PrlListCache()
+{
+	if (m_monitor_fd != -1)
+		close(m_monitor_fd);
+}
+
+static std::string cache_escape(const std::string &str)
+{
+	std::string out;
+
+	for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+		switch (*it) {
+		case '\\': out += "\\\\"; break;
+		case '\t': out += "\\t"; break;
+		case '\n': out += "\\n"; break;
+		default: out += *it;
+		}
+	}
+	return out;
+}
+
+static std::string cache_unescape(const std::string &str)
+{
+	std::string out;
+
+	for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+		if (*it != '\\' || it + 1 == str.end()) {
+			out += *it;
+			continue;
+		}
+		switch (*++it) {
+		case 't': out += '\t'; break;
+		case 'n': out += '\n'; break;
+		default: out += *it;
+		}
+	}
+	return out;
+}
+
+/* The file format:
+ *	prlctl-list-cache 1
+ *	seq <seq> <complete>
+ *	vm <uuid> <valid> <template> <vmtype>
+ *	<field>\t<value>
+ *	...
+ *	end
+ * A file which is not finished by "end" is treated as empty.
+ */
+int PrlListCache::read_locked(int fd)
+{
+	std::string data, line;
+	char buf[4096];
+	ssize_t n;
+	VmCacheEntry *vm = NULL;
+	bool end = false;
+	unsigned int vmtype;
+
+	complete = false;
+	seq = 0;
+	vms.clear();
+
+	while ((n = pread(fd, buf, sizeof(buf), data.size())) > 0)
+		data.append(buf, n);
+	if (n < 0) {
+		prl_log(L_DEBUG, "Unable to read %s: %m", m_path.c_str());
+		return -1;
+	}
+	if (data.empty())
+		return 0;
+
+	std::istringstream in(data);
+	if (!std::getline(in, line) || line != LIST_CACHE_MAGIC)
+		goto corrupted;
+	while (std::getline(in, line)) {
+		char uuid[128];
+		int valid, tmpl, full;
+
+		if (line == "end") {
+			end = true;
+			break;
+		} else if (sscanf(line.c_str(), "seq %lu %d", &seq, &full) == 2) {
+			complete = full;
+		} else if (sscanf(line.c_str(), "vm %127s %d %d %u", uuid,
+					&valid, &tmpl, &vmtype) == 4) {
+			vm = &vms[uuid];
+			vm->valid = valid;
+			vm->tmpl = tmpl;
+			vm->vmtype = vmtype;
+		} else {
+			std::string::size_type pos = line.find('\t');
+
+			if (vm == NULL || pos == std::string::npos)
+				goto corrupted;
+			vm->fields[line.substr(0, pos)] =
+				cache_unescape(line.substr(pos + 1));
+		}
+	}
+	if (end)
+		return 0;
+
+corrupted:
+	prl_log(L_DEBUG, "The list cache %s is corrupted", m_path.c_str());
+	complete = false;
+	vms.clear();
+	return 0;
+}
+
+int PrlListCache::write_locked(int fd)
+{
+	std::ostringstream out;
+	std::map<std::string, VmCacheEntry>::const_iterator it;
+	std::map<std::string, std::string>::const_iterator f;
+
+	out << LIST_CACHE_MAGIC << "\n";
+	out << "seq " << seq << " " << (complete ? 1 : 0) << "\n";
+	for (it = vms.begin(); it != vms.end(); ++it) {
+		out << "vm " << it->first << " " << (it->second.valid ? 1 : 0) <<
+			" " << (it->second.tmpl ? 1 : 0) << " " <<
+			it->second.vmtype << "\n";
+		for (f = it->second.fields.begin(); f != it->second.fields.end(); ++f)
+			out << f->first << "\t" << cache_escape(f->second) << "\n";
+	}
+	out << "end\n";
+
+	std::string data = out.str();
+	size_t done = 0;
+
+	if (ftruncate(fd, 0))
+		goto err;
+	while (done < data.size()) {
+		ssize_t n = pwrite(fd, data.c_str() + done, data.size() - done, done);
+		if (n < 0)
+			goto err;
+		done += n;
+	}
+	return 0;
+
+err:
+	prl_log(L_DEBUG, "Unable to write %s: %m", m_path.c_str());
+	return -1;
+}
+
+/* Taken for the whole "prlctl monitor --cache" run. The events sent
+ * before the monitor started are lost, so the cache starts empty.
+ */
+int PrlListCache::lock_monitor()
+{
+	std::string path = m_path + ".monitor";
+
+	if (mkdir(LIST_CACHE_DIR, 0700) && errno != EEXIST)
+		return prl_err(-1, "Unable to create %s: %m", LIST_CACHE_DIR);
+
+	m_monitor_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (m_monitor_fd == -1)
+		return prl_err(-1, "Unable to open %s: %m", path.c_str());
+
+	if (flock(m_monitor_fd, LOCK_EX | LOCK_NB)) {
+		int err = errno;
+
+		close(m_monitor_fd);
+		m_monitor_fd = -1;
+		if (err == EWOULDBLOCK)
+			return prl_err(-1, "The list cache is already maintained"
+					" by another monitor");
+		errno = err;
+		return prl_err(-1, "Unable to lock %s: %m", path.c_str());
+	}
+
+	return invalidate(std::string(), true);
+}
+
+bool PrlListCache::is_maintained() const
+{
+	std::string path = m_path + ".monitor";
+	bool locked;
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	locked = flock(fd, LOCK_SH | LOCK_NB) && errno == EWOULDBLOCK;
+	close(fd);
+
+	return locked;
+}
+
+int PrlListCache::load()
+{
+	int fd, ret;
+
+	complete = false;
+	seq = 0;
+	vms.clear();
+
+	fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return errno == ENOENT ? 0 : -1;
+	if (flock(fd, LOCK_SH)) {
+		close(fd);
+		return -1;
+	}
+	ret = read_locked(fd);
+	close(fd);
+
+	return ret;
+}
+
+/* Store the entries unless an event came after they were loaded */
+int PrlListCache::save()
+{
+	PrlListCache cur("");
+	int fd, ret = 0;
+
+	cur.m_path = m_path;
+
+	fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return -1;
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return -1;
+	}
+	if (cur.read_locked(fd) == 0 && cur.seq == seq)
+		ret = write_locked(fd);
+	else
+		prl_log(L_DEBUG, "The list cache has changed, not saved");
+	close(fd);
+
+	return ret;
+}
+
+/* Mark the VM entry stale, drop it if the VM is removed. An empty uuid
+ * drops all the entries.
+ */
+int PrlListCache::invalidate(const std::string &uuid, bool removed)
+{
+	int fd, ret;
+
+	fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return prl_err(-1, "Unable to open %s: %m", m_path.c_str());
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return prl_err(-1, "Unable to lock %s: %m", m_path.c_str());
+	}
+	read_locked(fd);
+	if (uuid.empty()) {
+		vms.clear();
+		complete = false;
+	} else if (removed) {
+		vms.erase(uuid);
+	} else {
+		vms[uuid].valid = false;
+	}
+	++seq;
+	ret = write_locked(fd);
+	close(fd);
+
+	return ret;
+}
+
+/* Evaluate all the fields but the guest addresses for the cache */
+static void fill_cache_entry(PrlVm *vm, VmCacheEntry &entry)
+{
+	const FieldVm *fld;
+	unsigned int deps = 0;
+	VmRow row;
+
+	for (fld = vm_field_tbl; fld->name; ++fld)
+		if (!(fld->deps & FD_GUEST_IP))
+			deps |= fld->deps;
+	fetch_vm_data(vm, deps, row);
+
+	entry.valid = true;
+	entry.tmpl = vm->is_template();
+	entry.vmtype = vm->get_vm_type() == PVT_CT ? PVTF_CT : PVTF_VM;
+	entry.fields.clear();
+
+	cur_row = &row;
+	/* keep all the values of the multi-value fields */
+	last_field = true;
+	for (fld = vm_field_tbl; fld->name; ++fld)
+		if (!(fld->deps & FD_GUEST_IP) && fld->get_fn != get_host)
+			entry.fields[fld->name] = fld->get_fn(vm);
+	cur_row = NULL;
+}
+
+/* Refresh the stale entries with a request per changed VM, or fill the
+ * cache with the whole VM list if it is empty.
+ */
+int PrlSrv::update_list_cache(PrlListCache &cache, unsigned int jobs)
+{
+	std::vector<PrlVm *> vms;
+	std::vector<VmCacheEntry *> entries;
+	PrlVmList stale;
+	int ret = 0;
+
+	if (!cache.complete) {
+		if ((ret = update_vm_list(PVTF_VM | PVTF_CT, PGVLF_FILL_AUTOGENERATED)))
+			return ret;
+		cache.vms.clear();
+		for (PrlVmList::iterator it = m_VmList.begin(); it != m_VmList.end(); ++it) {
+			vms.push_back(*it);
+			entries.push_back(&cache.vms[(*it)->get_uuid()]);
+		}
+		cache.complete = true;
+	} else {
+		std::map<std::string, VmCacheEntry>::iterator it;
+		std::vector<std::string> ids;
+		std::vector<PrlVm *> found;
+
+		for (it = cache.vms.begin(); it != cache.vms.end(); ++it)
+			if (!it->second.valid)
+				ids.push_back(it->first);
+
+		if (!ids.empty())
+			ret = get_vm_configs(ids, found, PGVC_SEARCH_BY_UUID);
+		for (size_t i = 0; ret == 0 && i < found.size(); i++) {
+			it = cache.vms.find(ids[i]);
+			if (found[i] == NULL) {
+				/* removed, the event is on the way */
+				cache.vms.erase(it);
+				continue;
+			}
+			vms.push_back(stale.add(found[i]));
+			entries.push_back(&it->second);
+		}
+	}
+
+	if (ret == 0 && !vms.empty()) {
+		run_parallel(vms.size(), jobs, [&](unsigned int i) {
+			fill_cache_entry(vms[i], *entries[i]);
+		});
+		cache.save();
+	}
+	stale.del();
+
+	return ret;
+}
+
+/* The cache keeps all the addresses, as shown in the last column */
+static std::string get_cached_value(const VmCacheEntry &vm, int id, bool last)
+{
+	std::map<std::string, std::string>::const_iterator it;
+
+	if (vm_field_tbl[id].get_fn == get_host)
+		return list_host;
+	it = vm.fields.find(vm_field_tbl[id].name);
+	if (it == vm.fields.end())
+		return std::string("-");
+	if (last || vm_field_tbl[id].sort_type != SORT_IP)
+		return it->second;
+
+	return handle_empty_str(it->second.substr(0, it->second.find(' ')));
+}
+
+/* Same as the list_vm() rows, but the data are taken from the cache */
+static void print_cached_list(const PrlListCache &cache,
+		const CmdParamData &param, IntList &field_order,
+		const VmFilterList &filter, int sort_fld, bool sort_rev,
+		PrlOutFormatter &f)
+{
+	std::vector<const VmCacheEntry *> entries;
+	std::vector<SortKey> keys;
+	std::map<std::string, VmCacheEntry>::const_iterator it;
+
+	for (it = cache.vms.begin(); it != cache.vms.end(); ++it) {
+		const VmCacheEntry &vm = it->second;
+		bool match = true;
+
+		if (!(vm.vmtype & param.vmtype) || vm.tmpl != param.tmpl)
+			continue;
+		if (!param.list_all && !param.tmpl &&
+				(param.list_filter.empty() || param.list_stopped) &&
+				get_cached_value(vm, vm_field_tbl->find("status"), true) !=
+					(param.list_stopped ? "stopped" : "running"))
+			continue;
+		BOOST_FOREACH(const VmFilter &flt, filter) {
+			if (!match_filter(flt, get_cached_value(vm, flt.field, true))) {
+				match = false;
+				break;
+			}
 		}
+		if (!match)
+			continue;
+
+		SortKey key;
+		key.idx = entries.size();
+		if (sort_fld != -1)
+			get_sort_key(get_cached_value(vm, sort_fld, false),
+					vm_field_tbl[sort_fld].sort_type, key);
+		keys.push_back(key);
+		entries.push_back(&vm);
+	}
+	sort_keys(keys, sort_rev);
+
+	f.set_stream(stdout);
+	f.open_list();
+	BOOST_FOREACH(const SortKey &key, keys) {
+		IntList::const_iterator i = field_order.begin();
+		str_list_t values;
+
+		while (i != field_order.end()) {
+			int id = *i;
+
+			values.push_back(get_cached_value(*entries[key.idx], id,
+						++i == field_order.end()));
+		}
+		f.tbl_row_open();
+		vm_field_tbl->print(values, field_order, f);
+		f.tbl_row_close();
+	}
+	f.close_list();
+}
+
+/* A row of the table shown by list --watch */
+struct WatchRow
+{
+	WatchRow() : show(false) {}
+
+	std::string uuid;
+	bool show;
+	str_list_t values;
+};
+
+struct ListWatch
+{
+	ListWatch() : stop(false) {}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	/* the VMs changed since the last update */
+	std::set<std::string> changed;
+	bool stop;
+};
+
+static int list_watch_event_handler(PRL_HANDLE hEvent, void *data)
+{
+	PrlHandle h(hEvent);
+	ListWatch *w = reinterpret_cast<ListWatch *>(data);
+	PRL_HANDLE_TYPE type;
+	PRL_EVENT_TYPE evt_type;
+	PRL_CHAR buf[256];
+	PRL_UINT32 buflen = sizeof(buf);
+
+	if (PrlHandle_GetType(h.get_handle(), &type) || type != PHT_EVENT)
+		return 0;
+	if (PrlEvent_GetType(h.get_handle(), &evt_type))
+		return 0;
+
+	switch (evt_type) {
+	case PET_DSP_EVT_VM_STATE_CHANGED:
+	case PET_DSP_EVT_VM_CONFIG_CHANGED:
+	case PET_DSP_EVT_VM_CREATED:
+	case PET_DSP_EVT_VM_ADDED:
+	case PET_DSP_EVT_VM_DELETED:
+	case PET_DSP_EVT_VM_UNREGISTERED:
+		break;
+	default:
+		return 0;
+	}
+	if (PrlEvent_GetIssuerId(h.get_handle(), buf, &buflen))
 		return 0;
+
+	std::lock_guard<std::mutex> lock(w->mutex);
+	w->changed.insert(buf);
+	w->cond.notify_one();
+
+	return 0;
+}
+
+static void stop_list_watch(void *data)
+{
+	ListWatch *w = reinterpret_cast<ListWatch *>(data);
+
+	std::lock_guard<std::mutex> lock(w->mutex);
+	w->stop = true;
+	w->cond.notify_one();
+}
+
+/* Request the VM again and evaluate its row. The row of a removed VM
+ * keeps the last values with the "deleted" status.
+ */
+static void update_watch_row(PrlSrv &srv, const CmdParamData &param,
+		IntList &field_order, const VmFilterList &filter, WatchRow &wr)
+{
+	std::vector<PrlVm *> vms(1, (PrlVm *)NULL);
+	std::vector<VmRow> rows(1);
+	VmRow &row = rows[0];
+
+	if (srv.get_vm_config(wr.uuid, &vms[0], true, PGVC_SEARCH_BY_UUID) ||
+			vms[0] == NULL) {
+		IntList::const_iterator it = field_order.begin();
+		str_list_t::iterator v = wr.values.begin();
+
+		for (; it != field_order.end() && v != wr.values.end(); ++it, ++v)
+			if (!strcmp(vm_field_tbl[*it].name, "status"))
+				*v = "deleted";
+		wr.show = false;
+		return;
 	}
 
+	unsigned int deps = vm_field_tbl->get_deps(field_order) |
+			get_filter_deps(filter);
+	if ((row.show = is_vm_listed(vms[0], param, filter, row))) {
+		fetch_vm_data(vms[0], deps, row);
+		if (row.probe)
+			probe_guest_ips(vms, rows, param);
+		row.show = filter_vm(vms[0], filter, FLT_COST_GUEST,
+				FLT_COST_GUEST, row);
+	}
+	fetch_vm_data(vms[0], deps & ~FD_GUEST_IP, row);
+
+	cur_row = &row;
+	vm_field_tbl->eval(vms[0], field_order, wr.values);
+	cur_row = NULL;
+	wr.show = row.show;
+
+	delete vms[0];
+}
+
+/* Keep the table up to date until interrupted: only the VMs the events
+ * are about are requested again. On a terminal the table is redrawn,
+ * otherwise only the changed rows are printed.
+ */
+static int watch_vm_list(PrlSrv &srv, const CmdParamData &param,
+		IntList &field_order, const VmFilterList &filter,
+		std::vector<WatchRow> &table, PrlOutFormatter &f)
+{
+	ListWatch w;
+	bool redraw = isatty(STDOUT_FILENO) && !param.use_json &&
+			!param.use_ndjson;
+	int ret;
+
+	if ((ret = srv.reg_event_callback(list_watch_event_handler, &w)))
+		return ret;
+	const PrlHook *hook = get_cleanup_ctx().register_hook(stop_list_watch, &w);
+
+	for (;;) {
+		std::set<std::string> changed;
+		std::vector<unsigned int> updated;
+
+		{
+			std::unique_lock<std::mutex> lock(w.mutex);
+
+			while (!w.stop && w.changed.empty())
+				w.cond.wait(lock);
+			if (w.stop)
+				break;
+			changed.swap(w.changed);
+		}
+
+		BOOST_FOREACH(const std::string &uuid, changed) {
+			unsigned int i;
+
+			for (i = 0; i < table.size(); ++i)
+				if (table[i].uuid == uuid)
+					break;
+			if (i == table.size()) {
+				/* only the given VM is watched */
+				if (!param.id.empty())
+					continue;
+				table.push_back(WatchRow());
+				table.back().uuid = uuid;
+			}
+
+			bool shown = table[i].show;
+			update_watch_row(srv, param, field_order, filter, table[i]);
+			if (shown || table[i].show)
+				updated.push_back(i);
+		}
+		if (updated.empty())
+			continue;
+
+		if (redraw) {
+			fputs("\033[H\033[2J", stdout);
+			if (!param.list_no_hdr)
+				vm_field_tbl->print_hdr(field_order);
+		}
+		f.open_list();
+		if (redraw) {
+			BOOST_FOREACH(const WatchRow &wr, table) {
+				if (!wr.show)
+					continue;
+				f.tbl_row_open();
+				vm_field_tbl->print(wr.values, field_order, f);
+				f.tbl_row_close();
+			}
+		} else {
+			BOOST_FOREACH(unsigned int i, updated) {
+				f.tbl_row_open();
+				vm_field_tbl->print(table[i].values, field_order, f);
+				f.tbl_row_close();
+			}
+		}
+		f.close_list();
+	}
+
+	get_cleanup_ctx().unregister_hook(hook);
+	srv.unreg_event_callback(list_watch_event_handler, &w);
+
+	return 0;
+}
+
+/* The columns and the sort field of the list */
+static int get_list_fields(const CmdParamData &param, IntList &field_order,
+		int &sort_fld, bool &sort_rev)
+{
+	const char *order_str = 0;
+
 	// sort by name by default
 	sort_fld = vm_field_tbl->find("name");
+	sort_rev = false;
 	if (!param.list_field.empty()) {
 		order_str = param.list_field.c_str();
 	} else if (param.tmpl) {
@@ -534,13 +1582,93 @@ int PrlSrv::list_vm(const CmdParamData &param)
 		sort_fld = field_order.front();
 	}
 
+	/* the rows of several servers tell where they come from */
+	if (!param.hosts.empty() && !param.info) {
+		int host = vm_field_tbl->find("host");
+
+		if (std::find(field_order.begin(), field_order.end(), host) ==
+				field_order.end())
+			field_order.push_front(host);
+	}
+
+	return 0;
+}
+
+int PrlSrv::list_vm(const CmdParamData &param)
+{
+	PRL_RESULT ret;
+	int sort_fld;
+	bool sort_rev;
+	IntList field_order;
+	std::unique_ptr<PrlOutFormatter> f(get_formatter(param.use_ndjson ?
+			OUT_FORMATTER_NDJSON : param.use_json ?
+			OUT_FORMATTER_JSON : OUT_FORMATTER_PLAIN));
+
+	if (param.list_all_fields) {
+		FieldVm *field;
+		field = vm_field_tbl;
+		while (field->name) {
+			if (!(field->type & PVTF_HIDE) && field->type & param.vmtype)
+				printf("%-20s %s\n", field->name, field->hdr);
+			++field;
+		}
+		return 0;
+	}
+
+	if (get_list_fields(param, field_order, sort_fld, sort_rev))
+		return 1;
+
+	VmFilterList filter;
+	if (compile_filter(param.list_filter, filter))
+		return 1;
+
+	list_host = param.login.server.empty() ? "localhost" : param.login.server;
+
+	/* The row of a multi-host run: the sort value goes first, the
+	 * values are merged with the other servers ones by print_host_rows()
+	 */
+	if (param.host_child)
+		field_order.push_front(sort_fld);
+
 	if (!param.list_no_hdr && param.info && !param.use_json)
 		fprintf(stdout, "INFO");
 
-	if (!param.list_no_hdr && !param.use_json)
+	if (!param.list_no_hdr && !param.use_json && !param.host_child)
 		vm_field_tbl->print_hdr(field_order);
 
-	unsigned flags = vm_field_tbl->get_PGVLF(param.list_field, param.tmpl, param.info);
+	if (param.list_cache && param.id.empty() && !param.info &&
+			!param.list_watch && !param.host_child) {
+		unsigned int all_deps = vm_field_tbl->get_deps(field_order) |
+			get_filter_deps(filter);
+		PrlListCache cache(get_uuid());
+
+		if (sort_fld != -1) {
+			IntList fld(1, sort_fld);
+			all_deps |= vm_field_tbl->get_deps(fld);
+		}
+
+		/* the guest addresses are never cached */
+		if (!(all_deps & FD_GUEST_IP) && cache.is_maintained() &&
+				cache.load() == 0 &&
+				update_list_cache(cache, param.list_jobs) == 0) {
+			print_cached_list(cache, param, field_order, filter,
+					sort_fld, sort_rev, *f);
+			return 0;
+		}
+		prl_log(L_DEBUG, "The list cache is not used");
+	}
+
+	/* the filtered and sorted by fields have to be fetched as well */
+	std::string fields(param.list_field);
+	if (sort_fld != -1) {
+		fields += ",";
+		fields += vm_field_tbl[sort_fld].name;
+	}
+	BOOST_FOREACH(const VmFilter &flt, filter) {
+		fields += ",";
+		fields += vm_field_tbl[flt.field].name;
+	}
+	unsigned flags = vm_field_tbl->get_PGVLF(fields, param.tmpl, param.info);
 	std::vector<PrlVm *> vm_list;
 	if (param.id.empty()) {
 		if ((ret = update_vm_list(param.vmtype, flags)))
@@ -548,12 +1676,7 @@ int PrlSrv::list_vm(const CmdParamData &param)
 			return ret;
 		}
 
-		/* Copy of VmList to perform sort operation */
 		vm_list.insert(vm_list.begin(), m_VmList.begin(), m_VmList.end());
-		/* Sort VM list before processing */
-		if (sort_fld != -1 && vm_field_tbl[sort_fld].sort_fn != NULL)
-			std::sort(vm_list.begin(), vm_list.end(),
-					vm_field_tbl[sort_fld].sort_fn);
 	} else {
 		PrlVm *vm = NULL;
 
@@ -576,51 +1699,218 @@ int PrlSrv::list_vm(const CmdParamData &param)
 
 	if (prl_get_log_verbose() == L_NORMAL)
 		prl_set_log_enable(0);
-	f->open_list();
-
-	unsigned int idx;
-	for (unsigned int i = 0; i < vm_list.size(); ++i) {
-		if (sort_rev)
-			idx = vm_list.size() - i - 1;
-		else
-			idx = i;
-
-		PrlVm *vm = vm_list[idx];
+	f->set_stream(stdout);
+	/* the rows of a host child are framed by the parent */
+	if (!param.host_child)
+		f->open_list();
+
+	/* Resolve the rows in parallel: each worker owns the VMs it picks up,
+	 * the rows are streamed out in the sort order as soon as they are ready.
+	 */
+	std::vector<VmRow> rows(vm_list.size());
+	std::vector<unsigned int> order(vm_list.size());
+	unsigned int deps = vm_field_tbl->get_deps(field_order) |
+			get_filter_deps(filter);
+	unsigned int sort_deps = 0;
+
+	if (sort_fld != -1) {
+		IntList fld(1, sort_fld);
+		sort_deps = vm_field_tbl->get_deps(fld);
+		deps |= sort_deps;
+	}
+	for (unsigned int i = 0; i < order.size(); ++i)
+		order[i] = i;
+	/* The guest probes share one deadline, so every row has to be
+	 * prepared before the guests are asked. Same for sorting by a field
+	 * which needs the VM data.
+	 */
+	bool probe = !param.info && (deps & FD_GUEST_IP);
+	bool late_sort = (sort_deps != 0);
+	auto prepare = [&](unsigned int i) {
+		PrlVm *vm = vm_list[i];
+
+		if (!(rows[i].show = is_vm_listed(vm, param, filter, rows[i])))
+			return;
+		if (!param.info)
+			fetch_vm_data(vm, deps, rows[i]);
+	};
+
+	if (sort_fld != -1 && !late_sort)
+		sort_rows(vm_list, rows, sort_fld, sort_rev, false,
+				param.list_jobs, order);
+	if (probe || late_sort) {
+		run_parallel(vm_list.size(), param.list_jobs, prepare);
+		if (probe)
+			probe_guest_ips(vm_list, rows, param);
+	}
+	if (late_sort)
+		sort_rows(vm_list, rows, sort_fld, sort_rev, true,
+				param.list_jobs, order);
+
+	run_parallel_ordered(vm_list.size(), param.list_jobs, [&](unsigned int n) {
+		unsigned int i = order[n];
+		TraceSpan span("list_vm row", vm_list[i]->get_uuid());
+
+		if (!probe && !late_sort)
+			prepare(i);
+		if (!rows[i].show)
+			return;
+		if (!filter_vm(vm_list[i], filter, FLT_COST_GUEST,
+					FLT_COST_GUEST, rows[i])) {
+			rows[i].show = false;
+			return;
+		}
+		if (param.info) {
+			/* the configuration is assembled by the worker */
+			std::unique_ptr<PrlOutFormatter> rf(get_formatter(f->type));
+
+			rf->set_fields(param.info_fields);
+			rf->tbl_row_open();
+			vm_list[i]->append_configuration(*rf);
+			rf->tbl_row_close();
+			rows[i].values.push_back(rf->get_buffer());
+			return;
+		}
 
-		bool tmpl = vm->is_template();
-		/* Skip all non template if -t specified */
-		if (param.tmpl && !tmpl)
-			continue;
-		/* Do not show templates by default */
-		if (!param.tmpl && param.id.empty() && tmpl)
-			continue;
+		cur_row = &rows[i];
+		vm_field_tbl->eval(vm_list[i], field_order, rows[i].values);
+		cur_row = NULL;
+	}, [&](unsigned int n) {
+		unsigned int i = order[n];
 
-		if (!param.info) {
-			if (param.id.empty() && !param.list_all && !param.tmpl) {
-				vm->update_state();
-				if (param.list_stopped) {
-					if (vm->get_state() != VMS_STOPPED)
-						continue;
-				} else if (vm->get_state() != VMS_RUNNING)
-					continue;
-			}
-		}
+		if (!rows[i].show)
+			return;
 
-		f->tbl_row_open();
 		if (param.info) {
-			vm->append_configuration(*f);
+			f->tbl_add_row(rows[i].values.front());
+		} else if (param.host_child) {
+			str_list_t::const_iterator v = rows[i].values.begin();
+			std::string line(cache_escape(*v));
+
+			while (++v != rows[i].values.end())
+				line += "\t" + cache_escape(*v);
+			fprintf(stdout, "%s\n", line.c_str());
 		} else {
-			vm_field_tbl->print(vm, field_order, *f);
+			f->tbl_row_open();
+			vm_field_tbl->print(rows[i].values, field_order, *f);
+			f->tbl_row_close();
 		}
-		f->tbl_row_close();
+		/* the row is on the screen already */
+		if (!param.list_watch)
+			rows[i].values.clear();
+	});
+
+	if (!param.host_child)
+		f->close_list();
+
+	ret = 0;
+	if (param.list_watch && !param.info) {
+		std::vector<WatchRow> table(vm_list.size());
+
+		for (unsigned int n = 0; n < order.size(); ++n) {
+			table[n].uuid = vm_list[order[n]]->get_uuid();
+			table[n].show = rows[order[n]].show;
+			table[n].values.swap(rows[order[n]].values);
+		}
+		ret = watch_vm_list(*this, param, field_order, filter, table, *f);
 	}
-
-	f->close_list();
-	fputs(f->get_buffer().c_str(), stdout);
 	if (!param.id.empty() && vm_list.size() == 1) {
 		delete vm_list.front();
 		vm_list.clear();
 	}
+	return ret;
+}
+
+/* The VEs a bulk action is run for: all of them with --all, or the ones
+ * matching --filter in any state. Templates are never selected.
+ */
+int PrlSrv::select_vms(const CmdParamData &param, std::vector<PrlVm *> &vms)
+{
+	PRL_RESULT ret;
+	VmFilterList filter;
+	std::string fields;
+
+	if (compile_filter(param.list_filter, filter))
+		return -1;
+
+	BOOST_FOREACH(const VmFilter &flt, filter) {
+		fields += ",";
+		fields += vm_field_tbl[flt.field].name;
+	}
+	if ((ret = update_vm_list(param.vmtype,
+			vm_field_tbl->get_PGVLF(fields, false, false))))
+		return ret;
+
+	std::vector<PrlVm *> all(m_VmList.begin(), m_VmList.end());
+	std::vector<char> match(all.size());
+
+	run_parallel(all.size(), param.list_jobs, [&](unsigned int i) {
+		VmRow row;
+
+		if (all[i]->is_template())
+			return;
+		match[i] = filter_vm(all[i], filter, FLT_COST_CONFIG,
+				FLT_COST_GUEST, row);
+	});
+
+	for (unsigned int i = 0; i < all.size(); ++i)
+		if (match[i])
+			vms.push_back(all[i]);
+
+	return 0;
+}
+
+/* Merge the rows reported by the servers of a multi-host run into one
+ * table, sorted the same way list_vm() sorts the rows of one server.
+ */
+int print_host_rows(const CmdParamData &param, const str_list_t &lines)
+{
+	int sort_fld;
+	bool sort_rev;
+	IntList field_order;
+	std::vector<str_list_t> rows;
+	std::vector<SortKey> keys;
+	std::unique_ptr<PrlOutFormatter> f(get_formatter(param.use_ndjson ?
+			OUT_FORMATTER_NDJSON : param.use_json ?
+			OUT_FORMATTER_JSON : OUT_FORMATTER_PLAIN));
+
+	if (get_list_fields(param, field_order, sort_fld, sort_rev))
+		return 1;
+
+	BOOST_FOREACH(const std::string &line, lines) {
+		std::vector<std::string> v;
+		str_list_t values;
+		SortKey key;
+
+		/* the sort value goes first */
+		boost::split(v, line, boost::is_any_of("\t"));
+		if (v.size() != field_order.size() + 1) {
+			prl_log(L_DEBUG, "Skipping the malformed row: %s",
+					line.c_str());
+			continue;
+		}
+		key.idx = rows.size();
+		get_sort_key(cache_unescape(v[0]),
+				vm_field_tbl[sort_fld].sort_type, key);
+		for (unsigned int i = 1; i < v.size(); ++i)
+			values.push_back(cache_unescape(v[i]));
+		keys.push_back(key);
+		rows.push_back(values);
+	}
+	sort_keys(keys, sort_rev);
+
+	if (!param.list_no_hdr && !param.use_json)
+		vm_field_tbl->print_hdr(field_order);
+
+	f->set_stream(stdout);
+	f->open_list();
+	BOOST_FOREACH(const SortKey &key, keys) {
+		f->tbl_row_open();
+		vm_field_tbl->print(rows[key.idx], field_order, *f);
+		f->tbl_row_close();
+	}
+	f->close_list();
+
 	return 0;
 }
 
@@ -812,6 +2102,7 @@ int PrlSrv::list_user(const CmdParamData &param, bool use_json)
 	std::vector<PrlUser *>::const_iterator it = users.begin(),
 						eit = users.end();
 
+	f->set_stream(stdout);
 	f->open_list();
 	for (; it != eit; ++it) {
 #if 0
@@ -827,6 +2118,5 @@ int PrlSrv::list_user(const CmdParamData &param, bool use_json)
 	}
 	f->close_list();
 
-	fprintf(stdout, "%s", f->get_buffer().c_str());
 	return 0;
 }
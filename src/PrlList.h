@@ -24,4 +24,56 @@
 #ifndef __PRLLIST_H__
 #define __PRLLIST_H__
 
+#include <map>
+#include <string>
+#include "PrlTypes.h"
+
+#define LIST_CACHE_DIR	"/var/cache/prlctl"
+
+struct VmCacheEntry
+{
+	VmCacheEntry() : valid(false), tmpl(false), vmtype(0) {}
+
+	bool valid;
+	bool tmpl;
+	unsigned int vmtype;
+	/* the list field values */
+	std::map<std::string, std::string> fields;
+};
+
+/* On-disk inventory of the list fields of the server VMs.
+ * It is only trusted while "prlctl monitor --cache" runs: the monitor
+ * holds the monitor lock and invalidates the entries on VM events.
+ * Every change bumps seq, so that a listing does not store the data
+ * it fetched while the events were coming.
+ */
+class PrlListCache
+{
+public:
+	PrlListCache(const std::string &srv_uuid);
+	~PrlListCache();
+
+	int lock_monitor();
+	bool is_maintained() const;
+	int load();
+	int save();
+	int invalidate(const std::string &uuid, bool removed);
+
+	/* the entries cover all the server VMs */
+	bool complete;
+	unsigned long seq;
+	std::map<std::string, VmCacheEntry> vms;
+
+private:
+	int read_locked(int fd);
+	int write_locked(int fd);
+
+	std::string m_path;
+	int m_monitor_fd;
+};
+
+class CmdParamData;
+
+int print_host_rows(const CmdParamData &param, const str_list_t &lines);
+
 #endif // __PRLLIST_H__
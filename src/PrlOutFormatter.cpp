@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <boost/algorithm/string.hpp>
+
 #include "Utils.h"
 #include "PrlSrv.h"
 #include "PrlOutFormatter.h"
@@ -35,85 +37,370 @@
 
 std::string PrlOutFormatter::get_buffer()
 {
+	FormatTimer t;
+
 	return out.str();
 }
 
-PrlOutFormatterJSON::PrlOutFormatterJSON()
+/* Move the buffered output to the stream in fixed-size chunks */
+void PrlOutFormatter::flush()
+{
+	char buf[4096];
+	/* the write is not formatting */
+	FormatPause p;
+
+	if (stream == NULL)
+		return;
+
+	while (out.read(buf, sizeof(buf)), out.gcount() > 0)
+		fwrite(buf, 1, out.gcount(), stream);
+	out.str("");
+	out.clear();
+	fflush(stream);
+}
+
+void PrlOutFormatter::set_fields(const std::string &list)
+{
+	fields.clear();
+	if (!list.empty())
+		boost::split(fields, list, boost::is_any_of(","));
+}
+
+/* The key is output if it is on the path to one of the requested
+ * fields, or inside one of them: "Hardware.cpu" gets the Hardware
+ * section opened and everything in the cpu one.
+ */
+bool PrlOutFormatter::want(const char *key) const
+{
+	std::string p;
+
+	if (fields.empty())
+		return true;
+
+	for (std::vector<std::string>::const_iterator it = path.begin();
+			it != path.end(); ++it) {
+		p += *it;
+		p += ".";
+	}
+	p += key;
+
+	for (std::vector<std::string>::const_iterator it = fields.begin();
+			it != fields.end(); ++it) {
+		if (boost::iequals(*it, p) ||
+				boost::istarts_with(p, *it + ".") ||
+				boost::istarts_with(*it, p + "."))
+			return true;
+	}
+	return false;
+}
+
+bool PrlOutFormatter::skip_open(const char *key)
+{
+	if (skip_key(key)) {
+		skip++;
+		return true;
+	}
+	path.push_back(key);
+	return false;
+}
+
+bool PrlOutFormatter::skip_close()
+{
+	if (skip) {
+		skip--;
+		return true;
+	}
+	if (!path.empty())
+		path.pop_back();
+	return false;
+}
+
+void PrlOutFormatter::open_object()
+{
+	FormatTimer t;
+
+	do_open_object();
+}
+
+void PrlOutFormatter::close_object()
+{
+	FormatTimer t;
+
+	do_close_object();
+}
+
+void PrlOutFormatter::open_list()
+{
+	FormatTimer t;
+
+	do_open_list();
+}
+
+void PrlOutFormatter::close_list()
+{
+	FormatTimer t;
+
+	do_close_list();
+}
+
+void PrlOutFormatter::open(const char *key, bool is_inline)
+{
+	FormatTimer t;
+
+	do_open(key, is_inline);
+}
+
+void PrlOutFormatter::open_dev(const char *key)
+{
+	FormatTimer t;
+
+	do_open_dev(key);
+}
+
+void PrlOutFormatter::open_shf(const char *key, bool is_enabled)
+{
+	FormatTimer t;
+
+	do_open_shf(key, is_enabled);
+}
+
+void PrlOutFormatter::close(bool is_inline)
+{
+	FormatTimer t;
+
+	do_close(is_inline);
+}
+
+void PrlOutFormatter::add(const char *key, const char *value,
+		bool is_inline, bool use_quotes, bool hide_key)
+{
+	FormatTimer t;
+
+	do_add(key, value, is_inline, use_quotes, hide_key);
+}
+
+void PrlOutFormatter::add(const char *key, std::string value,
+		bool is_inline, bool use_quotes, bool hide_key)
+{
+	FormatTimer t;
+
+	do_add(key, value, is_inline, use_quotes, hide_key);
+}
+
+void PrlOutFormatter::add(const char *key, int value, const char *suffix,
+		bool is_inline, bool hide_key)
+{
+	FormatTimer t;
+
+	do_add(key, value, suffix, is_inline, hide_key);
+}
+
+void PrlOutFormatter::add(const char *key, bool value)
+{
+	FormatTimer t;
+
+	do_add(key, value);
+}
+
+void PrlOutFormatter::add_uptime(const char *key, unsigned long long uptime,
+		std::string start_date)
+{
+	FormatTimer t;
+
+	do_add_uptime(key, uptime, start_date);
+}
+
+void PrlOutFormatter::add_isenabled(bool is_enabled)
+{
+	FormatTimer t;
+
+	do_add_isenabled(is_enabled);
+}
+
+void PrlOutFormatter::add_host_dev(const char *id, const char *name,
+		const char *type, const char *assignment, const char *used_by)
 {
-	type = OUT_FORMATTER_JSON;
+	FormatTimer t;
+
+	do_add_host_dev(id, name, type, assignment, used_by);
+}
+
+void PrlOutFormatter::add_uuid(const char *key, const char *uuid)
+{
+	FormatTimer t;
+
+	do_add_uuid(key, uuid);
+}
+
+void PrlOutFormatter::lic_add(const char *key, const char *value)
+{
+	FormatTimer t;
+
+	do_lic_add(key, value);
+}
+
+void PrlOutFormatter::lic_add(const char *key, std::string value)
+{
+	FormatTimer t;
+
+	do_lic_add(key, value);
+}
+
+void PrlOutFormatter::lic_add(const char *key, int value)
+{
+	FormatTimer t;
+
+	do_lic_add(key, value);
+}
+
+void PrlOutFormatter::tbl_row_open()
+{
+	FormatTimer t;
+
+	do_tbl_row_open();
+}
+
+void PrlOutFormatter::tbl_row_close()
+{
+	FormatTimer t;
+
+	do_tbl_row_close();
+}
+
+void PrlOutFormatter::tbl_add_item(const char *key, const char *fmt,
+		const char *value)
+{
+	FormatTimer t;
+
+	do_tbl_add_item(key, fmt, value);
+}
+
+void PrlOutFormatter::tbl_add_uuid(const char *key, const char *fmt,
+		const char *value)
+{
+	FormatTimer t;
+
+	do_tbl_add_uuid(key, fmt, value);
+}
+
+void PrlOutFormatter::tbl_add_row(const std::string &row)
+{
+	FormatTimer t;
+
+	do_tbl_add_row(row);
+}
+
+/* In the compact mode every object and table row is written on a line
+ * of its own and lists are not wrapped into [], i.e. the output is
+ * newline delimited JSON.
+ */
+PrlOutFormatterJSON::PrlOutFormatterJSON(bool compact)
+{
+	type = compact ? OUT_FORMATTER_NDJSON : OUT_FORMATTER_JSON;
 	indent = 0;
 	is_first_key = true;
+	this->compact = compact;
 };
 
-void PrlOutFormatterJSON::open_object()
+void PrlOutFormatterJSON::put_sep()
 {
-	out << "{\n";
+	out << (compact ? "," : ",\n");
 }
 
-void PrlOutFormatterJSON::open_list()
+void PrlOutFormatterJSON::put_indent()
 {
-	out << "[\n";
+	if (compact)
+		return;
+	for (int i = 0; i < indent + 1; i++)
+		out << '\t';
+}
+
+void PrlOutFormatterJSON::put_nl()
+{
+	if (!compact)
+		out << "\n";
 }
 
-void PrlOutFormatterJSON::close_list()
+void PrlOutFormatterJSON::do_open_object()
 {
-	out << "\n]\n";
+	out << "{";
+	put_nl();
 }
 
-void PrlOutFormatterJSON::open(const char *key, bool)
+void PrlOutFormatterJSON::do_open_list()
 {
+	if (!compact)
+		out << "[\n";
+	is_first_key = true;
+}
+
+void PrlOutFormatterJSON::do_close_list()
+{
+	if (!compact)
+		out << "\n]\n";
+	flush();
+}
+
+void PrlOutFormatterJSON::do_open(const char *key, bool)
+{
+	if (skip_open(key))
+		return;
 	if (!is_first_key)
-		out << ",\n";
+		put_sep();
 	is_first_key = true;
 
-	for (int i = 0; i < indent + 1; i++)
-		out << '\t';
-	out << '\"' << key << '\"' << ": {\n";
+	put_indent();
+	out << '\"' << key << '\"' << ": {";
+	put_nl();
 	indent++;
 };
 
-void PrlOutFormatterJSON::open_dev(const char *key)
+void PrlOutFormatterJSON::do_open_dev(const char *key)
 {
 	open(key);
 };
 
-void PrlOutFormatterJSON::open_shf(const char *key, bool is_enabled)
+void PrlOutFormatterJSON::do_open_shf(const char *key, bool is_enabled)
 {
 	open(key);
 	add("enabled", is_enabled);
 }
 
-void PrlOutFormatterJSON::close(bool)
+void PrlOutFormatterJSON::do_close(bool)
 {
+	if (skip_close())
+		return;
 	indent--;
 
-	out << "\n";
-	for (int i = 0; i < indent + 1; i++)
-		out << '\t';
+	put_nl();
+	put_indent();
 	out << "}";
 	is_first_key = false;
 };
 
-void PrlOutFormatterJSON::close_object()
+void PrlOutFormatterJSON::do_close_object()
 {
-	out << "\n}\n";
+	put_nl();
+	out << "}\n";
+	is_first_key = true;
 };
 
 void PrlOutFormatterJSON::add_key(const char *key)
 {
 	if (!is_first_key)
-		out << ",\n";
+		put_sep();
 	else
 		is_first_key = false;
 
-	for (int i = 0; i < indent + 1; i++)
-		out << '\t';
-	out << '\"' << key << '\"' << ": ";
+	put_indent();
+	out << '\"' << key << '\"' << (compact ? ":" : ": ");
 };
 
-void PrlOutFormatterJSON::add(const char *key, const char *value,
+void PrlOutFormatterJSON::do_add(const char *key, const char *value,
 								bool, bool, bool)
 {
+	if (skip_key(key))
+		return;
 	add_key(key);
 	out << '\"';
 	while (*value) {
@@ -133,15 +420,17 @@ void PrlOutFormatterJSON::add(const char *key, const char *value,
 	out << "\"";
 };
 
-void PrlOutFormatterJSON::add(const char *key, std::string value,
+void PrlOutFormatterJSON::do_add(const char *key, std::string value,
 							  bool, bool, bool)
 {
 	add(key, value.c_str());
 }
 
-void PrlOutFormatterJSON::add(const char *key, int value,
+void PrlOutFormatterJSON::do_add(const char *key, int value,
 							  const char *suffix, bool, bool)
 {
+	if (skip_key(key))
+		return;
 	add_key(key);
 	if (strlen(suffix) != 0)
 		out << '\"' << value << suffix << '\"';
@@ -149,25 +438,29 @@ void PrlOutFormatterJSON::add(const char *key, int value,
 		out << value;
 }
 
-void PrlOutFormatterJSON::add(const char *key, bool value)
+void PrlOutFormatterJSON::do_add(const char *key, bool value)
 {
+	if (skip_key(key))
+		return;
 	add_key(key);
 	out << (value ? "true" : "false");
 }
 
-void PrlOutFormatterJSON::add_uptime(const char *key,
+void PrlOutFormatterJSON::do_add_uptime(const char *key,
 								unsigned long long uptime, std::string)
 {
+	if (skip_key(key))
+		return;
 	add_key(key);
 	out << '\"' << uptime << '\"';
 }
 
-void PrlOutFormatterJSON::add_isenabled(bool is_enabled)
+void PrlOutFormatterJSON::do_add_isenabled(bool is_enabled)
 {
 	add("enabled", is_enabled);
 }
 
-void PrlOutFormatterJSON::add_host_dev(const char *id, const char *name,
+void PrlOutFormatterJSON::do_add_host_dev(const char *id, const char *name,
 							  const char *type, const char *assignment,
 							  const char *used_by)
 {
@@ -181,7 +474,7 @@ void PrlOutFormatterJSON::add_host_dev(const char *id, const char *name,
 	close();
 }
 
-void PrlOutFormatterJSON::add_uuid(const char *key, const char *uuid)
+void PrlOutFormatterJSON::do_add_uuid(const char *key, const char *uuid)
 {
 	std::string uuid_stripped;
 	if (*uuid != '\0') {
@@ -191,17 +484,17 @@ void PrlOutFormatterJSON::add_uuid(const char *key, const char *uuid)
 	add(key, uuid_stripped);
 }
 
-void PrlOutFormatterJSON::lic_add(const char *key, const char *value)
+void PrlOutFormatterJSON::do_lic_add(const char *key, const char *value)
 {
 	add(key, value);
 }
 
-void PrlOutFormatterJSON::lic_add(const char *key, std::string value)
+void PrlOutFormatterJSON::do_lic_add(const char *key, std::string value)
 {
 	add(key, value);
 }
 
-void PrlOutFormatterJSON::lic_add(const char *key, int value)
+void PrlOutFormatterJSON::do_lic_add(const char *key, int value)
 {
 	if (value == PRL_LIC_UNLIM_VAL)
 		add(key, -1);
@@ -209,35 +502,49 @@ void PrlOutFormatterJSON::lic_add(const char *key, int value)
 		add(key, value);
 }
 
-void PrlOutFormatterJSON::tbl_row_open()
+void PrlOutFormatterJSON::do_tbl_row_open()
 {
-	if (!is_first_key)
+	if (!is_first_key && !compact)
 		out << ",\n";
 	is_first_key = true;
 
-	for (int i = 0; i < indent + 1; i++)
-		out << '\t';
-	out << "{\n";
+	put_indent();
+	out << "{";
+	put_nl();
 	indent++;
 }
 
-void PrlOutFormatterJSON::tbl_row_close()
+void PrlOutFormatterJSON::do_tbl_row_close()
 {
 	close();
+	if (compact) {
+		out << "\n";
+		is_first_key = true;
+	}
+	flush();
 }
 
-void PrlOutFormatterJSON::tbl_add_item(const char *key, const char *,
+void PrlOutFormatterJSON::do_tbl_add_item(const char *key, const char *,
 										const char *value)
 {
 	add(key, value);
 }
 
-void PrlOutFormatterJSON::tbl_add_uuid(const char *key, const char *,
+void PrlOutFormatterJSON::do_tbl_add_uuid(const char *key, const char *,
 										const char *value)
 {
 	add_uuid(key, value);
 }
 
+void PrlOutFormatterJSON::do_tbl_add_row(const std::string &row)
+{
+	if (!is_first_key && !compact)
+		out << ",\n";
+	out << row;
+	is_first_key = compact;
+	flush();
+}
+
 PrlOutFormatterPlain::PrlOutFormatterPlain(const char *tab)
 {
 	type = OUT_FORMATTER_PLAIN;
@@ -245,23 +552,25 @@ PrlOutFormatterPlain::PrlOutFormatterPlain(const char *tab)
 	this->tab = tab;
 };
 
-void PrlOutFormatterPlain::open_object()
+void PrlOutFormatterPlain::do_open_object()
 {
 
 }
 
-void PrlOutFormatterPlain::open_list()
+void PrlOutFormatterPlain::do_open_list()
 {
 
 }
 
-void PrlOutFormatterPlain::close_list()
+void PrlOutFormatterPlain::do_close_list()
 {
-
+	flush();
 }
 
-void PrlOutFormatterPlain::open(const char *key, bool is_inline)
+void PrlOutFormatterPlain::do_open(const char *key, bool is_inline)
 {
+	if (skip_open(key))
+		return;
 	if (is_inline) {
 		for (int i = 0; i < indent; i++)
 			out << tab;
@@ -275,29 +584,35 @@ void PrlOutFormatterPlain::open(const char *key, bool is_inline)
 	indent++;
 };
 
-void PrlOutFormatterPlain::open_dev(const char *key)
+void PrlOutFormatterPlain::do_open_dev(const char *key)
 {
+	if (skip_open(key))
+		return;
 	for (int i = 0; i < indent; i++)
 		out << tab;
 	out << key;
 	indent++;
 };
 
-void PrlOutFormatterPlain::open_shf(const char *key, bool is_enabled)
+void PrlOutFormatterPlain::do_open_shf(const char *key, bool is_enabled)
 {
+	if (skip_open(key))
+		return;
 	out << key << ": ";
 	out << (is_enabled ? "(+)" : "(-)") << "\n";
 	indent++;
 };
 
-void PrlOutFormatterPlain::close(bool is_inline)
+void PrlOutFormatterPlain::do_close(bool is_inline)
 {
+	if (skip_close())
+		return;
 	if (is_inline)
 		out << "\n";
 	indent--;
 };
 
-void PrlOutFormatterPlain::close_object()
+void PrlOutFormatterPlain::do_close_object()
 {
 
 };
@@ -322,9 +637,11 @@ void PrlOutFormatterPlain::close_key(bool is_inline)
 		out << '\n';
 };
 
-void PrlOutFormatterPlain::add(const char *key, const char *value,
+void PrlOutFormatterPlain::do_add(const char *key, const char *value,
 							bool is_inline, bool use_quotes, bool hide_key)
 {
+	if (skip_key(key))
+		return;
 	open_key(key, is_inline, hide_key);
 	if (use_quotes)
 		out << '\'' << value << '\'';
@@ -333,27 +650,31 @@ void PrlOutFormatterPlain::add(const char *key, const char *value,
 	close_key(is_inline);
 };
 
-void PrlOutFormatterPlain::add(const char *key, std::string value,
+void PrlOutFormatterPlain::do_add(const char *key, std::string value,
 		bool is_inline, bool use_quotes, bool hide_key)
 {
 	add(key, value.c_str(), is_inline, use_quotes, hide_key);
 }
 
-void PrlOutFormatterPlain::add(const char *key, int value, const char *suffix,
+void PrlOutFormatterPlain::do_add(const char *key, int value, const char *suffix,
 								bool is_inline, bool hide_key)
 {
+	if (skip_key(key))
+		return;
 	open_key(key, is_inline, hide_key);
 	out << value << suffix;
 	close_key(is_inline);
 };
 
-void PrlOutFormatterPlain::add(const char *key, bool value)
+void PrlOutFormatterPlain::do_add(const char *key, bool value)
 {
+	if (skip_key(key))
+		return;
 	if (value)
 		out << ' ' << key;
 };
 
-void PrlOutFormatterPlain::add_uptime(const char *key,
+void PrlOutFormatterPlain::do_add_uptime(const char *key,
 							unsigned long long uptime, std::string start_date)
 {
 	std::string tmp;
@@ -365,12 +686,12 @@ void PrlOutFormatterPlain::add_uptime(const char *key,
 	add(key, tmp);
 };
 
-void PrlOutFormatterPlain::add_isenabled(bool is_enabled)
+void PrlOutFormatterPlain::do_add_isenabled(bool is_enabled)
 {
 	add("enabled", is_enabled ? "(+)" : "(-)", true, false, true);
 };
 
-void PrlOutFormatterPlain::add_host_dev(const char *id, const char *name,
+void PrlOutFormatterPlain::do_add_host_dev(const char *id, const char *name,
 							  const char *type, const char *assignment,
 							  const char *used_by)
 {
@@ -394,22 +715,34 @@ PrlOutFormatter * get_formatter(bool use_json, const char *tab)
 		return new PrlOutFormatterPlain(tab);
 }
 
-void PrlOutFormatterPlain::add_uuid(const char *key, const char *uuid)
+PrlOutFormatter * get_formatter(OutFormatterType type, const char *tab)
+{
+	switch (type) {
+	case OUT_FORMATTER_JSON:
+		return new PrlOutFormatterJSON();
+	case OUT_FORMATTER_NDJSON:
+		return new PrlOutFormatterJSON(true);
+	default:
+		return new PrlOutFormatterPlain(tab);
+	}
+}
+
+void PrlOutFormatterPlain::do_add_uuid(const char *key, const char *uuid)
 {
 	add(key, uuid);
 };
 
-void PrlOutFormatterPlain::lic_add(const char *key, const char *value)
+void PrlOutFormatterPlain::do_lic_add(const char *key, const char *value)
 {
 	out << "\t" << key << "=\"" << value << "\"\n";
 }
 
-void PrlOutFormatterPlain::lic_add(const char *key, std::string value)
+void PrlOutFormatterPlain::do_lic_add(const char *key, std::string value)
 {
 	lic_add(key, value.c_str());
 }
 
-void PrlOutFormatterPlain::lic_add(const char *key, int value)
+void PrlOutFormatterPlain::do_lic_add(const char *key, int value)
 {
 	out << "\t" << key << "=";
 	if (value == PRL_LIC_UNLIM_VAL)
@@ -418,17 +751,18 @@ void PrlOutFormatterPlain::lic_add(const char *key, int value)
 		out << value << "\n";
 }
 
-void PrlOutFormatterPlain::tbl_row_open()
+void PrlOutFormatterPlain::do_tbl_row_open()
 {
 
 }
 
-void PrlOutFormatterPlain::tbl_row_close()
+void PrlOutFormatterPlain::do_tbl_row_close()
 {
 	out << "\n";
+	flush();
 }
 
-void PrlOutFormatterPlain::tbl_add_item(const char *, const char *fmt,
+void PrlOutFormatterPlain::do_tbl_add_item(const char *, const char *fmt,
 											const char *value)
 {
 	char buf[256];
@@ -439,8 +773,14 @@ void PrlOutFormatterPlain::tbl_add_item(const char *, const char *fmt,
 	out << buf;
 }
 
-void PrlOutFormatterPlain::tbl_add_uuid(const char *, const char *fmt,
+void PrlOutFormatterPlain::do_tbl_add_uuid(const char *, const char *fmt,
 											const char *value)
 {
 	tbl_add_item(NULL, fmt, value);
 }
+
+void PrlOutFormatterPlain::do_tbl_add_row(const std::string &row)
+{
+	out << row;
+	flush();
+}
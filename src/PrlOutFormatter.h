@@ -24,60 +24,118 @@
 #ifndef __PRL_OUT_FORMATTER_H__
 #define __PRL_OUT_FORMATTER_H__
 
+#include <stdio.h>
 #include <string>
 #include <sstream>
+#include <vector>
 
 enum OutFormatterType {
 	OUT_FORMATTER_PLAIN,
 	OUT_FORMATTER_JSON,
+	/* compact JSON, one object per line */
+	OUT_FORMATTER_NDJSON,
 };
 
 class PrlOutFormatter {
 protected:
 	std::stringstream out;
+	/* Streaming mode: completed table rows are written here */
+	FILE *stream;
+	/* Projection: the dotted key paths to output, all if empty */
+	std::vector<std::string> fields;
+	std::vector<std::string> path;
+	/* the number of opened sections which are not output */
+	int skip;
+
+	bool skip_open(const char *key);
+	bool skip_close();
+	bool skip_key(const char *key) const { return skip || !want(key); }
+
+	virtual void do_open_object() = 0;
+	virtual void do_close_object() = 0;
+	virtual void do_open_list() = 0;
+	virtual void do_close_list() = 0;
+
+	virtual void do_open(const char *key, bool is_inline) = 0;
+	virtual void do_open_dev(const char *key) = 0;
+	virtual void do_open_shf(const char *key, bool is_enabled) = 0;
+	virtual void do_close(bool is_inline) = 0;
+
+	virtual void do_add(const char *key, const char *value,
+			bool is_inline, bool use_quotes, bool hide_key) = 0;
+	virtual void do_add(const char *key, std::string value,
+			bool is_inline, bool use_quotes, bool hide_key) = 0;
+	virtual void do_add(const char *key, int value, const char *suffix,
+			bool is_inline, bool hide_key) = 0;
+	virtual void do_add(const char *key, bool value) = 0;
+	virtual void do_add_uptime(const char *key, unsigned long long uptime,
+			std::string start_date) = 0;
+	virtual void do_add_isenabled(bool is_enabled) = 0;
+	virtual void do_add_host_dev(const char *id, const char *name,
+			const char *type, const char *assignment,
+			const char *used_by) = 0;
+	virtual void do_add_uuid(const char *key, const char *uuid) = 0;
+	virtual void do_lic_add(const char *key, const char *value) = 0;
+	virtual void do_lic_add(const char *key, std::string value) = 0;
+	virtual void do_lic_add(const char *key, int value) = 0;
+
+	virtual void do_tbl_row_open() = 0;
+	virtual void do_tbl_row_close() = 0;
+	virtual void do_tbl_add_item(const char *key, const char *fmt,
+			const char *value) = 0;
+	virtual void do_tbl_add_uuid(const char *key, const char *fmt,
+			const char *value) = 0;
+	virtual void do_tbl_add_row(const std::string &row) = 0;
 
 public:
 	OutFormatterType type;
 
-	PrlOutFormatter() {};
+	PrlOutFormatter() : stream(NULL), skip(0) {};
 	virtual ~PrlOutFormatter() {};
 
-	virtual void open_object() = 0;
-	virtual void close_object() = 0;
-	virtual void open_list() = 0;
-	virtual void close_list() = 0;
-
-	virtual void open(const char *key, bool is_inline = false) = 0;
-	virtual void open_dev(const char *key) = 0;
-	virtual void open_shf(const char *key, bool is_enabled) = 0;
-	virtual void close(bool is_inline = false) = 0;
-
-	virtual void add(const char *key, const char *value,
-					 bool is_inline = false, bool use_quotes = false,
-					 bool hide_key = false) = 0;
-	virtual void add(const char *key, std::string value,
-					 bool is_inline = false, bool use_quotes = false,
-					 bool hide_key = false) = 0;
-	virtual void add(const char *key, int value, const char *suffix = "",
-					 bool is_inline = false, bool hide_key = false) = 0;
-	virtual void add(const char *key, bool value) = 0;
-	virtual void add_uptime(const char *key, unsigned long long uptime,
-							std::string start_date) = 0;
-	virtual void add_isenabled(bool is_enabled) = 0;
-	virtual void add_host_dev(const char *id, const char *name,
-							  const char *type, const char *assignment,
-							  const char *used_by) = 0;
-	virtual void add_uuid(const char *key, const char *uuid) = 0;
-	virtual void lic_add(const char *key, const char *value) = 0;
-	virtual void lic_add(const char *key, std::string value) = 0;
-	virtual void lic_add(const char *key, int value) = 0;
-
-	virtual void tbl_row_open() = 0;
-	virtual void tbl_row_close() = 0;
-	virtual void tbl_add_item(const char *key, const char *fmt,
-								const char *value) = 0;
-	virtual void tbl_add_uuid(const char *key, const char *fmt,
-								const char *value) = 0;
+	void set_stream(FILE *fp) { stream = fp; }
+	void flush();
+	void set_fields(const std::string &list);
+	bool want(const char *key) const;
+
+	/* The emitters, timed as the local formatting for --timing; the
+	 * output itself is made by the do_ methods of the formatter type */
+	void open_object();
+	void close_object();
+	void open_list();
+	void close_list();
+
+	void open(const char *key, bool is_inline = false);
+	void open_dev(const char *key);
+	void open_shf(const char *key, bool is_enabled);
+	void close(bool is_inline = false);
+
+	void add(const char *key, const char *value,
+			 bool is_inline = false, bool use_quotes = false,
+			 bool hide_key = false);
+	void add(const char *key, std::string value,
+			 bool is_inline = false, bool use_quotes = false,
+			 bool hide_key = false);
+	void add(const char *key, int value, const char *suffix = "",
+			 bool is_inline = false, bool hide_key = false);
+	void add(const char *key, bool value);
+	void add_uptime(const char *key, unsigned long long uptime,
+					std::string start_date);
+	void add_isenabled(bool is_enabled);
+	void add_host_dev(const char *id, const char *name,
+					  const char *type, const char *assignment,
+					  const char *used_by);
+	void add_uuid(const char *key, const char *uuid);
+	void lic_add(const char *key, const char *value);
+	void lic_add(const char *key, std::string value);
+	void lic_add(const char *key, int value);
+
+	void tbl_row_open();
+	void tbl_row_close();
+	void tbl_add_item(const char *key, const char *fmt, const char *value);
+	void tbl_add_uuid(const char *key, const char *fmt, const char *value);
+	/* a table row rendered by another formatter of the same type */
+	void tbl_add_row(const std::string &row);
 
 	std::string get_buffer();
 };
@@ -86,47 +144,54 @@ class PrlOutFormatterJSON : public PrlOutFormatter {
 private:
 	int indent;
 	bool is_first_key;
+	bool compact;
+
+	void put_sep();
+	void put_indent();
+	void put_nl();
 
 public:
-	PrlOutFormatterJSON();
-	virtual void open_object();
-	virtual void close_object();
-	virtual void open_list();
-	virtual void close_list();
-
-	virtual void open(const char *key, bool is_inline = false);
-	virtual void open_dev(const char *key);
-	virtual void open_shf(const char *key, bool is_enabled);
-	virtual void close(bool is_inline = false);
+	PrlOutFormatterJSON(bool compact = false);
+
+protected:
+	virtual void do_open_object();
+	virtual void do_close_object();
+	virtual void do_open_list();
+	virtual void do_close_list();
+
+	virtual void do_open(const char *key, bool is_inline);
+	virtual void do_open_dev(const char *key);
+	virtual void do_open_shf(const char *key, bool is_enabled);
+	virtual void do_close(bool is_inline);
+
+	virtual void do_add(const char *key, const char *value,
+			bool is_inline, bool use_quotes, bool hide_key);
+	virtual void do_add(const char *key, std::string value,
+			bool is_inline, bool use_quotes, bool hide_key);
+	virtual void do_add(const char *key, int value, const char *suffix,
+			bool is_inline, bool hide_key);
+	virtual void do_add(const char *key, bool value);
+	virtual void do_add_uptime(const char *key, unsigned long long uptime,
+			std::string start_date);
+	virtual void do_add_isenabled(bool is_enabled);
+	virtual void do_add_host_dev(const char *id, const char *name,
+			const char *type, const char *assignment,
+			const char *used_by);
+	virtual void do_add_uuid(const char *key, const char *uuid);
+	virtual void do_lic_add(const char *key, const char *value);
+	virtual void do_lic_add(const char *key, std::string value);
+	virtual void do_lic_add(const char *key, int value);
+
+	virtual void do_tbl_row_open();
+	virtual void do_tbl_row_close();
+	virtual void do_tbl_add_item(const char *key, const char *fmt,
+			const char *value);
+	virtual void do_tbl_add_uuid(const char *key, const char *fmt,
+			const char *value);
+	virtual void do_tbl_add_row(const std::string &row);
+
 private:
 	virtual void add_key(const char *key);
-public:
-	virtual void add(const char *key, const char *value,
-					 bool is_inline = false, bool use_quotes = false,
-					 bool hide_key = false);
-	virtual void add(const char *key, std::string value,
-					 bool is_inline = false, bool use_quotes = false,
-					 bool hide_key = false);
-	virtual void add(const char *key, int value, const char *suffix = "",
-					 bool is_inline = false, bool hide_key = false);
-	virtual void add(const char *key, bool value);
-	virtual void add_uptime(const char *key, unsigned long long uptime,
-							std::string start_date);
-	virtual void add_isenabled(bool is_enabled);
-	virtual void add_host_dev(const char *id, const char *name,
-							  const char *type, const char *assignment,
-							  const char *used_by);
-	virtual void add_uuid(const char *key, const char *uuid);
-	virtual void lic_add(const char *key, const char *value);
-	virtual void lic_add(const char *key, std::string value);
-	virtual void lic_add(const char *key, int value);
-
-	virtual void tbl_row_open();
-	virtual void tbl_row_close();
-	virtual void tbl_add_item(const char *key, const char *,
-								const char *value);
-	virtual void tbl_add_uuid(const char *key, const char *,
-								const char *value);
 };
 
 class PrlOutFormatterPlain : public PrlOutFormatter {
@@ -136,45 +201,48 @@ private:
 
 public:
 	PrlOutFormatterPlain(const char *tab = "  ");
-	virtual void open_object();
-	virtual void close_object();
-	virtual void open_list();
-	virtual void close_list();
-
-	virtual void open(const char *key, bool is_inline = false);
-	virtual void open_dev(const char *key);
-	virtual void open_shf(const char *key, bool is_enabled);
-	virtual void close(bool is_inline = false);
 	void open_key(const char * key, bool is_inline, bool hide_key);
 	void close_key(bool is_inline);
-	virtual void add(const char *key, const char *value,
-					 bool is_inline = false, bool use_quotes = false,
-					 bool hide_key = false);
-	virtual void add(const char *key, std::string value,
-					 bool is_inline = false, bool use_quotes = false,
-					 bool hide_key = false);
-	virtual void add(const char *key, int value, const char *suffix = "",
-					 bool is_inline = false, bool hide_key = false);
-	virtual void add(const char *key, bool value);
-	virtual void add_uptime(const char *key, unsigned long long uptime,
-							std::string start_date);
-	virtual void add_isenabled(bool is_enabled);
-	virtual void add_host_dev(const char *id, const char *name,
-							  const char *type, const char *assignment,
-							  const char *used_by);
-	virtual void add_uuid(const char *key, const char *uuid);
-	virtual void lic_add(const char *key, const char *value);
-	virtual void lic_add(const char *key, std::string value);
-	virtual void lic_add(const char *key, int value);
-
-	virtual void tbl_row_open();
-	virtual void tbl_row_close();
-	virtual void tbl_add_item(const char *key, const char *fmt,
-								const char *value);
-	virtual void tbl_add_uuid(const char *key, const char *fmt,
-								const char *value);
+
+protected:
+	virtual void do_open_object();
+	virtual void do_close_object();
+	virtual void do_open_list();
+	virtual void do_close_list();
+
+	virtual void do_open(const char *key, bool is_inline);
+	virtual void do_open_dev(const char *key);
+	virtual void do_open_shf(const char *key, bool is_enabled);
+	virtual void do_close(bool is_inline);
+
+	virtual void do_add(const char *key, const char *value,
+			bool is_inline, bool use_quotes, bool hide_key);
+	virtual void do_add(const char *key, std::string value,
+			bool is_inline, bool use_quotes, bool hide_key);
+	virtual void do_add(const char *key, int value, const char *suffix,
+			bool is_inline, bool hide_key);
+	virtual void do_add(const char *key, bool value);
+	virtual void do_add_uptime(const char *key, unsigned long long uptime,
+			std::string start_date);
+	virtual void do_add_isenabled(bool is_enabled);
+	virtual void do_add_host_dev(const char *id, const char *name,
+			const char *type, const char *assignment,
+			const char *used_by);
+	virtual void do_add_uuid(const char *key, const char *uuid);
+	virtual void do_lic_add(const char *key, const char *value);
+	virtual void do_lic_add(const char *key, std::string value);
+	virtual void do_lic_add(const char *key, int value);
+
+	virtual void do_tbl_row_open();
+	virtual void do_tbl_row_close();
+	virtual void do_tbl_add_item(const char *key, const char *fmt,
+			const char *value);
+	virtual void do_tbl_add_uuid(const char *key, const char *fmt,
+			const char *value);
+	virtual void do_tbl_add_row(const std::string &row);
 };
 
 PrlOutFormatter * get_formatter(bool use_json, const char *tab = "  ");
+PrlOutFormatter * get_formatter(OutFormatterType type, const char *tab = "  ");
 
 #endif //__PRL_OUT_FORMATTER_H__
@@ -28,7 +28,11 @@
  */
 
 #include <set>
+#include <map>
 #include <vector>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include <sstream>
 #include <algorithm>
 #include <time.h>
@@ -43,6 +47,7 @@
 #include <PrlApiDeprecated.h>
 #include <Interfaces/VirtuozzoDomModel.h>
 #include <pwd.h>
+#include <boost/algorithm/string.hpp>
 
 
 #include "CmdParam.h"
@@ -54,6 +59,7 @@
 #include "Logger.h"
 #include "PrlDisp.h"
 #include "PrlCleanup.h"
+#include "PrlJobMux.h"
 
 #ifdef _WIN_
 #include <windows.h>
@@ -61,6 +67,8 @@
 #define snprintf _snprintf
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 inline int _getch() { return getchar() ; }
 #endif
 
@@ -158,10 +166,66 @@ static bool is_local(const std::string &host)
 	return false;
 }
 
+static int load_session(const std::string &path, std::string &session)
+{
+	struct stat st;
+	char buf[128];
+	ssize_t n;
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+		prl_log(L_WARN, "The session cache %s is ignored: it is not"
+				" private to the user", path.c_str());
+		close(fd);
+		return -1;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	session = buf;
+	boost::trim(session);
+
+	return session.empty() ? -1 : 0;
+}
+
+static void save_session(const std::string &path, const std::string &session)
+{
+	std::string dir = path.substr(0, path.rfind('/'));
+	std::string data = session + "\n";
+	std::vector<char> tmp(path.begin(), path.end());
+	const char *suffix = ".XXXXXX";
+	int fd;
+
+	if ((mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0700) && errno != EEXIST) ||
+			(mkdir(dir.c_str(), 0700) && errno != EEXIST)) {
+		prl_log(L_DEBUG, "Unable to create %s: %m", dir.c_str());
+		return;
+	}
+
+	/* mkstemp() creates the file with 0600 */
+	tmp.insert(tmp.end(), suffix, suffix + strlen(suffix) + 1);
+	if ((fd = mkstemp(&tmp[0])) == -1) {
+		prl_log(L_DEBUG, "Unable to create %s: %m", &tmp[0]);
+		return;
+	}
+	if (write(fd, data.c_str(), data.size()) != (ssize_t) data.size() ||
+			close(fd) || rename(&tmp[0], path.c_str())) {
+		prl_log(L_DEBUG, "Unable to save the session to %s: %m", path.c_str());
+		unlink(&tmp[0]);
+	}
+}
+
 int PrlSrv::login(const LoginInfo &login)
 {
 	PRL_RESULT ret = PRL_ERR_SUCCESS;
 	PRL_HANDLE hJob = PRL_INVALID_HANDLE;
+	TraceSpan span("login");
 
 	if (m_logged)
 		logoff();
@@ -185,9 +249,36 @@ int PrlSrv::login(const LoginInfo &login)
 		bool paswd_in_args = false;
 		std::string passwd(login.get_passwd_from_stack(paswd_in_args));
 		unsigned int nFlags = PACF_NON_INTERACTIVE_MODE;
+		std::string session;
+
+		// Reattach to the session of the previous run first
+		if (login.session_cache &&
+				load_session(get_session_cache_file(login), session) == 0)
+		{
+			prl_log(L_INFO, "Reattaching %s@%s to session %s", login.user.c_str(),
+							login.server.c_str(), session.c_str());
+
+			hJob = PrlSrv_LoginEx(m_hSrv,
+								login.server.c_str(),
+								login.user.c_str(),
+								passwd.c_str(),
+								session.c_str(),
+								login.port,
+								JOB_WAIT_TIMEOUT,
+								PSL_HIGH_SECURITY,
+								nFlags);
+			if ((ret = get_job_retcode(hJob, err)) != 0) {
+				prl_log(L_INFO, "Unable to reattach to the session: %s", err.c_str());
+				unlink(get_session_cache_file(login).c_str());
+				PrlHandle_Free(hJob);
+				hJob = PRL_INVALID_HANDLE;
+			}
+		}
 
 		// If pass not in args, try public key authorization
-		std::string pub_key = load_rsa_public_key();
+		std::string pub_key;
+		if (hJob == PRL_INVALID_HANDLE)
+			pub_key = load_rsa_public_key();
 		if (!paswd_in_args && !pub_key.empty())
 		{
 			prl_log(L_INFO, "Logging in %s@%s using public key", login.user.c_str(),
@@ -207,7 +298,7 @@ int PrlSrv::login(const LoginInfo &login)
     	}
 
 		// If it didn't succeed, or password was passed explcitly, try password authentication
-		if (pub_key.empty() || paswd_in_args || ret)
+		if (hJob == PRL_INVALID_HANDLE || ret)
 		{
 			// Read pass if we haven't already done it
 		 	if (!paswd_in_args)
@@ -277,6 +368,10 @@ int PrlSrv::login(const LoginInfo &login)
 			m_sessionid = buf;
 			prl_log(L_DEBUG, "sessionid=%s", get_sessionid());
 			m_logged = true;
+			if (login.session_cache && !is_local(login.server)) {
+				save_session(get_session_cache_file(login), m_sessionid);
+				m_keep_session = true;
+			}
 
 		} while (0);
 	}
@@ -289,6 +384,15 @@ void PrlSrv::logoff()
 	if (!m_logged)
 		return;
 
+	if (m_keep_session) {
+		/* the next run reattaches to the session */
+		prl_log(L_INFO, "Detaching from the session");
+		m_logged = false;
+		m_keep_session = false;
+		clear();
+		return;
+	}
+
 	prl_log(L_INFO, "Logging off");
 	PRL_RESULT ret;
 	std::string err;
@@ -371,6 +475,8 @@ int PrlSrv::get_vm_list(PrlList<PrlVm *> &list, unsigned vmtype, unsigned list_f
 
 int PrlSrv::update_vm_list(unsigned vmtype, unsigned flags)
 {
+	TraceSpan span("update_vm_list");
+
 	m_VmList.del();
 	return get_vm_list(m_VmList, vmtype, flags);
 }
@@ -490,6 +596,62 @@ int PrlSrv::get_vm_config(const std::string &id, PrlVm **vm, bool ignore_not_fou
 	return ret;
 }
 
+/* Same as get_vm_config() with ignore_not_found for many ids at once, all
+ * the requests are in flight together. A VE that is not found is NULL.
+ * Without rets the first error fails all of them, with rets the error of
+ * every VE is given there.
+ */
+int PrlSrv::get_vm_configs(const std::vector<std::string> &ids,
+	std::vector<PrlVm *> &vms, int nFlags, std::vector<int> *rets)
+{
+	if (m_hSrv == PRL_INVALID_HANDLE)
+		return prl_err(-1, "Failed to get the handle; you are not"
+			" logged on to the server.");
+
+	std::vector<PrlHandle> jobs(ids.size());
+	std::vector<unsigned int> tags(ids.size());
+	PrlJobMux mux;
+	int ret = 0;
+
+	vms.assign(ids.size(), NULL);
+	if (rets)
+		rets->assign(ids.size(), 0);
+	for (size_t i = 0; i < ids.size(); i++) {
+		*jobs[i].get_ptr() = PrlSrv_GetVmConfig(m_hSrv, ids[i].c_str(), nFlags);
+		tags[i] = mux.submit(jobs[i].get_handle());
+	}
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		PrlHandle hResult;
+		std::string err;
+		PRL_RESULT rc;
+		int &res = rets ? (*rets)[i] : ret;
+
+		rc = mux.await(tags[i], err);
+		if (res || rc == PRL_ERR_VM_UUID_NOT_FOUND)
+			continue;
+		if (rc) {
+			res = prl_err(rc, "Failed to get VM config: %s",
+					err.c_str());
+			continue;
+		}
+		if ((rc = PrlJob_GetResult(jobs[i], hResult.get_ptr()))) {
+			res = prl_err(rc, "PrlJob_GetResult returned the following"
+				" error: %s [%d]", get_error_str(rc).c_str(), rc);
+			continue;
+		}
+		res = vm_from_result(hResult, 0, &vms[i]);
+	}
+
+	if (ret) {
+		for (size_t i = 0; i < vms.size(); i++)
+			delete vms[i];
+		vms.assign(ids.size(), NULL);
+	}
+
+	return ret;
+}
+
 int PrlSrv::get_vm_config(const CmdParamData &param, PrlVm **vm,
 	bool ignore_not_found /*= false*/)
 {
@@ -505,10 +667,12 @@ int PrlSrv::run_action(const CmdParamData &param)
 {
 	int ret;
 
-	if (!m_logged && !param.problem_report.stand_alone && !param.xmlrpc.action_provided) {
+	if (!m_logged && get_action_needs(param) == NEEDS_LOGIN) {
+		profile_phase("login");
 		if ((ret = login(param.login)))
 			return ret;
 	}
+	profile_phase("action");
 	if (param.action == SrvShutdownAction)
 		return shutdown(param.disp.force,
 				param.disp.suspend_vm_to_pram);
@@ -542,9 +706,26 @@ int PrlSrv::run_action(const CmdParamData &param)
 	else if (param.action == VmPerfStatsAction && param.list_all)
 		return print_statistics(param);
 	else if (param.action == VmMonitorAction)
-		return monitor();
+		return monitor(param.use_ndjson ? OUT_FORMATTER_NDJSON :
+				OUT_FORMATTER_JSON, param.list_cache);
+	else if (param.action == VmAgentAction)
+		return agent(param);
+	else if (param.action == VmBatchAction)
+		return batch(param);
+	else if (param.action == VmWaitAction)
+		return wait_vm(param);
+	else if (param.action == VmApplyAction)
+		return apply(param);
+	else if (param.action == VmBenchAction)
+		return bench(param);
 
 	/* Per VM actions */
+	if (param.start_waves && !param.id.empty())
+		return prl_err(-1, "The --waves option can only be used with"
+				" --all or --filter");
+	if (param.id.empty() && is_bulk_action(param.action))
+		return bulk_action(param);
+
 	PrlVm *vm = NULL;
 	ret = get_vm_config(param, &vm);
 	if (ret)
@@ -559,9 +740,23 @@ int PrlSrv::run_action(const CmdParamData &param)
 	if ((ret = vm->update_state()))
 		return ret;
 
+	return run_vm_action(vm, param);
+}
+
+int PrlSrv::run_vm_action(PrlVm *vm, const CmdParamData &param)
+{
+	int ret;
+
 	switch (param.action) {
 	case VmStartAction:
-		return vm->start(param.start_mode, param.start_opts);
+	case VmStopAction:
+	case VmResetAction:
+	case VmRestartAction:
+	case VmSuspendAction:
+	case VmResumeAction:
+	case VmPauseAction:
+	case VmUnregisterAction:
+		return vm->job_action(param);
 	case VmMountAction:
 		return vm->mount(param.mnt_opts);
 	case VmUmountAction:
@@ -572,22 +767,8 @@ int PrlSrv::run_action(const CmdParamData &param)
 		return vm->reset_uptime();
 	case VmAuthAction:
 		return vm->auth(param.user_name, param.user_password);
-	case VmStopAction:
-		return vm->stop(param);
-	case VmResetAction:
-		return vm->reset();
-	case VmRestartAction:
-		return vm->restart();
-	case VmSuspendAction:
-		return vm->suspend();
-	case VmResumeAction:
-		return vm->resume();
-	case VmPauseAction:
-		return vm->pause();
 	case VmDestroyAction:
 		return vm->destroy(param);
-	case VmUnregisterAction:
-		return vm->unreg();
 	case VmCloneAction:
 		return vm->clone(param.new_name, param.uuid, param.vm_location,
 				param.clone_flags);
@@ -640,7 +821,7 @@ int PrlSrv::run_disp_action(const CmdParamData &param)
 {
 	int ret;
 
-	if (!m_logged && !param.problem_report.stand_alone && !param.xmlrpc.action_provided) {
+	if (!m_logged && get_action_needs(param) == NEEDS_LOGIN) {
 		if ((ret = login(param.login)))
 			return ret;
 	}
@@ -1041,6 +1222,7 @@ PRL_HANDLE PrlSrv::get_srv_config_handle()
 	PRL_RESULT ret;
 	PRL_UINT32 resultCount = 0;
 	PrlHandle hResult;
+	std::lock_guard<std::recursive_mutex> g(m_hw_mutex);
 
 	if (!m_hSrvConf.valid()) {
 		PrlHandle hJob(PrlSrv_GetSrvConfig(m_hSrv));
@@ -1223,6 +1405,7 @@ int PrlSrv::get_user_info(PrlList<PrlUser *> &users)
 
 PrlDevSrv *PrlSrv::find_dev(DevType type, const std::string &name)
 {
+	std::lock_guard<std::recursive_mutex> g(m_hw_mutex);
 	if (m_DevList.empty())
 		get_hw_dev_info(type);
 
@@ -1241,6 +1424,7 @@ PrlDevSrv *PrlSrv::find_dev(DevType type, const std::string &name)
 
 PrlDevSrv *PrlSrv::find_net_dev_by_mac(const std::string &mac)
 {
+	std::lock_guard<std::recursive_mutex> g(m_hw_mutex);
 	if (m_DevList.empty())
 		get_hw_dev_info(DEV_NET);
 
@@ -1258,6 +1442,7 @@ PrlDevSrv *PrlSrv::find_net_dev_by_mac(const std::string &mac)
 
 PrlDevSrv *PrlSrv::find_net_dev_by_idx(unsigned int idx, bool is_virtual)
 {
+	std::lock_guard<std::recursive_mutex> g(m_hw_mutex);
 	if (m_DevList.empty())
 		get_hw_dev_info(DEV_NET);
 
@@ -1332,6 +1517,7 @@ int PrlSrv::get_new_dir(const char *dir, const char *pattern,
 
 unsigned int PrlSrv::get_cpu_count()
 {
+	std::lock_guard<std::recursive_mutex> g(m_hw_mutex);
 	if (!m_cpus)
 		get_hw_info(RES_HW_CPUS);
 	return m_cpus;
@@ -1770,6 +1956,25 @@ void PrlSrv::clear()
 	m_hSrv = 0;;
 }
 
+/* Drop everything fetched from the server on the first use but the
+ * session, e.g. between the requests of the agent */
+void PrlSrv::reset_caches()
+{
+	std::lock_guard<std::recursive_mutex> g(m_hw_mutex);
+
+	m_VmList.del();
+	m_DevList.del();
+	m_VNetList.del();
+	m_PrivNetList.del();
+	if (m_hSrvConf.valid())
+		PrlHandle_Free(m_hSrvConf.release_handle());
+	m_cpus = 0;
+	if (m_disp) {
+		delete m_disp;
+		m_disp = new PrlDisp(*this);
+	}
+}
+
 PrlSrv::~PrlSrv()
 {
 	logoff();
@@ -2817,12 +3022,12 @@ int PrlSrv::vnetwork_list(const VNetParam &vnet, bool use_json)
 		fprintf(stdout, "%-17s %-9s %-14s %-14s %-15s\n",
 			"Network ID", "Type", "Bound To", "Bridge", "Slave interfaces");
 	PrlVNetList::const_iterator it = m_VNetList.begin();
+	f->set_stream(stdout);
 	f->open_list();
 	for (; it != m_VNetList.end(); ++it)
 		print_vnetwork_info(*it, *f, vnet);
 	f->close_list();
 
-	fprintf(stdout, "%s", f->get_buffer().c_str());
 	return 0;
 }
 
@@ -3279,6 +3484,7 @@ int PrlSrv::ct_templates(const CtTemplateParam &tmpl, bool use_json)
 
 		if (f->type == OUT_FORMATTER_PLAIN)
 			fprintf(stdout, "%-*s Type Arch   Cached Description\n", (int)(width+1), "Name");
+		f->set_stream(stdout);
 		f->open_list();
 		for (it = list.begin(); it != list.end(); ++it) {
 			f->tbl_row_open();
@@ -3286,7 +3492,6 @@ int PrlSrv::ct_templates(const CtTemplateParam &tmpl, bool use_json)
 			f->tbl_row_close();
 		}
 		f->close_list();
-		fprintf(stdout, "%s", f->get_buffer().c_str());
 	} else if (tmpl.cmd == CtTemplateParam::Remove) {
 		std::string err;
 		PrlHandle hJob(PrlSrv_RemoveCtTemplate(m_hSrv, tmpl.name.c_str(),
@@ -3398,6 +3603,51 @@ static  const char *evt2str(int e)
 	}
 }
 
+/* Keep the list cache in sync with the VM events */
+static void invalidate_list_cache(PrlSrv *srv, PRL_EVENT_TYPE type,
+		const char *uuid)
+{
+	PrlListCache *cache = srv->get_list_cache();
+
+	if (cache == NULL)
+		return;
+
+	switch (type) {
+	case PET_DSP_EVT_VM_STATE_CHANGED:
+	case PET_DSP_EVT_VM_CONFIG_CHANGED:
+	case PET_DSP_EVT_VM_CREATED:
+	case PET_DSP_EVT_VM_ADDED:
+		cache->invalidate(uuid, false);
+		break;
+	case PET_DSP_EVT_VM_DELETED:
+	case PET_DSP_EVT_VM_UNREGISTERED:
+		cache->invalidate(uuid, true);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Only keeps the list cache in sync, used by the agent */
+int server_event_handler_cache(PRL_HANDLE hEvent, void *data)
+{
+	PrlHandle h(hEvent);
+	PRL_HANDLE_TYPE type;
+	PRL_EVENT_TYPE evt_type;
+	PRL_CHAR buf[256];
+	PRL_UINT32 buflen = sizeof(buf);
+
+	if (PrlHandle_GetType(h.get_handle(), &type) || type != PHT_EVENT)
+		return 0;
+	if (PrlEvent_GetType(h.get_handle(), &evt_type) ||
+			PrlEvent_GetIssuerId(h.get_handle(), buf, &buflen))
+		return 0;
+
+	invalidate_list_cache(reinterpret_cast<PrlSrv *>(data), evt_type, buf);
+
+	return 0;
+}
+
 int server_event_handler_monitor(PRL_HANDLE hEvent, void *data)
 {
 	PrlHandle h(hEvent);
@@ -3425,7 +3675,8 @@ int server_event_handler_monitor(PRL_HANDLE hEvent, void *data)
 	}
 
 	PrlEvent_GetIssuerId(hEvent, buf, &buflen);
-	std::unique_ptr<PrlOutFormatter> f(get_formatter(true));
+	invalidate_list_cache(srv, evt_type, buf);
+	std::unique_ptr<PrlOutFormatter> f(get_formatter(srv->get_monitor_fmt()));
 
 	if (evt_type == PET_DSP_EVT_VM_STATE_CHANGED) {
 		f->open_object();
@@ -3477,20 +3728,189 @@ int server_event_handler_monitor(PRL_HANDLE hEvent, void *data)
 	return 0;
 }
 
-int PrlSrv::monitor(void)
+int PrlSrv::monitor(OutFormatterType type, bool list_cache)
 {
+	PrlListCache cache(get_uuid());
 	char c;
+	int ret;
 
+	if (list_cache) {
+		if ((ret = cache.lock_monitor()))
+			return ret;
+		m_list_cache = &cache;
+	}
+	m_monitor_fmt = type;
 	reg_event_callback(server_event_handler_monitor, this);
 
 	/* wait until stdin is closed */
 	while (fread(&c, 1, 1, stdin));
 
 	unreg_event_callback(server_event_handler_monitor, this);
+	m_list_cache = NULL;
+
+	return 0;
+}
+
+/* The state is not known yet */
+#define WAIT_STATE_NONE		-1
+#define WAIT_STATE_DELETED	-2
+
+struct VmWait
+{
+	VmWait() : stop(false) {}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	/* the state of the waited VMs by the UUID */
+	std::map<std::string, int> state;
+	bool stop;
+};
+
+static int wait_event_handler(PRL_HANDLE hEvent, void *data)
+{
+	PrlHandle h(hEvent);
+	VmWait *w = reinterpret_cast<VmWait *>(data);
+	PRL_HANDLE_TYPE type;
+	PRL_EVENT_TYPE evt_type;
+	PRL_CHAR buf[256];
+	PRL_UINT32 buflen = sizeof(buf);
+	int s;
+
+	if (PrlHandle_GetType(h.get_handle(), &type) || type != PHT_EVENT)
+		return 0;
+	if (PrlEvent_GetType(h.get_handle(), &evt_type))
+		return 0;
+
+	if (evt_type == PET_DSP_EVT_VM_STATE_CHANGED) {
+		PrlHandle hParam;
+
+		if (PrlEvent_GetParamByName(h.get_handle(),
+					EVT_PARAM_VMINFO_VM_STATE, hParam.get_ptr()) ||
+				PrlEvtPrm_ToInt32(hParam, &s))
+			return 0;
+	} else if (evt_type == PET_DSP_EVT_VM_DELETED ||
+			evt_type == PET_DSP_EVT_VM_UNREGISTERED) {
+		s = WAIT_STATE_DELETED;
+	} else
+		return 0;
+	if (PrlEvent_GetIssuerId(h.get_handle(), buf, &buflen))
+		return 0;
+
+	std::lock_guard<std::mutex> lock(w->mutex);
+	std::map<std::string, int>::iterator it = w->state.find(buf);
+	if (it != w->state.end()) {
+		it->second = s;
+		w->cond.notify_one();
+	}
 
 	return 0;
 }
 
+static void stop_vm_wait(void *data)
+{
+	VmWait *w = reinterpret_cast<VmWait *>(data);
+
+	std::lock_guard<std::mutex> lock(w->mutex);
+	w->stop = true;
+	w->cond.notify_one();
+}
+
+/* Wait until all the given VMs are in the state. The current states are
+ * read once, then only the state events are used. The --timeout
+ * option limits the wait.
+ */
+int PrlSrv::wait_vm(const CmdParamData &param)
+{
+	std::vector<std::shared_ptr<PrlVm> > vms;
+	std::map<std::string, std::string> names;
+	VmWait w;
+	int ret = 0;
+
+	std::vector<std::string> ids(param.wait_ids.begin(),
+			param.wait_ids.end());
+	std::vector<PrlVm *> found;
+
+	for (size_t i = 0; i < ids.size(); i++)
+		normalize_uuid(ids[i], ids[i]);
+	if ((ret = get_vm_configs(ids, found)))
+		return ret;
+	for (size_t i = 0; i < found.size(); i++)
+		vms.push_back(std::shared_ptr<PrlVm>(found[i]));
+
+	str_list_t::const_iterator it = param.wait_ids.begin();
+	for (size_t i = 0; i < vms.size(); i++, ++it) {
+		PrlVm *vm = vms[i].get();
+
+		if (vm == NULL) {
+			if ((ret = get_vm_config(*it, &vm, false,
+						PGVC_SEARCH_BY_NAME)))
+				return ret;
+			if (vm == NULL)
+				return prl_err(-1, "The %s virtual machine does not exist.",
+						it->c_str());
+			vms[i].reset(vm);
+		}
+		w.state[vm->get_uuid()] = WAIT_STATE_NONE;
+		names[vm->get_uuid()] = vm->get_name();
+	}
+
+	/* no state change is missed between the reading and the events */
+	if ((ret = reg_event_callback(wait_event_handler, &w)))
+		return ret;
+	const PrlHook *h = get_cleanup_ctx().register_hook(stop_vm_wait, &w);
+
+	for (size_t i = 0; i < vms.size() && ret == 0; i++) {
+		if ((ret = vms[i]->update_state()))
+			break;
+
+		std::lock_guard<std::mutex> lock(w.mutex);
+		int &s = w.state[vms[i]->get_uuid()];
+		if (s == WAIT_STATE_NONE)
+			s = vms[i]->get_state();
+	}
+
+	std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(g_nJobTimeout);
+
+	std::unique_lock<std::mutex> lock(w.mutex);
+	while (ret == 0) {
+		std::map<std::string, int>::const_iterator it;
+
+		for (it = w.state.begin(); it != w.state.end(); ++it)
+			if (it->second != param.wait_state)
+				break;
+		if (it == w.state.end())
+			break;
+		if (it->second == WAIT_STATE_DELETED) {
+			ret = prl_err(-1, "The %s virtual machine has been"
+					" removed.", names[it->first].c_str());
+			break;
+		}
+		if (w.stop) {
+			ret = prl_err(-1, "The wait is canceled");
+			break;
+		}
+		if (g_nJobTimeout == JOB_INFINIT_WAIT_TIMEOUT) {
+			w.cond.wait(lock);
+		} else if (w.cond.wait_until(lock, deadline) ==
+				std::cv_status::timeout) {
+			for (it = w.state.begin(); it != w.state.end(); ++it)
+				if (it->second != param.wait_state)
+					prl_log(L_ERR, "%s is %s", names[it->first].c_str(),
+						vmstate2str((VIRTUAL_MACHINE_STATE)it->second));
+			ret = prl_err(PRL_ERR_TIMEOUT, "Timed out waiting for the %s"
+					" state", vmstate2str(param.wait_state));
+		}
+	}
+	lock.unlock();
+
+	get_cleanup_ctx().unregister_hook(h);
+	unreg_event_callback(wait_event_handler, &w);
+
+	return ret;
+}
+
 int PrlSrv::set_user(const CmdParamData &param) {
 	if (param.user.def_vm_home.empty())
 		return 0;
@@ -3550,6 +3970,19 @@ int PrlSrv::restart_shaping()
 	return 0;
 }
 
+/* ~/.vz/sessions/user@server:port */
+std::string PrlSrv::get_session_cache_file(const LoginInfo &login)
+{
+  const char *homedir;
+  if ((homedir = std::getenv("HOME")) == nullptr) {
+    homedir = getpwuid(getuid())->pw_dir;
+  }
+  std::string key = login.user + "@" + login.server + ":" +
+    std::to_string(login.port);
+  std::replace(key.begin(), key.end(), '/', '_');
+  return std::string(homedir) + "/.vz/sessions/" + key;
+}
+
 std::string PrlSrv::get_user_keys_directory()
 {
   const char *homedir;
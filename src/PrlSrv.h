@@ -30,6 +30,8 @@
 #ifndef __PRLSRV_H__
 #define __PRLSRV_H__
 #include <string>
+#include <vector>
+#include <mutex>
 #include "PrlVm.h"
 #include "PrlDisp.h"
 #include "PrlTypes.h"
@@ -126,6 +128,8 @@ public:
 };
 
 typedef PrlList<PrlVm *> PrlVmList ;
+class PrlListCache;
+struct AgentCtx;
 typedef PrlList<PrlDevSrv *> PrlDevSrvList;
 typedef std::list<std::pair<PRL_GUEST_OS_SUPPORT_TYPE, PRL_UINT16> > DistList;
 
@@ -147,13 +151,22 @@ private:
 	std::string m_product_version;
 	std::string m_hostname;
 	PrlDisp *m_disp;
+	OutFormatterType m_monitor_fmt;
+	PrlListCache *m_list_cache;
+	bool m_keep_session;
+	/* the host data above is filled on the first use, possibly by
+	 * the workers of bulk set and apply */
+	std::recursive_mutex m_hw_mutex;
 
 public:
 	PrlSrv() : m_hSrv(PRL_INVALID_HANDLE),
 			   m_logged(false),
 			   m_logoffTimeout(DEFAULT_LOGOFF_TIMEOUT),
 			   m_cpus(0),
-			   m_run_via_launchd(-1)
+			   m_run_via_launchd(-1),
+			   m_monitor_fmt(OUT_FORMATTER_JSON),
+			   m_list_cache(NULL),
+			   m_keep_session(false)
 	{
 		m_disp = new PrlDisp(*this);
 	}
@@ -161,6 +174,7 @@ public:
 	int login(const LoginInfo &login);
 	void logoff();
 	int run_action(const CmdParamData &param);
+	int run_vm_action(PrlVm *vm, const CmdParamData &param);
 	int run_disp_action(const CmdParamData &param);
 	int get_new_dir(const char *dir, const char *pattern,
 		std::string &new_dir_name) const;
@@ -168,6 +182,10 @@ public:
 		int nFlags = PGVC_SEARCH_BY_UUID | PGVC_SEARCH_BY_NAME );
 	int get_vm_config(const CmdParamData &param, PrlVm **vm,
 		bool ignore_not_found = false);
+	int get_vm_configs(const std::vector<std::string> &ids,
+		std::vector<PrlVm *> &vms,
+		int nFlags = PGVC_SEARCH_BY_UUID | PGVC_SEARCH_BY_NAME,
+		std::vector<int> *rets = NULL);
 	PrlDevSrv *find_dev(DevType type, const std::string &name);
 	PrlDevSrv *find_net_dev_by_mac(const std::string &mac);
 	PrlDevSrv *find_net_dev_by_idx(unsigned int idx, bool is_virtual);
@@ -214,7 +232,15 @@ public:
 	int appliance_install(const CmdParamData &param);
 	int ct_templates(const CtTemplateParam &param, bool use_json);
 	int copy_ct_template(const CtTemplateParam &tmpl, const CopyCtTemplateParam &copy_tmpl);
-	int monitor();
+	int monitor(OutFormatterType type = OUT_FORMATTER_JSON,
+			bool list_cache = false);
+	int agent(const CmdParamData &param);
+	int batch(const CmdParamData &param);
+	int wait_vm(const CmdParamData &param);
+	int apply(const CmdParamData &param);
+	int bench(const CmdParamData &param);
+	OutFormatterType get_monitor_fmt() const { return m_monitor_fmt; }
+	PrlListCache *get_list_cache() const { return m_list_cache; }
 	void set_logoff_timeout(unsigned int timeout) { m_logoffTimeout = timeout; }
 	~PrlSrv();
 	int get_backup_disks(const std::string& id, std::list<std::string>& disks);
@@ -223,6 +249,9 @@ public:
 private:
 	int get_srv_info();
 	int list_vm(const CmdParamData &param);
+	int update_list_cache(PrlListCache &cache, unsigned int jobs);
+	int agent_request(int sock, AgentCtx &ctx);
+	int agent_run(int sock, int argc, char **argv, AgentCtx &ctx);
 	int list_user(const CmdParamData &param, bool use_json);
 	int set_user(const CmdParamData &param);
 	int create_vm(const CmdParamData &param);
@@ -259,7 +288,10 @@ private:
 	void append_slave_ifaces(PrlOutFormatter &f, const std::string& netId, bool detailed);
 	int print_info(bool is_license_info, bool use_json);
 	void clear();
+	void reset_caches();
 	int status_vm(const CmdParamData &param);
+	int select_vms(const CmdParamData &param, std::vector<PrlVm *> &vms);
+	int bulk_action(const CmdParamData &param);
 	int print_statistics(const CmdParamData &param, PrlVm *vm = NULL) ;
 	int get_server_launch_mode(PrlHandle& hResponse);
 
@@ -272,7 +304,9 @@ private:
 	void print_dist_list(const DistList& info, PRL_GUEST_OS_SUPPORT_TYPE type);
 	std::string load_rsa_public_key();
 	std::string get_user_keys_directory();
+	std::string get_session_cache_file(const LoginInfo &login);
 };
 
 int server_event_handler_monitor(PRL_HANDLE hEvent, void *data);
+int server_event_handler_cache(PRL_HANDLE hEvent, void *data);
 #endif // __PRLSRV_H__
@@ -56,6 +56,8 @@ int main(int argc, char **argv)
 	delete srv;
 
 	deinit_sdk_lib();
+	trace_write();
+	timing_report();
 
 	return prlerr2exitcode(ret);
 }
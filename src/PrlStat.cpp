@@ -42,6 +42,7 @@ inline int _getch() { return getchar() ; }
 
 #include <string.h>
 #include <time.h>
+#include <memory>
 
 #include "EventSyncObject.h"
 
@@ -59,8 +60,18 @@ static PRL_RESULT print_perfstats(PRL_HANDLE handle, const CmdParamData &param)
 	if (!param_count)
 		return PRL_ERR_SUCCESS;
 
+	/* --ndjson: the whole sample goes into one line */
+	std::unique_ptr<PrlOutFormatter> f;
+	if (param.use_ndjson) {
+		f.reset(get_formatter(OUT_FORMATTER_NDJSON));
+		f->open_object();
+		/* the samples of a multi-host run tell where they come from */
+		if (param.host_child)
+			f->add("host", param.login.server);
+	}
+
 	// Print VM uuid if necessary
-	if (param.list_all) {
+	if (param.list_all || f) {
 		char uuid[NORMALIZED_UUID_LEN + 1] = {0};
 		PRL_UINT32 size = sizeof(uuid);
 		PRL_HANDLE hVm;
@@ -68,7 +79,10 @@ static PRL_RESULT print_perfstats(PRL_HANDLE handle, const CmdParamData &param)
 			PrlVmCfg_GetUuid(hVm, uuid, &size);
 			PrlHandle_Free(hVm);
 		}
-		printf("%s\n", uuid);
+		if (!f)
+			printf("%s\n", uuid);
+		else if (uuid[0] != '\0')
+			f->add_uuid("ID", uuid);
 	}
 	for (unsigned int ndx = 0; ndx < param_count; ++ndx) {
 		PrlHandle hPrm;
@@ -96,10 +110,20 @@ static PRL_RESULT print_perfstats(PRL_HANDLE handle, const CmdParamData &param)
 
 				if (PrlEvtPrm_GetBuffer(hPrm.get_handle(), &net_stat_buf, &len) == 0) {
 
-					for (unsigned int i = 0; i < PRL_TC_CLASS_MAX; i++)
+					for (unsigned int i = 0; i < PRL_TC_CLASS_MAX; i++) {
+						if (f) {
+							f->open((std::string(name_buff) + "." + ui2string(i)).c_str());
+							f->add("incoming", std::to_string(net_stat_buf.incoming[i]));
+							f->add("incoming_pkt", (int)net_stat_buf.incoming_pkt[i]);
+							f->add("outgoing", std::to_string(net_stat_buf.outgoing[i]));
+							f->add("outgoing_pkt", (int)net_stat_buf.outgoing_pkt[i]);
+							f->close();
+							continue;
+						}
 						fprintf(stdout, "\t%20s %2d %20llu %10u %20llu %10u\n", name_buff, i,
 								net_stat_buf.incoming[i], net_stat_buf.incoming_pkt[i],
 								net_stat_buf.outgoing[i], net_stat_buf.outgoing_pkt[i]);
+					}
 				}
 			}
 		} else {
@@ -108,11 +132,20 @@ static PRL_RESULT print_perfstats(PRL_HANDLE handle, const CmdParamData &param)
 				return prl_err(ret, "PrlEvtPrm_ToString returned the following error: %s",
 						get_error_str(ret).c_str());
 
-			fprintf(stdout, "\t%s:\t%s\n", name_buff, val_buff);
+			if (f)
+				f->add(name_buff, val_buff);
+			else
+				fprintf(stdout, "\t%s:\t%s\n", name_buff, val_buff);
 		}
 
 	}
 
+	if (f) {
+		f->close_object();
+		fputs(f->get_buffer().c_str(), stdout);
+		fflush(stdout);
+	}
+
 	return PRL_ERR_SUCCESS;
 }
 
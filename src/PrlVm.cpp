@@ -42,6 +42,7 @@
 #include <iostream>
 #include <utility>
 #include <map>
+#include <chrono>
 
 #include <PrlApiDeprecated.h>
 #include <PrlApiDisp.h>
@@ -241,27 +242,6 @@ static int start_event_handler(PRL_HANDLE hEvent, void *)
 	return 0;
 }
 
-int PrlVm::start(int mode, int flags)
-{
-	PRL_RESULT ret;
-
-	prl_log(0, "Starting the %s...", get_vm_type_str());
-
-	std::string err;
-
-	m_srv.reg_event_callback(start_event_handler);
-	PrlHandle hJob(PrlVm_StartEx(m_hVm, mode, flags));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to start the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully started.",
-				 get_vm_type_str());
-	m_srv.unreg_event_callback(start_event_handler);
-
-	return ret;
-}
-
 int PrlVm::mount_info()
 {
 	PRL_RESULT ret;
@@ -380,17 +360,11 @@ int PrlVm::auth(const std::string &user_name, const std::string &user_password)
 	return ret;
 }
 
-#define VM_SHUTDOWN_TIMEOUT 120 * 1000
-int PrlVm::stop(const CmdParamData &param)
+static void get_stop_mode(const CmdParamData &param, PRL_UINT32 &nStopMode,
+		PRL_UINT32 &nFlags)
 {
-	PRL_RESULT ret;
-
-	prl_log(0, "Stopping the %s...", get_vm_type_str());
-
-	std::string err;
-
-	PRL_UINT32 nStopMode = PSM_SHUTDOWN;
-	PRL_UINT32 nFlags = 0;
+	nStopMode = PSM_SHUTDOWN;
+	nFlags = 0;
 	if (param.fast)
 		nStopMode = PSM_KILL;
 	else if (param.use_acpi)
@@ -400,113 +374,156 @@ int PrlVm::stop(const CmdParamData &param)
 		nFlags = PSF_NOFORCE;
 	else if (param.force)
 		nFlags = PSF_FORCE;
-
-	PrlHandle hJob(PrlVm_StopEx(m_hVm, nStopMode, nFlags));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		return prl_err(ret, "Failed to stop the %s: %s",
-				get_vm_type_str(), err.c_str());
-	if (param.fast) {
-		prl_log(0, "The %s has been forcibly stopped",
-				get_vm_type_str());
-	} else {
-		prl_log(0, "The %s has been successfully stopped.",
-				get_vm_type_str());
-	}
-
-	return ret;
 }
 
-int PrlVm::reset()
-{
-	PRL_RESULT ret;
-
-	prl_log(0, "Resetting the %s...", get_vm_type_str());
-
-	std::string err;
-
-	PrlHandle hJob(PrlVm_Reset(m_hVm));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to reset the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully reset.",
-				get_vm_type_str());
+#define VM_SHUTDOWN_TIMEOUT 120 * 1000
 
-	return ret;
+bool PrlVm::is_job_action(const CmdParamData &param)
+{
+	switch (param.action) {
+	case VmStartAction:
+	case VmStopAction:
+	case VmResetAction:
+	case VmRestartAction:
+	case VmSuspendAction:
+	case VmResumeAction:
+	case VmPauseAction:
+	case VmUnregisterAction:
+		return true;
+	case VmDestroyAction:
+		/* --force stops the VE first */
+		return !param.force;
+	default:
+		return false;
+	}
 }
 
-int PrlVm::restart()
+int PrlVm::action_job(const CmdParamData &param, PRL_HANDLE *phJob)
 {
-	PRL_RESULT ret;
-
-	prl_log(0, "Restarting the %s...", get_vm_type_str());
-
-	std::string err;
+	PRL_UINT32 nStopMode, nFlags;
 
-	PrlHandle hJob(PrlVm_Restart(m_hVm));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to restart the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully restarted.",
-				get_vm_type_str());
+	switch (param.action) {
+	case VmStartAction:
+		prl_log(0, "Starting the %s...", get_vm_type_str());
+		*phJob = PrlVm_StartEx(m_hVm, param.start_mode, param.start_opts);
+		break;
+	case VmStopAction:
+		prl_log(0, "Stopping the %s...", get_vm_type_str());
+		get_stop_mode(param, nStopMode, nFlags);
+		*phJob = PrlVm_StopEx(m_hVm, nStopMode, nFlags);
+		break;
+	case VmResetAction:
+		prl_log(0, "Resetting the %s...", get_vm_type_str());
+		*phJob = PrlVm_Reset(m_hVm);
+		break;
+	case VmRestartAction:
+		prl_log(0, "Restarting the %s...", get_vm_type_str());
+		*phJob = PrlVm_Restart(m_hVm);
+		break;
+	case VmSuspendAction:
+		prl_log(0, "Suspending the %s...", get_vm_type_str());
+		*phJob = PrlVm_Suspend(m_hVm);
+		break;
+	case VmResumeAction:
+		prl_log(0, "Resuming the %s...", get_vm_type_str());
+		*phJob = PrlVm_Resume(m_hVm);
+		break;
+	case VmPauseAction:
+		prl_log(0, "Pause the %s...", get_vm_type_str());
+		*phJob = PrlVm_Pause(m_hVm, PRL_FALSE);
+		break;
+	case VmUnregisterAction:
+		prl_log(L_INFO, "Unregister the %s.", get_vm_type_str());
+		*phJob = PrlVm_Unreg(m_hVm);
+		break;
+	case VmDestroyAction:
+		if (param.force)
+			return prl_err(-1, "The %s is not removed by one job",
+					get_vm_type_str());
+		prl_log(0, "Removing the %s...", get_vm_type_str());
+		*phJob = PrlVm_Delete(m_hVm, PRL_INVALID_HANDLE);
+		break;
+	default:
+		return prl_err(-1, "The action is not done by one job");
+	}
 
-	return ret;
+	return 0;
 }
 
-int PrlVm::suspend()
+int PrlVm::action_done(const CmdParamData &param, PRL_RESULT ret,
+		const std::string &err)
 {
-	PRL_RESULT ret;
+	const char *verb, *done;
 
-	prl_log(0, "Suspending the %s...", get_vm_type_str());
-
-	std::string err;
+	switch (param.action) {
+	case VmStartAction:
+		verb = "start";
+		done = "successfully started";
+		break;
+	case VmStopAction:
+		verb = "stop";
+		done = param.fast ? "forcibly stopped" : "successfully stopped";
+		break;
+	case VmResetAction:
+		verb = "reset";
+		done = "successfully reset";
+		break;
+	case VmRestartAction:
+		verb = "restart";
+		done = "successfully restarted";
+		break;
+	case VmSuspendAction:
+		verb = "suspend";
+		done = "successfully suspended";
+		break;
+	case VmResumeAction:
+		verb = "resume";
+		done = "successfully resumed";
+		break;
+	case VmPauseAction:
+		verb = "pause";
+		done = "successfully paused";
+		break;
+	case VmUnregisterAction:
+		verb = "unregister";
+		done = "successfully unregistered";
+		break;
+	case VmDestroyAction:
+		verb = "remove";
+		done = "successfully removed";
+		break;
+	default:
+		return ret;
+	}
 
-	PrlHandle hJob(PrlVm_Suspend(m_hVm));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to suspend the %s: %s",
+	if (ret)
+		return prl_err(ret, "Failed to %s the %s: %s", verb,
 				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully suspended.",
-				get_vm_type_str());
+	prl_log(0, "The %s has been %s.", get_vm_type_str(), done);
 
-	return ret;
+	return 0;
 }
 
-int PrlVm::resume()
+PRL_EVENT_HANDLER_PTR PrlVm::action_event_handler(const CmdParamData &param)
 {
-	PRL_RESULT ret;
-
-	prl_log(0, "Resuming the %s...", get_vm_type_str());
-
-	std::string err;
-
-	PrlHandle hJob(PrlVm_Resume(m_hVm));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to resume the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully resumed.",
-				get_vm_type_str());
-
-	return ret;
+	return param.action == VmStartAction ? start_event_handler : NULL;
 }
 
-int PrlVm::pause(bool acpi)
+int PrlVm::job_action(const CmdParamData &param)
 {
-	PRL_RESULT ret;
-
-	prl_log(0, "Pause the %s...", get_vm_type_str());
-
+	PRL_EVENT_HANDLER_PTR fn = action_event_handler(param);
+	PrlHandle hJob;
 	std::string err;
+	int ret;
 
-	PrlHandle hJob(PrlVm_Pause(m_hVm, acpi));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to pause the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully paused.",
-				get_vm_type_str());
+	if (fn)
+		m_srv.reg_event_callback(fn);
+	if ((ret = action_job(param, hJob.get_ptr())) == 0) {
+		ret = get_job_retcode(hJob.get_handle(), err);
+		ret = action_done(param, ret, err);
+	}
+	if (fn)
+		m_srv.unreg_event_callback(fn);
 
 	return ret;
 }
@@ -1419,49 +1436,22 @@ int PrlVm::move(const std::string &location)
 	return ret;
 }
 
-int PrlVm::unreg()
-{
-	PRL_RESULT ret;
-
-	prl_log(L_INFO, "Unregister the %s.", get_vm_type_str());
-
-	std::string err;
-
-	PrlHandle hJob(PrlVm_Unreg(m_hVm));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to unregister the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully unregistered.",
-				get_vm_type_str());
-
-	return ret;
-}
-
 int PrlVm::destroy(const CmdParamData &param)
 {
 	PRL_RESULT ret;
-
-	prl_log(0, "Removing the %s...", get_vm_type_str());
-	std::string err;
 	VIRTUAL_MACHINE_STATE state = get_state();
 
 	if (param.force && (state == VMS_RUNNING || state == VMS_PAUSED || state == VMS_UNKNOWN)) {
 		CmdParamData p;
+		p.action = VmStopAction;
 		p.force = p.fast = true;
-		if ((ret = stop(p)) && state != VMS_UNKNOWN)
+		if ((ret = job_action(p)) && state != VMS_UNKNOWN)
 			return ret;
 	}
 
-	PrlHandle hJob(PrlVm_Delete(m_hVm, PRL_INVALID_HANDLE));
-	if ((ret = get_job_retcode(hJob.get_handle(), err)))
-		prl_err(ret, "Failed to remove the %s: %s",
-				get_vm_type_str(), err.c_str());
-	else
-		prl_log(0, "The %s has been successfully removed.",
-				get_vm_type_str());
-
-	return ret;
+	CmdParamData p(param);
+	p.force = false;
+	return job_action(p);
 }
 
 int PrlVm::get_boot_list(PrlList<PrlBootEntry *> &bootlist,
@@ -3548,6 +3538,7 @@ int PrlVm::commit_configuration(const CmdParamData &param)
 	PRL_UINT32 resultCount = 0;
 	std::string err;
 	char vm_uuid[256];
+	TraceSpan span("commit_configuration", get_uuid());
 
 	strcpy(vm_uuid, get_id().c_str());
 	m_srv.reg_event_callback(commit_event_handler, vm_uuid);
@@ -4386,14 +4377,30 @@ int PrlVm::get_uptime(PRL_UINT64 *uptime, std::string &start_date)
 	return ret;
 }
 
+/* The timeout limits the whole guest query, not each request */
+/* The logout is waited for even if the deadline of the probe has passed */
+#define GUEST_LOGOUT_TIMEOUT 5 * 1000
+
 int PrlVm::get_real_ip(ip_list_t &ips, unsigned int timeout)
 {
 	PRL_RESULT ret;
 	std::string err;
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	auto left = [&]() -> unsigned int {
+		if (timeout == JOB_INFINIT_WAIT_TIMEOUT)
+			return timeout;
+		long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+		return ms > 0 ? ms : 1;
+	};
 
 	PrlHandle hLoginJob(PrlVm_LoginInGuest(m_hVm, PRL_PRIVILEGED_GUEST_OS_SESSION, 0, 0));
-	if ((ret = get_job_retcode(hLoginJob.get_handle(), err, timeout))) {
+	if ((ret = get_job_retcode(hLoginJob.get_handle(), err, left()))) {
 		prl_log(L_DEBUG, "PrlVm_LoginInGuest: %s", err.c_str());
+		if (ret == PRL_ERR_TIMEOUT) {
+			PrlHandle hCancel(PrlJob_Cancel(hLoginJob.get_handle()));
+		}
 		return ret;
 	}
 
@@ -4413,8 +4420,11 @@ int PrlVm::get_real_ip(ip_list_t &ips, unsigned int timeout)
 
 		PRL_UINT32 count;
 		PrlHandle hJob(PrlVmGuest_GetNetworkSettings(hVmGuest.get_handle(), 0));
-		if ((ret = get_job_result(hJob.get_handle(), hResult.get_ptr(), &count, timeout))) {
+		if ((ret = get_job_result(hJob.get_handle(), hResult.get_ptr(), &count, left()))) {
 			prl_log(L_DEBUG, "PrlVmGuest_GetNetworkSettings; %s", get_error_str(ret).c_str());
+			if (ret == PRL_ERR_TIMEOUT) {
+				PrlHandle hCancel(PrlJob_Cancel(hJob.get_handle()));
+			}
 			break;
 		}
 
@@ -4455,7 +4465,7 @@ int PrlVm::get_real_ip(ip_list_t &ips, unsigned int timeout)
 	} while (0);
 
 	PrlHandle hJob(PrlVmGuest_Logout(hVmGuest.get_handle(), 0));
-	get_job_retcode(hJob.get_handle(), err);
+	get_job_retcode(hJob.get_handle(), err, GUEST_LOGOUT_TIMEOUT);
 
 	return ret;
 }
@@ -4534,8 +4544,6 @@ std::string PrlVm::get_netdev_name()
 {
 	std::string out;
 
-	get_dev_info();
-
 	BOOST_FOREACH(PrlDevNet *net, m_DevNetList) {
 		if (!out.empty())
 			out += ",";
@@ -4567,6 +4575,17 @@ unsigned int PrlVm::get_ha_prio() const
 	return prio;
 }
 
+unsigned int PrlVm::get_autostart_delay() const
+{
+	PRL_RESULT ret;
+	PRL_UINT32 delay = 0;
+	ret = PrlVmCfg_GetAutoStartDelay(m_hVm, &delay);
+	if (PRL_FAILED(ret))
+		prl_log(L_INFO, "PrlVmCfg_GetAutoStartDelay: %s",
+			get_error_str(ret).c_str());
+	return delay;
+}
+
 void PrlVm::get_high_availability_info(PrlOutFormatter &f)
 {
 	f.open("High Availability", true);
@@ -4619,7 +4638,12 @@ void PrlVm::append_configuration(PrlOutFormatter &f)
 	PRL_APPLICATION_MODE appMode = PAM_UNKNOWN;
 	PrlApi_GetAppMode(&appMode);
 
-	get_vm_info();
+	/* Only the data of the requested keys are loaded */
+	if (f.want("Hardware") || f.want("Boot order"))
+		get_vm_info();
+	else if (f.want("State") || f.want("Owner") ||
+			f.want("Remote display state"))
+		update_state();
 
 	f.add_uuid("ID", get_id().c_str());
 
@@ -4642,7 +4666,7 @@ void PrlVm::append_configuration(PrlOutFormatter &f)
 
 	PRL_UINT64 uptime;
 	std::string start_date;
-	if (get_uptime(&uptime, start_date) == 0)
+	if (f.want("Uptime") && get_uptime(&uptime, start_date) == 0)
 		f.add_uptime("Uptime", uptime, start_date);
 
 	std::string x;
@@ -4651,20 +4675,102 @@ void PrlVm::append_configuration(PrlOutFormatter &f)
 	f.add("Backup path", get_backup_path());
 
 	f.add("Owner", m_owner);
-	get_tools_info(f);
+	if (f.want("GuestTools"))
+		get_tools_info(f);
 	f.add("GuestTools autoupdate", (is_tools_autoupdate_enabled() ? "on" : "off"));
 	f.add("Autostart", get_autostart_info());
 	f.add("Autostop", get_autostop_info());
 	f.add("Autocompact", (get_autocompact() ? "on" : "off"));
-	f.add("Boot order", get_bootdev_info());
+	if (f.want("Boot order"))
+		f.add("Boot order", get_bootdev_info());
 	f.add("EFI boot", (m_efi_boot ? "on" : "off"));
 	f.add("Allow select boot device", (m_select_boot_dev ? "on" : "off"));
 	f.add("External boot device", m_ext_boot_dev);
-	if (get_vm_type() == PVT_VM)
+	if (get_vm_type() == PVT_VM && f.want("On guest crash"))
 		f.add("On guest crash", get_on_crash_info());
-	get_vnc_info(f);
+	if (f.want("Remote display"))
+		get_vnc_info(f);
 	f.add("Remote display state", (m_is_vnc_server_started ? "running" : "stopped"));
 
+	if (f.want("Hardware"))
+		append_hardware_info(f);
+
+	FeaturesParam feature = get_features();
+	if (vm_type == PVT_CT) {
+		f.add("Features", feature2str(feature));
+	} else {
+		if (feature.mask & FT_SmartMount) {
+			f.open_shf("SmartMount", true);
+
+			f.open("removable drives", true);
+			f.add_isenabled(prl_bool(feature.mask & FT_SmartMountRemovableDrives));
+			f.close(true);
+
+			f.open("CD/DVD drives", true);
+			f.add_isenabled(prl_bool(feature.mask & FT_SmartMountDVDs));
+			f.close(true);
+
+			f.open("network shares", true);
+			f.add_isenabled(prl_bool(feature.mask & FT_SmartMountNetworkShares));
+			f.close(true);
+
+			f.close();
+		} else {
+			f.open_shf("SmartMount", false);
+			f.close();
+		}
+	}
+
+	get_optimization_info(f);
+
+	PRL_RESULT ret;
+	PRL_BOOL bEnabled;
+	std::string stmp;
+	if (f.want("Offline management") &&
+			PrlVmCfg_IsOfflineManagementEnabled(m_hVm, &bEnabled) == 0) {
+		f.open_shf("Offline management", prl_bool(bEnabled));
+		PrlHandle hList;
+		if (bEnabled && PrlVmCfg_GetOfflineServices(m_hVm, hList.get_ptr()) == 0) {
+			PRL_UINT32 count;
+			PrlStrList_GetItemsCount(hList.get_handle(), &count);
+			stmp = "";
+			for (unsigned int i = 0; i < count; i++) {
+				char buf[256];
+				unsigned int len = sizeof(buf);
+				if ((ret = PrlStrList_GetItem(hList.get_handle(), i, buf, &len))) {
+					prl_log(L_DEBUG, "PrlStrList_GetItem: %s", get_error_str(ret).c_str());
+					continue;
+				}
+				stmp += "'";stmp += buf; stmp += "' ";
+			}
+			f.add("services", stmp);
+		}
+		f.close();
+	}
+	std::string hostname = get_hostname();
+	if (!hostname.empty())
+		f.add("Hostname", hostname);
+
+	if (f.want("DNS Servers")) {
+		std::string dnsservers = get_nameservers();
+		if (!dnsservers.empty())
+			f.add("DNS Servers", dnsservers);
+	}
+
+	if (f.want("Search Domains")) {
+		std::string searchdomains = get_searchdomains();
+		if (!searchdomains.empty())
+			f.add("Search Domains", searchdomains);
+	}
+
+	if (is_full_info_mode()) {
+		get_high_availability_info(f);
+		append_net_shaping_info(f);
+	}
+}
+
+void PrlVm::append_hardware_info(PrlOutFormatter &f)
+{
 	f.open("Hardware");
 	f.open("cpu", true);
 
@@ -4795,73 +4901,6 @@ void PrlVm::append_configuration(PrlOutFormatter &f)
 			(*it)->append_info(f);
 	}
 	f.close();
-
-	FeaturesParam feature = get_features();
-	if (vm_type == PVT_CT) {
-		f.add("Features", feature2str(feature));
-	} else {
-		if (feature.mask & FT_SmartMount) {
-			f.open_shf("SmartMount", true);
-
-			f.open("removable drives", true);
-			f.add_isenabled(prl_bool(feature.mask & FT_SmartMountRemovableDrives));
-			f.close(true);
-
-			f.open("CD/DVD drives", true);
-			f.add_isenabled(prl_bool(feature.mask & FT_SmartMountDVDs));
-			f.close(true);
-
-			f.open("network shares", true);
-			f.add_isenabled(prl_bool(feature.mask & FT_SmartMountNetworkShares));
-			f.close(true);
-
-			f.close();
-		} else {
-			f.open_shf("SmartMount", false);
-			f.close();
-		}
-	}
-
-	get_optimization_info(f);
-
-	PRL_RESULT ret;
-	PRL_BOOL bEnabled;
-	if (PrlVmCfg_IsOfflineManagementEnabled(m_hVm, &bEnabled) == 0) {
-		f.open_shf("Offline management", prl_bool(bEnabled));
-		PrlHandle hList;
-		if (bEnabled && PrlVmCfg_GetOfflineServices(m_hVm, hList.get_ptr()) == 0) {
-			PRL_UINT32 count;
-			PrlStrList_GetItemsCount(hList.get_handle(), &count);
-			stmp = "";
-			for (unsigned int i = 0; i < count; i++) {
-				char buf[256];
-				unsigned int len = sizeof(buf);
-				if ((ret = PrlStrList_GetItem(hList.get_handle(), i, buf, &len))) {
-					prl_log(L_DEBUG, "PrlStrList_GetItem: %s", get_error_str(ret).c_str());
-					continue;
-				}
-				stmp += "'";stmp += buf; stmp += "' ";
-			}
-			f.add("services", stmp);
-		}
-		f.close();
-	}
-	std::string hostname = get_hostname();
-	if (!hostname.empty())
-		f.add("Hostname", hostname);
-
-	std::string dnsservers = get_nameservers();
-	if (!dnsservers.empty())
-		f.add("DNS Servers", dnsservers);
-
-	std::string searchdomains = get_searchdomains();
-	if (!searchdomains.empty())
-		f.add("Search Domains", searchdomains);
-
-	if (is_full_info_mode()) {
-		get_high_availability_info(f);
-		append_net_shaping_info(f);
-	}
 }
 
 void PrlVm::clear()
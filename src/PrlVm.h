@@ -86,19 +86,23 @@ public:
 	const PrlSrv &get_srv() const { return m_srv; }
 	void set_updated() { m_updated = true; }
 	bool is_updated() const { return m_updated; }
-	int start(int mode, int mask);
 	int mount(int flags);
 	int mount_info();
 	int umount();
 	int change_sid();
 	int reset_uptime();
 	int auth(const std::string &user_name, const std::string &user_password);
-	int stop(const CmdParamData &param);
-	int reset();
-	int restart();
-	int suspend();
-	int resume();
-	int pause(bool acpi = false);
+	/* The actions which are done by one dispatcher job: action_job()
+	 * starts the job without waiting for it, action_done() reports its
+	 * result. The server events of the action_event_handler() have to be
+	 * registered while the jobs run. job_action() does it all for one VE.
+	 */
+	static bool is_job_action(const CmdParamData &param);
+	static PRL_EVENT_HANDLER_PTR action_event_handler(const CmdParamData &param);
+	int action_job(const CmdParamData &param, PRL_HANDLE *phJob);
+	int action_done(const CmdParamData &param, PRL_RESULT ret,
+			const std::string &err);
+	int job_action(const CmdParamData &param);
 	int reg_event_callback(PRL_EVENT_HANDLER_PTR fn, void *data);
 	void unreg_event_callback(PRL_EVENT_HANDLER_PTR fn, void *data);
 	int snapshot_create(const SnapshotParam &param);
@@ -127,7 +131,6 @@ public:
 	int reg(const std::string &location, PRL_UINT32 nFlags = 0);
 	int clone(const std::string &name, const std::string &uuid,
 			const std::string &location, unsigned int flags);
-	int unreg();
 	int destroy(const CmdParamData &param);
 	int set_boot_dev(const PrlDev *dev, int bootindex, bool inuse = true) const;
 	unsigned int get_cpu_cores() const;
@@ -240,11 +243,14 @@ public:
 	PrlDev *find_dev(const std::string &sname) const;
 	int get_uptime(PRL_UINT64 *uptime, std::string &start_date);
 	int get_real_ip(ip_list_t &ips, unsigned int timeout = JOB_INFINIT_WAIT_TIMEOUT);
+	/* Uses the device list loaded by get_dev_info() */
 	std::string get_netdev_name();
 	bool get_ha_enable() const;
 	unsigned int get_ha_prio() const;
+	unsigned int get_autostart_delay() const;
 	void get_high_availability_info(PrlOutFormatter &f);
 	void append_net_shaping_info(PrlOutFormatter &f);
+	void append_hardware_info(PrlOutFormatter &f);
 	void append_configuration(PrlOutFormatter &f);
 	int validate_config(PRL_VM_CONFIG_SECTIONS section) const;
 	~PrlVm();
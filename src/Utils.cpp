@@ -33,11 +33,18 @@
 #include <string.h>
 #include <algorithm>
 #include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #ifndef _WIN_
 #include <termios.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #else
 #include <windows.h>
 #include <time.h>
@@ -369,13 +376,26 @@ static void get_op_rc(PrlHandle &hEvent, PRL_RESULT &retcode)
 PRL_RESULT get_job_retcode(PRL_HANDLE hJob, std::string &err,
 	unsigned int timeout)
 {
-	PRL_RESULT ret, retcode;
+	PRL_RESULT ret;
+	std::chrono::steady_clock::time_point begin =
+			std::chrono::steady_clock::now();
 
 	err.clear();
-	if ((ret = PrlJob_Wait(hJob, (JOB_INFINIT_WAIT_TIMEOUT == timeout ? g_nJobTimeout : timeout)))) {
+	ret = PrlJob_Wait(hJob, (JOB_INFINIT_WAIT_TIMEOUT == timeout ? g_nJobTimeout : timeout));
+	record_job(hJob, begin, trace_vm());
+	if (ret) {
 		err = "PrlJob_Wait: " + get_error_str(ret);
 		return ret;
 	}
+	return get_done_job_retcode(hJob, err);
+}
+
+/* The result of a job that is already finished, see get_job_retcode() */
+PRL_RESULT get_done_job_retcode(PRL_HANDLE hJob, std::string &err)
+{
+	PRL_RESULT ret, retcode;
+
+	err.clear();
 	if ((ret = PrlJob_GetRetCode(hJob, &retcode))) {
 		err = "PrlJob_GetRetCode: " +
 			get_error_str(ret);
@@ -1883,6 +1903,86 @@ void xplatform_sleep(unsigned uiMsec)
 #endif
 }
 
+/* Call fn(i) for each i in [0, count) using up to 'jobs' threads.
+ * Indexes are handed out in ascending order; fn must only touch
+ * the data that belongs to its index.
+ */
+void run_parallel(unsigned int count, unsigned int jobs,
+		const std::function<void (unsigned int)> &fn)
+{
+	if (jobs > count)
+		jobs = count;
+	if (jobs <= 1) {
+		for (unsigned int i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<unsigned int> next(0);
+	auto worker = [&]() {
+		for (unsigned int i; (i = next++) < count;)
+			fn(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < jobs; ++i) {
+		try {
+			threads.emplace_back(worker);
+		} catch (const std::system_error &e) {
+			prl_log(L_DEBUG, "Unable to start a worker thread: %s", e.what());
+			break;
+		}
+	}
+	worker();
+	for (auto &t : threads)
+		t.join();
+}
+
+/* Same as run_parallel(), but the calling thread gets emit(i) called in
+ * the index order as soon as fn(i) is done, while the rest is still
+ * being processed.
+ */
+void run_parallel_ordered(unsigned int count, unsigned int jobs,
+		const std::function<void (unsigned int)> &fn,
+		const std::function<void (unsigned int)> &emit)
+{
+	if (jobs <= 1 || count <= 1) {
+		for (unsigned int i = 0; i < count; ++i) {
+			fn(i);
+			emit(i);
+		}
+		return;
+	}
+
+	std::vector<char> done(count, 0);
+	std::mutex mtx;
+	std::condition_variable cv;
+	auto worker = [&](unsigned int i) {
+		fn(i);
+		std::lock_guard<std::mutex> lock(mtx);
+		done[i] = 1;
+		cv.notify_one();
+	};
+
+	std::thread pool;
+	try {
+		pool = std::thread([&]() { run_parallel(count, jobs, worker); });
+	} catch (const std::system_error &e) {
+		prl_log(L_DEBUG, "Unable to start a worker thread: %s", e.what());
+		run_parallel(count, jobs, worker);
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&]() { return done[i] != 0; });
+		}
+		emit(i);
+	}
+	if (pool.joinable())
+		pool.join();
+}
+
 int parse_adv_security_mode(const char *str, int *val)
 {
 	if (!strncmp(str, "off", 3))
@@ -2591,6 +2691,391 @@ void CpuFeatures::set(PRL_CPU_FEATURES_EX reg, PRL_UINT32 v)
 	PrlCpuFeatures_SetValue(m_handle, reg, v);
 }
 
+static std::mutex g_profile_mutex;
+/* -1 until the environment is checked */
+static int g_profile = -1;
+static const char *g_profile_cur;
+static std::chrono::steady_clock::time_point g_profile_start;
+static std::chrono::steady_clock::time_point g_profile_begin;
+static std::vector<std::pair<const char *, double> > g_profile_phases;
+
+/* End the current phase and begin the named one, NULL to just end it.
+ * The time of the phases with the same name is summed up.
+ */
+void profile_phase(const char *name)
+{
+	std::lock_guard<std::mutex> lock(g_profile_mutex);
+	std::chrono::steady_clock::time_point now =
+			std::chrono::steady_clock::now();
+
+	if (g_profile == -1) {
+		const char *env = getenv(PROFILE_STARTUP_ENV);
+
+		g_profile = env != NULL && *env != '\0' && strcmp(env, "0");
+		g_profile_start = now;
+	}
+	if (!g_profile)
+		return;
+
+	if (g_profile_cur != NULL) {
+		double ms = std::chrono::duration<double, std::milli>(
+				now - g_profile_begin).count();
+		size_t i;
+
+		for (i = 0; i < g_profile_phases.size(); i++)
+			if (!strcmp(g_profile_phases[i].first, g_profile_cur))
+				break;
+		if (i == g_profile_phases.size())
+			g_profile_phases.push_back(std::make_pair(g_profile_cur, 0.0));
+		g_profile_phases[i].second += ms;
+	}
+	g_profile_cur = name;
+	g_profile_begin = now;
+}
+
+void profile_report()
+{
+	profile_phase(NULL);
+
+	std::lock_guard<std::mutex> lock(g_profile_mutex);
+	if (g_profile != 1)
+		return;
+
+	double total = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - g_profile_start).count();
+
+	fprintf(stderr, "Startup profile:\n");
+	for (size_t i = 0; i < g_profile_phases.size(); i++)
+		fprintf(stderr, "  %-12s %10.3f ms\n", g_profile_phases[i].first,
+				g_profile_phases[i].second);
+	fprintf(stderr, "  %-12s %10.3f ms\n", "total", total);
+}
+
+static std::atomic<bool> g_trace(false);
+static std::mutex g_trace_mutex;
+static std::string g_trace_file;
+static std::string g_trace_events;
+static std::chrono::steady_clock::time_point g_trace_start;
+/* the VE the spans of the thread belong to */
+static thread_local std::string g_trace_vm;
+
+static std::string json_escape(const std::string &str)
+{
+	std::string out;
+
+	for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+		char buf[8];
+
+		if (*it == '"' || *it == '\\') {
+			out += '\\';
+			out += *it;
+		} else if ((unsigned char) *it < 0x20) {
+			snprintf(buf, sizeof(buf), "\\u%04x", *it);
+			out += buf;
+		} else {
+			out += *it;
+		}
+	}
+	return out;
+}
+
+static long trace_tid()
+{
+#ifdef _LIN_
+	return syscall(SYS_gettid);
+#else
+	static std::atomic<long> next(1);
+	static thread_local long tid = next++;
+
+	return tid;
+#endif
+}
+
+/* --trace-file: every span is kept until trace_write() */
+void trace_enable(const char *path)
+{
+	std::lock_guard<std::mutex> lock(g_trace_mutex);
+
+	g_trace_file = path;
+	if (!g_trace)
+		g_trace_start = std::chrono::steady_clock::now();
+	g_trace = true;
+}
+
+bool trace_enabled()
+{
+	return g_trace;
+}
+
+const std::string &trace_vm()
+{
+	return g_trace_vm;
+}
+
+/* args is the inside of a JSON object, already escaped */
+void trace_event(const char *name, std::chrono::steady_clock::time_point begin,
+		const std::string &vm, const std::string &args)
+{
+	if (!g_trace)
+		return;
+
+	std::chrono::steady_clock::time_point end =
+			std::chrono::steady_clock::now();
+	std::ostringstream e;
+
+	std::lock_guard<std::mutex> lock(g_trace_mutex);
+	e << "{\"name\":\"" << json_escape(name) << "\",\"cat\":\"prlctl\""
+		<< ",\"ph\":\"X\",\"pid\":" << getpid()
+		<< ",\"tid\":" << trace_tid()
+		<< ",\"ts\":" << std::chrono::duration_cast<std::chrono::microseconds>(
+				begin - g_trace_start).count()
+		<< ",\"dur\":" << std::chrono::duration_cast<std::chrono::microseconds>(
+				end - begin).count()
+		<< ",\"args\":{\"tid\":" << trace_tid();
+	if (!vm.empty())
+		e << ",\"vm\":\"" << json_escape(vm) << "\"";
+	if (!args.empty())
+		e << "," << args;
+	e << "}}";
+
+	if (!g_trace_events.empty())
+		g_trace_events += ",\n";
+	g_trace_events += e.str();
+}
+
+static std::atomic<bool> g_timing(false);
+static std::mutex g_timing_mutex;
+/* the job latencies by the operation code, ms */
+static std::map<int, std::vector<double> > g_timing_jobs;
+static double g_timing_format;
+static thread_local int g_format_depth;
+static thread_local double g_format_paused;
+
+/* The jobs prlctl runs, the others are shown by the code */
+static const struct {
+	int code;
+	const char *name;
+} job_names[] = {
+	{ PJOC_SRV_LOGIN, "SRV_LOGIN" },
+	{ PJOC_SRV_LOGIN_LOCAL, "SRV_LOGIN_LOCAL" },
+	{ PJOC_SRV_LOGOFF, "SRV_LOGOFF" },
+	{ PJOC_SRV_GET_SRV_CONFIG, "SRV_GET_SRV_CONFIG" },
+	{ PJOC_SRV_GET_COMMON_PREFS, "SRV_GET_COMMON_PREFS" },
+	{ PJOC_SRV_GET_VM_LIST, "SRV_GET_VM_LIST" },
+	{ PJOC_SRV_GET_VM_CONFIG, "SRV_GET_VM_CONFIG" },
+	{ PJOC_SRV_GET_STATISTICS, "SRV_GET_STATISTICS" },
+	{ PJOC_SRV_CREATE_VM_BACKUP, "SRV_CREATE_VM_BACKUP" },
+	{ PJOC_SRV_RESTORE_VM_BACKUP, "SRV_RESTORE_VM_BACKUP" },
+	{ PJOC_SRV_GET_BACKUP_TREE, "SRV_GET_BACKUP_TREE" },
+	{ PJOC_SRV_REMOVE_VM_BACKUP, "SRV_REMOVE_VM_BACKUP" },
+	{ PJOC_VM_START, "VM_START" },
+	{ PJOC_VM_START_EX, "VM_START_EX" },
+	{ PJOC_VM_STOP, "VM_STOP" },
+	{ PJOC_VM_STOP_EX, "VM_STOP_EX" },
+	{ PJOC_VM_PAUSE, "VM_PAUSE" },
+	{ PJOC_VM_RESET, "VM_RESET" },
+	{ PJOC_VM_RESTART, "VM_RESTART" },
+	{ PJOC_VM_SUSPEND, "VM_SUSPEND" },
+	{ PJOC_VM_RESUME, "VM_RESUME" },
+	{ PJOC_VM_CLONE, "VM_CLONE" },
+	{ PJOC_VM_DELETE, "VM_DELETE" },
+	{ PJOC_VM_UNREG, "VM_UNREG" },
+	{ PJOC_VM_MIGRATE, "VM_MIGRATE" },
+	{ PJOC_VM_GET_STATE, "VM_GET_STATE" },
+	{ PJOC_VM_REFRESH_CONFIG, "VM_REFRESH_CONFIG" },
+	{ PJOC_VM_BEGIN_EDIT, "VM_BEGIN_EDIT" },
+	{ PJOC_VM_COMMIT, "VM_COMMIT" },
+	{ PJOC_VM_GET_STATISTICS, "VM_GET_STATISTICS" },
+	{ PJOC_VM_CREATE_SNAPSHOT, "VM_CREATE_SNAPSHOT" },
+	{ PJOC_VM_SWITCH_TO_SNAPSHOT, "VM_SWITCH_TO_SNAPSHOT" },
+	{ PJOC_VM_DELETE_SNAPSHOT, "VM_DELETE_SNAPSHOT" },
+	{ PJOC_VM_GET_SNAPSHOTS_TREE, "VM_GET_SNAPSHOTS_TREE" },
+	{ PJOC_VM_LOGIN_IN_GUEST, "VM_LOGIN_IN_GUEST" },
+	{ PJOC_VM_GUEST_LOGOUT, "VM_GUEST_LOGOUT" },
+	{ PJOC_VM_GUEST_GET_NETWORK_SETTINGS, "VM_GUEST_GET_NETWORK_SETTINGS" },
+	{ PJOC_VM_GUEST_RUN_PROGRAM, "VM_GUEST_RUN_PROGRAM" },
+	{ PJOC_VM_INSTALL_TOOLS, "VM_INSTALL_TOOLS" },
+	{ PJOC_VM_MOUNT, "VM_MOUNT" },
+	{ PJOC_VM_UMOUNT, "VM_UMOUNT" },
+};
+
+static std::string get_job_name(int code)
+{
+	if (code == -1)
+		return "unknown";
+	for (size_t i = 0; i < sizeof(job_names)/sizeof(job_names[0]); i++)
+		if (job_names[i].code == code)
+			return job_names[i].name;
+
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%d", code);
+	return buf;
+}
+
+/* Account a finished job for --trace-file and --timing. The job span is
+ * named after the SDK call, the operation code goes to args.
+ */
+void record_job(PRL_HANDLE hJob, std::chrono::steady_clock::time_point begin,
+		const std::string &vm)
+{
+	if (!g_trace && !g_timing)
+		return;
+
+	PRL_JOB_OPERATION_CODE op;
+	int code = -1;
+	if (PrlJob_GetOpCode(hJob, &op) == 0)
+		code = (int) op;
+
+	if (g_timing) {
+		double ms = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - begin).count();
+
+		std::lock_guard<std::mutex> lock(g_timing_mutex);
+		g_timing_jobs[code].push_back(ms);
+	}
+	if (g_trace)
+		trace_event("PrlJob_Wait", begin, vm, code == -1 ? std::string() :
+				"\"op\":" + std::to_string(code) + ",\"name\":\"" +
+				get_job_name(code) + "\"");
+}
+
+int trace_write(const std::string &suffix)
+{
+	if (!g_trace)
+		return 0;
+
+	std::lock_guard<std::mutex> lock(g_trace_mutex);
+	std::string path(g_trace_file + suffix);
+	FILE *fp = fopen(path.c_str(), "w");
+	if (fp == NULL)
+		return prl_err(-1, "Unable to create %s: %m", path.c_str());
+
+	fprintf(fp, "{\"traceEvents\":[\n%s\n],\"displayTimeUnit\":\"ms\"}\n",
+			g_trace_events.c_str());
+	if (fclose(fp))
+		return prl_err(-1, "Unable to write %s: %m", path.c_str());
+
+	return 0;
+}
+
+void timing_enable()
+{
+	g_timing = true;
+}
+
+bool timing_enabled()
+{
+	return g_timing;
+}
+
+/* nearest-rank percentile of the sorted values */
+static double percentile(const std::vector<double> &v, unsigned int p)
+{
+	size_t i = (v.size() * p + 99) / 100;
+
+	return v[i ? i - 1 : 0];
+}
+
+void timing_report()
+{
+	if (!g_timing)
+		return;
+
+	std::lock_guard<std::mutex> lock(g_timing_mutex);
+	std::map<int, std::vector<double> >::iterator it;
+	unsigned int count = 0;
+	double total = 0;
+
+	for (it = g_timing_jobs.begin(); it != g_timing_jobs.end(); ++it) {
+		std::sort(it->second.begin(), it->second.end());
+		count += it->second.size();
+		for (size_t i = 0; i < it->second.size(); i++)
+			total += it->second[i];
+	}
+
+	fprintf(stderr, "Timing:\n");
+	fprintf(stderr, "  SDK jobs     %10u %10.3f ms\n", count, total);
+	if (count != 0)
+		fprintf(stderr, "  %-29s %6s %12s %12s %12s\n", "OP", "COUNT",
+				"P50 MS", "P95 MS", "MAX MS");
+	for (it = g_timing_jobs.begin(); it != g_timing_jobs.end(); ++it) {
+		const std::vector<double> &v = it->second;
+
+		fprintf(stderr, "  %-29s %6u %12.3f %12.3f %12.3f\n",
+				get_job_name(it->first).c_str(),
+				(unsigned int) v.size(), percentile(v, 50),
+				percentile(v, 95), v.back());
+	}
+	fprintf(stderr, "  %-12s %10.3f ms\n", "formatting", g_timing_format);
+#ifndef _WIN_
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		fprintf(stderr, "  %-12s %10ld kB\n", "peak RSS", ru.ru_maxrss);
+#endif
+}
+
+/* Only the outermost timer of the thread counts */
+FormatTimer::FormatTimer() :
+	m_on(g_timing),
+	m_outer(false),
+	m_paused(0)
+{
+	if (m_on && g_format_depth++ == 0) {
+		m_outer = true;
+		m_paused = g_format_paused;
+		m_begin = std::chrono::steady_clock::now();
+	}
+}
+
+FormatTimer::~FormatTimer()
+{
+	if (!m_on)
+		return;
+	if (--g_format_depth != 0 || !m_outer)
+		return;
+
+	double ms = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - m_begin).count();
+	ms -= g_format_paused - m_paused;
+	std::lock_guard<std::mutex> lock(g_timing_mutex);
+	g_timing_format += ms;
+}
+
+FormatPause::FormatPause() :
+	m_on(g_format_depth != 0)
+{
+	if (m_on)
+		m_begin = std::chrono::steady_clock::now();
+}
+
+FormatPause::~FormatPause()
+{
+	if (m_on)
+		g_format_paused += std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - m_begin).count();
+}
+
+TraceSpan::TraceSpan(const char *name, const std::string &vm) :
+	m_name(name),
+	m_on(g_trace)
+{
+	if (!m_on)
+		return;
+	m_prev_vm = g_trace_vm;
+	if (!vm.empty())
+		g_trace_vm = vm;
+	m_begin = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan()
+{
+	if (!m_on)
+		return;
+	trace_event(m_name, m_begin, g_trace_vm, std::string());
+	g_trace_vm = m_prev_vm;
+}
+
 bool check_address(const std::string& address_)
 {
 	std::string::size_type l = address_.find_last_of(":");
@@ -32,6 +32,8 @@
 #include <string>
 #include <vector>
 #include <bitset>
+#include <functional>
+#include <chrono>
 #include "PrlTypes.h"
 #include "CmdParam.h"
 
@@ -72,6 +74,7 @@ int send_problem_report_on_stdout(const PrlHandle &hProblemReport);
 int assembly_problem_report(const PrlHandle &hProblemReport, const ProblemReportParam &param, PRL_UINT32 flags);
 PRL_RESULT get_job_retcode(PRL_HANDLE hJob, std::string &err,
 	unsigned int timeout = JOB_INFINIT_WAIT_TIMEOUT);
+PRL_RESULT get_done_job_retcode(PRL_HANDLE hJob, std::string &err);
 inline PRL_RESULT get_job_retcode_predefined(PRL_HANDLE hJob, std::string &err)
 {
 	bool s = (JOB_INFINIT_WAIT_TIMEOUT == g_nJobTimeout);
@@ -179,6 +182,70 @@ std::string print_features_unmaskable(const CpuFeatures &features, const CpuFeat
 const char *prl_ct_resource2str(PRL_CT_RESOURCE id);
 int prlerr2exitcode(PRL_RESULT result);
 void xplatform_sleep(unsigned uiMsec);
+void run_parallel(unsigned int count, unsigned int jobs,
+		const std::function<void (unsigned int)> &fn);
+void run_parallel_ordered(unsigned int count, unsigned int jobs,
+		const std::function<void (unsigned int)> &fn,
+		const std::function<void (unsigned int)> &emit);
+/* With PRLCTL_PROFILE_STARTUP=1 the time of every phase is printed
+ * to stderr by profile_report().
+ */
+#define PROFILE_STARTUP_ENV	"PRLCTL_PROFILE_STARTUP"
+void profile_phase(const char *name);
+void profile_report();
+/* --trace-file: the spans of the SDK jobs and of the main phases are
+ * written in the Chrome trace-event format, for chrome://tracing or Perfetto.
+ */
+void trace_enable(const char *path);
+bool trace_enabled();
+const std::string &trace_vm();
+void trace_event(const char *name, std::chrono::steady_clock::time_point begin,
+		const std::string &vm, const std::string &args);
+int trace_write(const std::string &suffix = std::string());
+/* --timing: the job latencies, the formatting time and the peak RSS
+ * are printed to stderr by timing_report()
+ */
+void timing_enable();
+bool timing_enabled();
+void timing_report();
+void record_job(PRL_HANDLE hJob, std::chrono::steady_clock::time_point begin,
+		const std::string &vm);
+/* Accounts the scope as the local output formatting */
+class FormatTimer : private boost::noncopyable
+{
+public:
+	FormatTimer();
+	~FormatTimer();
+private:
+	bool m_on;
+	bool m_outer;
+	std::chrono::steady_clock::time_point m_begin;
+	double m_paused;
+};
+/* Leaves the scope out of the FormatTimer around it, e.g. the output I/O */
+class FormatPause : private boost::noncopyable
+{
+public:
+	FormatPause();
+	~FormatPause();
+private:
+	bool m_on;
+	std::chrono::steady_clock::time_point m_begin;
+};
+/* A span for the scope; the nested spans and jobs of the thread are
+ * attributed to the VE given here.
+ */
+class TraceSpan : private boost::noncopyable
+{
+public:
+	TraceSpan(const char *name, const std::string &vm = std::string());
+	~TraceSpan();
+private:
+	const char *m_name;
+	bool m_on;
+	std::string m_prev_vm;
+	std::chrono::steady_clock::time_point m_begin;
+};
 int parse_adv_security_mode(const char *str, int *val);
 const char * adv_security_mode_to_str(PRL_MOBILE_ADVANCED_AUTH_MODE val);
 int edit_allow_command_list(PRL_HANDLE hList, const std::vector< std::pair<PRL_ALLOWED_VM_COMMAND, bool > >& vCmds);
@@ -0,0 +1,1466 @@
+/*
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo International GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+/* The SDK stand-in prlctl-bench is linked with instead of libprl_sdk, see
+ * make bench. It serves a synthetic fleet for the calls of the hot paths:
+ * the VE list and configs, the states and devices, the performance
+ * statistics, the backup tree, and PrlVm_BeginBackup() with the disks and
+ * the CBT maps. Every job is finished after the configured latency. The
+ * other SDK calls are the stubs of MockUnimpl.c which fail with
+ * PRL_ERR_UNIMPLEMENTED.
+ *
+ * The fleet is set up from the environment:
+ *	PRL_MOCK_VMS		number of VEs, every 4th is a CT (10000)
+ *	PRL_MOCK_NETS		network adapters of a VE (3)
+ *	PRL_MOCK_DISKS		hard disks of a VE (2)
+ *	PRL_MOCK_DISK_MB	size of a disk image (64)
+ *	PRL_MOCK_BACKUPS	backups of a VE in the backup tree, the first
+ *				one is full, the others are incremental (3)
+ *	PRL_MOCK_LATENCY_US	time a job takes (100)
+ *	PRL_MOCK_READ_US	time a PrlDisk_Read() takes (0)
+ *	PRL_MOCK_VERBOSE	report the unimplemented calls on stderr
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <PrlTypes.h>
+#include <PrlEnums.h>
+#include <PrlErrors.h>
+#include <PrlOses.h>
+
+typedef std::chrono::steady_clock mock_clock;
+typedef PRL_RESULT (*mock_handler_t)(PRL_HANDLE, PRL_VOID_PTR);
+
+/* The block size of the disks and of their CBT maps */
+#define MOCK_GRANULARITY	(64 * 1024)
+/* The statistics of a subscribed VE are sent that often */
+#define MOCK_STATS_PERIOD_MS	1000
+
+/***************************** the fleet ******************************/
+
+struct MockFleet {
+	unsigned int vms;
+	unsigned int nets;
+	unsigned int disks;
+	unsigned int disk_blocks;
+	unsigned int backups;
+	std::chrono::microseconds latency;
+	std::chrono::microseconds read_latency;
+	bool verbose;
+};
+
+static unsigned int env_uint(const char *name, unsigned int def)
+{
+	const char *val = getenv(name);
+
+	if (val == NULL || *val == '\0')
+		return def;
+	return (unsigned int) strtoul(val, NULL, 10);
+}
+
+static const MockFleet &fleet()
+{
+	static const MockFleet f = {
+		env_uint("PRL_MOCK_VMS", 10000),
+		env_uint("PRL_MOCK_NETS", 3),
+		env_uint("PRL_MOCK_DISKS", 2),
+		env_uint("PRL_MOCK_DISK_MB", 64) * (1024 * 1024 / MOCK_GRANULARITY),
+		env_uint("PRL_MOCK_BACKUPS", 3),
+		std::chrono::microseconds(env_uint("PRL_MOCK_LATENCY_US", 100)),
+		std::chrono::microseconds(env_uint("PRL_MOCK_READ_US", 0)),
+		getenv("PRL_MOCK_VERBOSE") != NULL,
+	};
+
+	return f;
+}
+
+static bool is_ct(unsigned int vm)
+{
+	return vm % 4 == 3;
+}
+
+static bool is_template(unsigned int vm)
+{
+	return vm % 50 == 49;
+}
+
+static VIRTUAL_MACHINE_STATE vm_state(unsigned int vm)
+{
+	if (is_template(vm))
+		return VMS_STOPPED;
+	switch (vm % 8) {
+	case 5:
+		return VMS_STOPPED;
+	case 6:
+		return VMS_SUSPENDED;
+	default:
+		return VMS_RUNNING;
+	}
+}
+
+static std::string fmt(const char *format, ...)
+	__attribute__ ((format (printf, 1, 2)));
+
+static std::string fmt(const char *format, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	va_start(ap, format);
+	vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	return std::string(buf);
+}
+
+static std::string vm_uuid(unsigned int vm)
+{
+	return fmt("{%08x-0000-4000-8000-%012x}", vm, vm * 2654435761u);
+}
+
+static std::string vm_name(unsigned int vm)
+{
+	return fmt("%s%05u", is_ct(vm) ? "ct" : "vm", vm);
+}
+
+static std::string backup_uuid(unsigned int vm, unsigned int n)
+{
+	return fmt("{%08x-%04x-4000-8000-0000000000b0}", vm, n);
+}
+
+/* The VE of a PrlSrv_GetVmConfig() id: the UUID or the name */
+static int find_vm(const char *id)
+{
+	unsigned int vm;
+
+	if (id == NULL)
+		return -1;
+	if (sscanf(id, "{%8x-", &vm) == 1 || sscanf(id, "%8x-", &vm) == 1) {
+		std::string uuid(vm_uuid(vm));
+
+		if (uuid == id || uuid.compare(1, uuid.size() - 2, id) == 0)
+			return vm < fleet().vms ? (int) vm : -1;
+	}
+	if ((sscanf(id, "vm%u", &vm) == 1 || sscanf(id, "ct%u", &vm) == 1) &&
+			vm_name(vm) == id)
+		return vm < fleet().vms ? (int) vm : -1;
+	return -1;
+}
+
+static uint64_t mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static uint64_t block_seed(unsigned int vm, unsigned int disk, uint64_t block)
+{
+	return mix(((uint64_t) vm << 40) ^ ((uint64_t) disk << 32) ^ block);
+}
+
+/* A quarter of the blocks is never written */
+static bool block_allocated(uint64_t seed)
+{
+	return (seed & 3) != 0;
+}
+
+/* Of the allocated blocks an eighth is changed since the last backup */
+static bool block_changed(uint64_t seed)
+{
+	return block_allocated(seed) && ((seed >> 8) & 7) == 0;
+}
+
+/****************************** handles *******************************/
+
+enum MockKind {
+	MOCK_SRV,
+	MOCK_JOB,
+	MOCK_RESULT,
+	MOCK_LOGIN,
+	MOCK_VM,
+	MOCK_VMINFO,
+	MOCK_ACL,
+	MOCK_NET,
+	MOCK_HDD,
+	MOCK_STRLIST,
+	MOCK_EVENT,
+	MOCK_EVT_PRM,
+	MOCK_BACKUP,
+	MOCK_DISK,
+	MOCK_DISKMAP,
+};
+
+/* What a job gives: the parameters are made on request */
+struct MockResult {
+	MockKind kind;
+	std::vector<unsigned int> vms;
+	std::string str;
+
+	explicit MockResult(MockKind k = MOCK_RESULT) : kind(k)
+	{}
+};
+
+struct MockObj {
+	MockKind kind;
+	std::atomic<int> refs;
+	unsigned int vm;
+	unsigned int idx;
+	bool full;
+	std::vector<std::string> strs;
+	/* a job, the fields below are under m */
+	std::mutex m;
+	std::condition_variable cond;
+	mock_clock::time_point done;
+	PRL_RESULT retcode;
+	int op;
+	std::shared_ptr<MockResult> result;
+
+	MockObj(MockKind k, unsigned int v = 0, unsigned int i = 0) :
+		kind(k), refs(1), vm(v), idx(i), full(false),
+		retcode(PRL_ERR_SUCCESS), op(-1)
+	{}
+};
+
+typedef std::shared_ptr<MockObj> MockPtr;
+
+static std::mutex g_handles_mutex;
+static std::unordered_map<uintptr_t, MockPtr> g_handles;
+static uintptr_t g_next_handle = 1;
+
+static PRL_HANDLE new_handle(MockObj *obj)
+{
+	std::lock_guard<std::mutex> lock(g_handles_mutex);
+	uintptr_t h = g_next_handle++;
+
+	g_handles[h] = MockPtr(obj);
+	return (PRL_HANDLE) h;
+}
+
+static MockPtr get_obj(PRL_HANDLE h, MockKind kind)
+{
+	std::lock_guard<std::mutex> lock(g_handles_mutex);
+	std::unordered_map<uintptr_t, MockPtr>::const_iterator it =
+			g_handles.find((uintptr_t) h);
+
+	if (it == g_handles.end() || it->second->kind != kind)
+		return MockPtr();
+	return it->second;
+}
+
+static PRL_HANDLE_TYPE handle_type(MockKind kind)
+{
+	switch (kind) {
+	case MOCK_SRV:
+		return PHT_SERVER;
+	case MOCK_JOB:
+		return PHT_JOB;
+	case MOCK_RESULT:
+		return PHT_RESULT;
+	case MOCK_LOGIN:
+		return PHT_LOGIN_RESPONSE;
+	case MOCK_VM:
+		return PHT_VIRTUAL_MACHINE;
+	case MOCK_VMINFO:
+		return PHT_VM_INFO;
+	case MOCK_ACL:
+		return PHT_ACCESS_RIGHTS;
+	case MOCK_NET:
+		return PHT_VIRTUAL_DEV_NET_ADAPTER;
+	case MOCK_HDD:
+		return PHT_VIRTUAL_DEV_HARD_DISK;
+	case MOCK_STRLIST:
+		return PHT_STRINGS_LIST;
+	case MOCK_EVENT:
+		return PHT_EVENT;
+	case MOCK_EVT_PRM:
+		return PHT_EVENT_PARAMETER;
+	default:
+		return PHT_ERROR;
+	}
+}
+
+static PRL_RESULT copy_str(const std::string &s, PRL_STR buf,
+		PRL_UINT32_PTR len)
+{
+	if (len == NULL)
+		return PRL_ERR_INVALID_ARG;
+	if (buf == NULL) {
+		*len = s.size() + 1;
+		return PRL_ERR_SUCCESS;
+	}
+	if (*len < s.size() + 1) {
+		*len = s.size() + 1;
+		return PRL_ERR_INVALID_ARG;
+	}
+	memcpy(buf, s.c_str(), s.size() + 1);
+	*len = s.size() + 1;
+	return PRL_ERR_SUCCESS;
+}
+
+#define GET_OBJ(o, h, kind) \
+	MockPtr o = get_obj(h, kind); \
+	if (!o) \
+		return PRL_ERR_INVALID_ARG;
+
+/******************************** jobs ********************************/
+
+static PRL_HANDLE new_job(int op, MockResult *result = NULL,
+		PRL_RESULT retcode = PRL_ERR_SUCCESS)
+{
+	MockObj *job = new MockObj(MOCK_JOB);
+
+	job->done = mock_clock::now() + fleet().latency;
+	job->op = op;
+	job->retcode = retcode;
+	job->result.reset(result);
+	return new_handle(job);
+}
+
+/****************************** events ********************************/
+
+struct MockHandler {
+	mock_handler_t fn;
+	PRL_VOID_PTR data;
+};
+
+/* The handlers are called with it held, so a handler is not called once
+ * the Unreg call which removes it has returned
+ */
+static std::recursive_mutex g_handlers_mutex;
+static std::vector<MockHandler> g_srv_handlers;
+static std::map<unsigned int, std::vector<MockHandler> > g_vm_handlers;
+
+static void reg_handler(std::vector<MockHandler> &list, mock_handler_t fn,
+		PRL_VOID_PTR data)
+{
+	MockHandler h = { fn, data };
+
+	list.push_back(h);
+}
+
+static PRL_RESULT unreg_handler(std::vector<MockHandler> &list,
+		mock_handler_t fn, PRL_VOID_PTR data)
+{
+	for (std::vector<MockHandler>::iterator it = list.begin();
+			it != list.end(); ++it) {
+		if (it->fn == fn && (data == NULL || it->data == data)) {
+			list.erase(it);
+			return PRL_ERR_SUCCESS;
+		}
+	}
+	return PRL_ERR_INVALID_ARG;
+}
+
+/* The statistics of the subscribed VEs are sent by one thread, the way
+ * the SDK delivers the dispatcher events
+ */
+class MockEvents {
+public:
+	MockEvents() : m_stop(false)
+	{}
+	~MockEvents()
+	{
+		stop();
+	}
+
+	void subscribe(unsigned int vm, mock_clock::time_point at)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_subscribed.insert(vm);
+		m_queue.insert(std::make_pair(at, vm));
+		if (!m_thread.joinable())
+			m_thread = std::thread(&MockEvents::run, this);
+		m_cond.notify_one();
+	}
+
+	void unsubscribe(unsigned int vm)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_subscribed.erase(vm);
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_stop = true;
+			m_cond.notify_one();
+		}
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+private:
+	void run();
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::multimap<mock_clock::time_point, unsigned int> m_queue;
+	std::set<unsigned int> m_subscribed;
+	bool m_stop;
+	std::thread m_thread;
+};
+
+static void send_stats(unsigned int vm)
+{
+	std::lock_guard<std::recursive_mutex> lock(g_handlers_mutex);
+	std::map<unsigned int, std::vector<MockHandler> >::const_iterator it =
+			g_vm_handlers.find(vm);
+
+	if (it == g_vm_handlers.end())
+		return;
+	/* a handler may unregister itself */
+	std::vector<MockHandler> handlers(it->second);
+	for (size_t i = 0; i < handlers.size(); i++) {
+		MockObj *evt = new MockObj(MOCK_EVENT, vm);
+
+		evt->idx = PET_DSP_EVT_VM_PERFSTATS;
+		/* the handler frees it */
+		handlers[i].fn(new_handle(evt), handlers[i].data);
+	}
+}
+
+void MockEvents::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_stop) {
+		if (m_queue.empty()) {
+			m_cond.wait(lock);
+			continue;
+		}
+		mock_clock::time_point at = m_queue.begin()->first;
+		if (mock_clock::now() < at) {
+			m_cond.wait_until(lock, at);
+			continue;
+		}
+		unsigned int vm = m_queue.begin()->second;
+		m_queue.erase(m_queue.begin());
+		if (!m_subscribed.count(vm))
+			continue;
+		m_queue.insert(std::make_pair(at +
+			std::chrono::milliseconds(MOCK_STATS_PERIOD_MS), vm));
+
+		lock.unlock();
+		send_stats(vm);
+		lock.lock();
+	}
+}
+
+static MockEvents g_events;
+
+/* The counters of a statistics event: the VE ones, then per adapter and
+ * per disk
+ */
+static const char *vm_counters[] = {
+	"cpu.usage", "guest.ram.usage", "guest.ram.total", "guest.ram.swap_in",
+};
+static const char *net_counters[] = {
+	"bytes_in", "bytes_out", "pkts_in", "pkts_out",
+};
+static const char *hdd_counters[] = {
+	"read_requests", "write_requests", "read_total", "write_total",
+};
+#define COUNTERS(a)	((unsigned int) (sizeof(a) / sizeof(a[0])))
+
+static unsigned int stats_count()
+{
+	return COUNTERS(vm_counters) +
+		COUNTERS(net_counters) * fleet().nets +
+		COUNTERS(hdd_counters) * fleet().disks;
+}
+
+static std::string stats_name(unsigned int idx)
+{
+	if (idx < COUNTERS(vm_counters))
+		return vm_counters[idx];
+	idx -= COUNTERS(vm_counters);
+	if (idx < COUNTERS(net_counters) * fleet().nets)
+		return fmt("net.nic%u.%s", idx / COUNTERS(net_counters),
+				net_counters[idx % COUNTERS(net_counters)]);
+	idx -= COUNTERS(net_counters) * fleet().nets;
+	return fmt("devices.scsi0:%u.%s", idx / COUNTERS(hdd_counters),
+			hdd_counters[idx % COUNTERS(hdd_counters)]);
+}
+
+static PRL_UINT64 stats_value(unsigned int vm, unsigned int idx)
+{
+	uint64_t t = std::chrono::duration_cast<std::chrono::seconds>(
+			mock_clock::now().time_since_epoch()).count();
+
+	return mix(((uint64_t) vm << 32) ^ (idx << 16) ^ t) % 100000;
+}
+
+/******************************** API *********************************/
+
+extern "C" {
+
+/* Called by the generated stubs of MockUnimpl.c */
+unsigned long mock_unimplemented(const char *name)
+{
+	static std::mutex m;
+	static std::set<std::string> reported;
+
+	if (fleet().verbose) {
+		std::lock_guard<std::mutex> lock(m);
+
+		if (reported.insert(name).second)
+			fprintf(stderr, "prl-mock: %s is not implemented\n", name);
+	}
+	return (PRL_UINT32) PRL_ERR_UNIMPLEMENTED;
+}
+
+PRL_RESULT PrlApi_InitEx(PRL_UINT32 nVersion, PRL_APPLICATION_MODE nAppMode,
+		PRL_UINT32 nFlags, PRL_UINT32 nReserved)
+{
+	(void)nVersion; (void)nAppMode; (void)nFlags; (void)nReserved;
+	fleet();
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlApi_Deinit()
+{
+	g_events.stop();
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlApi_SwitchConsoleLogging(PRL_BOOL bSwitchOn)
+{
+	(void)bSwitchOn;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlApi_GetResultDescription(PRL_RESULT nErrCode,
+		PRL_BOOL bIsBriefMessage, PRL_BOOL bFormated, PRL_STR sErrString,
+		PRL_UINT32_PTR pnErrStringBufLength)
+{
+	(void)bFormated;
+	if (!bIsBriefMessage)
+		return copy_str("", sErrString, pnErrStringBufLength);
+	return copy_str(fmt("prl-mock error %#x", (unsigned int) nErrCode),
+			sErrString, pnErrStringBufLength);
+}
+
+PRL_RESULT PrlHandle_AddRef(PRL_HANDLE h)
+{
+	std::lock_guard<std::mutex> lock(g_handles_mutex);
+	std::unordered_map<uintptr_t, MockPtr>::const_iterator it =
+			g_handles.find((uintptr_t) h);
+
+	if (it == g_handles.end())
+		return PRL_ERR_INVALID_ARG;
+	it->second->refs++;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlHandle_Free(PRL_HANDLE h)
+{
+	std::lock_guard<std::mutex> lock(g_handles_mutex);
+	std::unordered_map<uintptr_t, MockPtr>::iterator it =
+			g_handles.find((uintptr_t) h);
+
+	if (it == g_handles.end())
+		return PRL_ERR_INVALID_ARG;
+	if (--it->second->refs == 0)
+		g_handles.erase(it);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlHandle_GetType(PRL_HANDLE h, PRL_HANDLE_TYPE *type)
+{
+	std::lock_guard<std::mutex> lock(g_handles_mutex);
+	std::unordered_map<uintptr_t, MockPtr>::const_iterator it =
+			g_handles.find((uintptr_t) h);
+
+	if (it == g_handles.end() || type == NULL)
+		return PRL_ERR_INVALID_ARG;
+	*type = handle_type(it->second->kind);
+	return PRL_ERR_SUCCESS;
+}
+
+/* Jobs */
+
+PRL_RESULT PrlJob_Wait(PRL_HANDLE hJob, PRL_UINT32 msecs)
+{
+	GET_OBJ(job, hJob, MOCK_JOB)
+	mock_clock::time_point deadline = mock_clock::now() +
+			std::chrono::milliseconds(msecs);
+	std::unique_lock<std::mutex> lock(job->m);
+
+	while (mock_clock::now() < job->done) {
+		if (deadline <= mock_clock::now())
+			return PRL_ERR_TIMEOUT;
+		job->cond.wait_until(lock, std::min(deadline, job->done));
+	}
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_HANDLE PrlJob_Cancel(PRL_HANDLE hJob)
+{
+	MockPtr job = get_obj(hJob, MOCK_JOB);
+
+	if (job) {
+		std::lock_guard<std::mutex> lock(job->m);
+
+		if (mock_clock::now() < job->done) {
+			job->retcode = PRL_ERR_OPERATION_WAS_CANCELED;
+			job->result.reset();
+			job->done = mock_clock::now();
+			job->cond.notify_all();
+		}
+	}
+	return new_job(-1);
+}
+
+PRL_RESULT PrlJob_GetRetCode(PRL_HANDLE hJob, PRL_RESULT *pnRetCode)
+{
+	GET_OBJ(job, hJob, MOCK_JOB)
+	std::lock_guard<std::mutex> lock(job->m);
+
+	if (mock_clock::now() < job->done)
+		return PRL_ERR_UNINITIALIZED;
+	*pnRetCode = job->retcode;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlJob_GetResult(PRL_HANDLE hJob, PRL_HANDLE_PTR phResult)
+{
+	GET_OBJ(job, hJob, MOCK_JOB)
+	std::lock_guard<std::mutex> lock(job->m);
+	MockObj *res;
+
+	if (mock_clock::now() < job->done)
+		return PRL_ERR_UNINITIALIZED;
+	res = new MockObj(MOCK_RESULT);
+	if (job->result)
+		res->result = job->result;
+	else
+		res->result.reset(new MockResult());
+	*phResult = new_handle(res);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlJob_GetError(PRL_HANDLE hJob, PRL_HANDLE_PTR phError)
+{
+	(void)hJob; (void)phError;
+	return PRL_ERR_NO_DATA;
+}
+
+PRL_RESULT PrlJob_GetOpCode(PRL_HANDLE hJob, PRL_JOB_OPERATION_CODE *pnOpCode)
+{
+	GET_OBJ(job, hJob, MOCK_JOB)
+
+	if (job->op == -1)
+		return PRL_ERR_NO_DATA;
+	*pnOpCode = (PRL_JOB_OPERATION_CODE) job->op;
+	return PRL_ERR_SUCCESS;
+}
+
+/* Results */
+
+PRL_RESULT PrlResult_GetParamsCount(PRL_HANDLE hResult, PRL_UINT32_PTR pnCount)
+{
+	GET_OBJ(res, hResult, MOCK_RESULT)
+	const MockResult &r = *res->result;
+
+	if (r.kind == MOCK_RESULT)
+		*pnCount = r.str.empty() ? 0 : 1;
+	else if (r.kind == MOCK_VM)
+		*pnCount = r.vms.size();
+	else
+		*pnCount = 1;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlResult_GetParamByIndex(PRL_HANDLE hResult, PRL_UINT32 nIndex,
+		PRL_HANDLE_PTR phParam)
+{
+	GET_OBJ(res, hResult, MOCK_RESULT)
+	const MockResult &r = *res->result;
+
+	if (r.kind == MOCK_VM) {
+		if (nIndex >= r.vms.size())
+			return PRL_ERR_INVALID_ARG;
+		*phParam = new_handle(new MockObj(MOCK_VM, r.vms[nIndex]));
+		return PRL_ERR_SUCCESS;
+	}
+	if (nIndex != 0 || r.kind == MOCK_RESULT)
+		return PRL_ERR_INVALID_ARG;
+	*phParam = new_handle(new MockObj(r.kind, r.vms.empty() ? 0 : r.vms[0]));
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlResult_GetParam(PRL_HANDLE hResult, PRL_HANDLE_PTR phParam)
+{
+	return PrlResult_GetParamByIndex(hResult, 0, phParam);
+}
+
+PRL_RESULT PrlResult_GetParamAsString(PRL_HANDLE hResult, PRL_STR sParam,
+		PRL_UINT32_PTR pnLength)
+{
+	GET_OBJ(res, hResult, MOCK_RESULT)
+
+	return copy_str(res->result->str, sParam, pnLength);
+}
+
+/* Server */
+
+PRL_RESULT PrlSrv_Create(PRL_HANDLE_PTR phServer)
+{
+	*phServer = new_handle(new MockObj(MOCK_SRV));
+	return PRL_ERR_SUCCESS;
+}
+
+static PRL_HANDLE login_job(PRL_HANDLE hServer, int op)
+{
+	if (!get_obj(hServer, MOCK_SRV))
+		return PRL_INVALID_HANDLE;
+	return new_job(op, new MockResult(MOCK_LOGIN));
+}
+
+PRL_HANDLE PrlSrv_LoginLocalEx(PRL_HANDLE hServer, PRL_CONST_STR sPrevSessionUuid,
+		PRL_UINT32 port, PRL_SECURITY_LEVEL security_level, PRL_UINT32 nFlags)
+{
+	(void)sPrevSessionUuid; (void)port; (void)security_level; (void)nFlags;
+	return login_job(hServer, PJOC_SRV_LOGIN_LOCAL);
+}
+
+PRL_HANDLE PrlSrv_LoginEx(PRL_HANDLE hServer, PRL_CONST_STR host,
+		PRL_CONST_STR user, PRL_CONST_STR passwd,
+		PRL_CONST_STR sPrevSessionUuid, PRL_UINT32 port_cmd,
+		PRL_UINT32 timeout, PRL_SECURITY_LEVEL security_level,
+		PRL_UINT32 nFlags)
+{
+	(void)host; (void)user; (void)passwd; (void)sPrevSessionUuid;
+	(void)port_cmd; (void)timeout; (void)security_level; (void)nFlags;
+	return login_job(hServer, PJOC_SRV_LOGIN);
+}
+
+PRL_HANDLE PrlSrv_Logoff(PRL_HANDLE hServer)
+{
+	(void)hServer;
+	return new_job(PJOC_SRV_LOGOFF);
+}
+
+PRL_HANDLE PrlSrv_SetNonInteractiveSession(PRL_HANDLE hServer,
+		PRL_BOOL bNonInteractive, PRL_UINT32 nFlags)
+{
+	(void)hServer; (void)bNonInteractive; (void)nFlags;
+	return new_job(-1);
+}
+
+PRL_RESULT PrlLoginResponse_GetServerUuid(PRL_HANDLE hLoginResp,
+		PRL_STR sServerUuid, PRL_UINT32_PTR pnServerUuidBufLength)
+{
+	GET_OBJ(r, hLoginResp, MOCK_LOGIN)
+
+	return copy_str("{00000000-0000-4000-8000-00000000cafe}", sServerUuid,
+			pnServerUuidBufLength);
+}
+
+PRL_RESULT PrlLoginResponse_GetSessionUuid(PRL_HANDLE hLoginResp,
+		PRL_STR sSessionUuid, PRL_UINT32_PTR pnSessionUuidBufLength)
+{
+	GET_OBJ(r, hLoginResp, MOCK_LOGIN)
+
+	return copy_str("{00000000-0000-4000-8000-0000000051d0}", sSessionUuid,
+			pnSessionUuidBufLength);
+}
+
+PRL_RESULT PrlSrv_RegEventHandler(PRL_HANDLE hServer, mock_handler_t handler,
+		PRL_VOID_PTR pUserData)
+{
+	GET_OBJ(srv, hServer, MOCK_SRV)
+	std::lock_guard<std::recursive_mutex> lock(g_handlers_mutex);
+
+	reg_handler(g_srv_handlers, handler, pUserData);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlSrv_UnregEventHandler(PRL_HANDLE hServer, mock_handler_t handler,
+		PRL_VOID_PTR pUserData)
+{
+	GET_OBJ(srv, hServer, MOCK_SRV)
+	std::lock_guard<std::recursive_mutex> lock(g_handlers_mutex);
+
+	return unreg_handler(g_srv_handlers, handler, pUserData);
+}
+
+PRL_HANDLE PrlSrv_GetVmListEx(PRL_HANDLE hServer, PRL_UINT32 nFlags)
+{
+	MockResult *r = new MockResult(MOCK_VM);
+	bool vm = (nFlags & PVTF_VM) || !(nFlags & PVTF_CT);
+	bool ct = (nFlags & PVTF_CT) || !(nFlags & PVTF_VM);
+
+	(void)hServer;
+	r->vms.reserve(fleet().vms);
+	for (unsigned int i = 0; i < fleet().vms; i++)
+		if (is_ct(i) ? ct : vm)
+			r->vms.push_back(i);
+	return new_job(PJOC_SRV_GET_VM_LIST, r);
+}
+
+PRL_HANDLE PrlSrv_GetVmConfig(PRL_HANDLE hServer, PRL_CONST_STR sSearchId,
+		PRL_UINT32 nFlags)
+{
+	int vm = find_vm(sSearchId);
+	MockResult *r;
+
+	(void)hServer; (void)nFlags;
+	if (vm == -1)
+		return new_job(PJOC_SRV_GET_VM_CONFIG, NULL,
+				PRL_ERR_VM_UUID_NOT_FOUND);
+	r = new MockResult(MOCK_VM);
+	r->vms.push_back(vm);
+	return new_job(PJOC_SRV_GET_VM_CONFIG, r);
+}
+
+/* The backup tree of the whole fleet, or of the VE of sUuid */
+PRL_HANDLE PrlSrv_GetBackupTreeEx(PRL_HANDLE hServer, PRL_CONST_STR sUuid,
+		PRL_CONST_STR sTargetHost, PRL_UINT32 nTargetPort,
+		PRL_CONST_STR sTargetSessionId, PRL_UINT32 nBackupFlags,
+		PRL_UINT32 nReserved, PRL_BOOL bUseDefault, PRL_VOID_PTR pParam)
+{
+	MockResult *r = new MockResult();
+	int only = find_vm(sUuid);
+	const MockFleet &f = fleet();
+	std::string &xml = r->str;
+
+	(void)hServer; (void)sTargetHost; (void)nTargetPort;
+	(void)sTargetSessionId; (void)nBackupFlags; (void)nReserved;
+	(void)bUseDefault; (void)pParam;
+	xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<BackupTree>\n";
+	for (unsigned int vm = 0; vm < f.vms && f.backups; vm++) {
+		if (only != -1 && (unsigned int) only != vm)
+			continue;
+		xml += "<VmItem>\n<Uuid>" + vm_uuid(vm) + "</Uuid>\n<Name>" +
+			vm_name(vm) + "</Name>\n";
+		for (unsigned int n = 0; n < f.backups; n++) {
+			std::string id(backup_uuid(vm, 0));
+
+			if (n == 0) {
+				xml += "<BackupItem>\n";
+			} else {
+				xml += "<PartialBackupItem>\n";
+				id += fmt(".%u", n + 1);
+			}
+			xml += "<Id>" + id + "</Id>\n<Host>mock</Host>\n"
+				"<Creator>root</Creator>\n<DateTime>" +
+				fmt("2026-01-%02u 03:00:00", n % 28 + 1) +
+				"</DateTime>\n<Size>" +
+				fmt("%llu", (unsigned long long) f.disk_blocks *
+					MOCK_GRANULARITY * f.disks / (n ? 8 : 1)) +
+				"</Size>\n<Type>" + (n ? "i" : "f") +
+				"</Type>\n<Description></Description>\n"
+				"<ServerUuid>{00000000-0000-4000-8000-00000000cafe}"
+				"</ServerUuid>\n<BackupDisks>\n";
+			for (unsigned int d = 0; d < f.disks; d++)
+				xml += "<BackupDisk>\n<Name>" +
+					fmt("harddisk%u.hdd", d) +
+					"</Name>\n<OriginalPath>/vz/vmprivate/" +
+					vm_name(vm) + fmt("/harddisk%u.hdd", d) +
+					"</OriginalPath>\n<Size>" +
+					fmt("%llu", (unsigned long long) f.disk_blocks *
+						MOCK_GRANULARITY) +
+					"</Size>\n</BackupDisk>\n";
+			xml += "</BackupDisks>\n";
+			if (n != 0)
+				xml += "</PartialBackupItem>\n";
+		}
+		xml += "</BackupItem>\n</VmItem>\n";
+	}
+	xml += "</BackupTree>\n";
+	return new_job(PJOC_SRV_GET_BACKUP_TREE, r);
+}
+
+/* VE configuration */
+
+PRL_RESULT PrlVmCfg_GetUuid(PRL_HANDLE hVmCfg, PRL_STR sVmUuid,
+		PRL_UINT32_PTR pnVmUuidBufLength)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	return copy_str(vm_uuid(vm->vm), sVmUuid, pnVmUuidBufLength);
+}
+
+PRL_RESULT PrlVmCfg_SetUuid(PRL_HANDLE hVmCfg, PRL_CONST_STR sNewVmUuid)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	(void)sNewVmUuid;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_GetName(PRL_HANDLE hVmCfg, PRL_STR sVmName,
+		PRL_UINT32_PTR pnVmNameBufLength)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	return copy_str(vm_name(vm->vm), sVmName, pnVmNameBufLength);
+}
+
+PRL_RESULT PrlVmCfg_GetCtId(PRL_HANDLE hVmCfg, PRL_STR sCtId,
+		PRL_UINT32_PTR pnCtIdBufLength)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+	std::string uuid(vm_uuid(vm->vm));
+
+	if (!is_ct(vm->vm))
+		return copy_str("", sCtId, pnCtIdBufLength);
+	return copy_str(uuid.substr(1, uuid.size() - 2), sCtId,
+			pnCtIdBufLength);
+}
+
+PRL_RESULT PrlVmCfg_GetHomePath(PRL_HANDLE hVmCfg, PRL_STR sHomePath,
+		PRL_UINT32_PTR pnHomePathBufLength)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	return copy_str("/vz/vmprivate/" + vm_name(vm->vm) + "/config.pvs",
+			sHomePath, pnHomePathBufLength);
+}
+
+PRL_RESULT PrlVmCfg_GetExternalBootDevice(PRL_HANDLE hVmCfg, PRL_STR sDev,
+		PRL_UINT32_PTR pnDevBufLength)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	return copy_str("", sDev, pnDevBufLength);
+}
+
+PRL_RESULT PrlVmCfg_GetOsTemplate(PRL_HANDLE hVmCfg, PRL_STR sOsTemplate,
+		PRL_UINT32_PTR pnOsTemplateBufLength)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	return copy_str(is_ct(vm->vm) ? "centos-7-x86_64" : "", sOsTemplate,
+			pnOsTemplateBufLength);
+}
+
+PRL_RESULT PrlVmCfg_GetOsType(PRL_HANDLE hVmCfg, PRL_UINT32_PTR pnVmOsType)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pnVmOsType = PVS_GUEST_TYPE_LINUX;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_GetOsVersion(PRL_HANDLE hVmCfg, PRL_UINT32_PTR pnVmOsVersion)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pnVmOsVersion = PVS_GUEST_VER_LIN_CENTOS_7;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_GetVmType(PRL_HANDLE hVmCfg, PRL_VM_TYPE *pnVmType)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pnVmType = is_ct(vm->vm) ? PVT_CT : PVT_VM;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_IsTemplate(PRL_HANDLE hVmCfg, PRL_BOOL_PTR pbVmIsTemplate)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pbVmIsTemplate = is_template(vm->vm) ? PRL_TRUE : PRL_FALSE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_IsEfiEnabled(PRL_HANDLE hVmCfg, PRL_BOOL_PTR pbEfiEnabled)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pbEfiEnabled = PRL_FALSE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_IsAllowSelectBootDevice(PRL_HANDLE hVmCfg,
+		PRL_BOOL_PTR pbAllowed)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pbAllowed = PRL_FALSE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_GetConfigValidity(PRL_HANDLE hVmCfg,
+		PRL_RESULT *pnErrCode)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pnErrCode = PRL_ERR_SUCCESS;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_IsConfigInvalid(PRL_RESULT nErrCode,
+		PRL_BOOL_PTR pbIsInvalid)
+{
+	*pbIsInvalid = PRL_FAILED(nErrCode) ? PRL_TRUE : PRL_FALSE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_GetVmInfo(PRL_HANDLE hVmCfg, PRL_HANDLE_PTR phVmInfo)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*phVmInfo = new_handle(new MockObj(MOCK_VMINFO, vm->vm));
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmInfo_GetState(PRL_HANDLE hVmInfo,
+		VIRTUAL_MACHINE_STATE *pVmState)
+{
+	GET_OBJ(info, hVmInfo, MOCK_VMINFO)
+
+	*pVmState = vm_state(info->vm);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmInfo_IsVncServerStarted(PRL_HANDLE hVmInfo,
+		PRL_BOOL_PTR pbStarted)
+{
+	GET_OBJ(info, hVmInfo, MOCK_VMINFO)
+
+	*pbStarted = PRL_FALSE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmInfo_GetAccessRights(PRL_HANDLE hVmInfo,
+		PRL_HANDLE_PTR phVmAcl)
+{
+	GET_OBJ(info, hVmInfo, MOCK_VMINFO)
+
+	*phVmAcl = new_handle(new MockObj(MOCK_ACL, info->vm));
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlAcl_GetOwnerName(PRL_HANDLE hAcl, PRL_STR sOwnerName,
+		PRL_UINT32_PTR pnOwnerNameBufLength)
+{
+	GET_OBJ(acl, hAcl, MOCK_ACL)
+
+	return copy_str("root", sOwnerName, pnOwnerNameBufLength);
+}
+
+/* Devices: the adapters go first, then the disks */
+
+PRL_RESULT PrlVmCfg_GetDevsCount(PRL_HANDLE hVmCfg, PRL_UINT32_PTR pnDevsCount)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+
+	*pnDevsCount = fleet().nets + fleet().disks;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmCfg_GetDevsList(PRL_HANDLE hVmCfg, PRL_HANDLE_PTR phDevsList,
+		PRL_UINT32_PTR pnDevsListCount)
+{
+	GET_OBJ(vm, hVmCfg, MOCK_VM)
+	unsigned int n = fleet().nets + fleet().disks;
+
+	if (*pnDevsListCount < n)
+		return PRL_ERR_INVALID_ARG;
+	for (unsigned int i = 0; i < n; i++) {
+		if (i < fleet().nets)
+			phDevsList[i] = new_handle(new MockObj(MOCK_NET, vm->vm, i));
+		else
+			phDevsList[i] = new_handle(new MockObj(MOCK_HDD, vm->vm,
+						i - fleet().nets));
+	}
+	*pnDevsListCount = n;
+	return PRL_ERR_SUCCESS;
+}
+
+static MockPtr get_dev(PRL_HANDLE hDev)
+{
+	MockPtr dev = get_obj(hDev, MOCK_NET);
+
+	return dev ? dev : get_obj(hDev, MOCK_HDD);
+}
+
+PRL_RESULT PrlVmDev_GetIndex(PRL_HANDLE hVmDev, PRL_UINT32_PTR pnIndex)
+{
+	MockPtr dev = get_dev(hVmDev);
+
+	if (!dev)
+		return PRL_ERR_INVALID_ARG;
+	*pnIndex = dev->idx;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmDev_IsEnabled(PRL_HANDLE hVmDev, PRL_BOOL_PTR pbEnabled)
+{
+	if (!get_dev(hVmDev))
+		return PRL_ERR_INVALID_ARG;
+	*pbEnabled = PRL_TRUE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmDev_IsConnected(PRL_HANDLE hVmDev, PRL_BOOL_PTR pbConnected)
+{
+	if (!get_dev(hVmDev))
+		return PRL_ERR_INVALID_ARG;
+	*pbConnected = PRL_TRUE;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmDevNet_GetMacAddress(PRL_HANDLE hVmDev, PRL_STR sMacAddress,
+		PRL_UINT32_PTR pnMacAddressBufLength)
+{
+	GET_OBJ(net, hVmDev, MOCK_NET)
+
+	return copy_str(fmt("001C42%06X", (net->vm * 16 + net->idx) & 0xffffff),
+			sMacAddress, pnMacAddressBufLength);
+}
+
+PRL_RESULT PrlVmDevNet_GetHostInterfaceName(PRL_HANDLE hVmDev,
+		PRL_STR sHostInterfaceName, PRL_UINT32_PTR pnBufLength)
+{
+	GET_OBJ(net, hVmDev, MOCK_NET)
+
+	return copy_str(fmt("veth%u.%u", net->vm, net->idx),
+			sHostInterfaceName, pnBufLength);
+}
+
+PRL_RESULT PrlVmDevNet_GetNetAddresses(PRL_HANDLE hVmDev,
+		PRL_HANDLE_PTR phNetAddressesList)
+{
+	GET_OBJ(net, hVmDev, MOCK_NET)
+	MockObj *list = new MockObj(MOCK_STRLIST, net->vm, net->idx);
+
+	list->strs.push_back(fmt("10.%u.%u.%u/255.255.0.0", net->idx,
+			(net->vm >> 8) & 0xff, net->vm & 0xff));
+	if (net->idx == 0)
+		list->strs.push_back(fmt("2001:db8::%x/64", net->vm + 1));
+	*phNetAddressesList = new_handle(list);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlStrList_GetItemsCount(PRL_HANDLE hStrList,
+		PRL_UINT32_PTR pnItemsCount)
+{
+	GET_OBJ(list, hStrList, MOCK_STRLIST)
+
+	*pnItemsCount = list->strs.size();
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlStrList_GetItem(PRL_HANDLE hStrList, PRL_UINT32 nItemIndex,
+		PRL_STR sItem, PRL_UINT32_PTR pnItemBufLength)
+{
+	GET_OBJ(list, hStrList, MOCK_STRLIST)
+
+	if (nItemIndex >= list->strs.size())
+		return PRL_ERR_INVALID_ARG;
+	return copy_str(list->strs[nItemIndex], sItem, pnItemBufLength);
+}
+
+/* Performance statistics */
+
+PRL_RESULT PrlVm_RegEventHandler(PRL_HANDLE hVm, mock_handler_t handler,
+		PRL_VOID_PTR pUserData)
+{
+	GET_OBJ(vm, hVm, MOCK_VM)
+	std::lock_guard<std::recursive_mutex> lock(g_handlers_mutex);
+
+	reg_handler(g_vm_handlers[vm->vm], handler, pUserData);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVm_UnregEventHandler(PRL_HANDLE hVm, mock_handler_t handler,
+		PRL_VOID_PTR pUserData)
+{
+	GET_OBJ(vm, hVm, MOCK_VM)
+	std::lock_guard<std::recursive_mutex> lock(g_handlers_mutex);
+
+	return unreg_handler(g_vm_handlers[vm->vm], handler, pUserData);
+}
+
+PRL_HANDLE PrlVm_SubscribeToPerfStats(PRL_HANDLE hVm, PRL_CONST_STR sFilter)
+{
+	MockPtr vm = get_obj(hVm, MOCK_VM);
+	PRL_HANDLE hJob;
+
+	(void)sFilter;
+	if (!vm)
+		return PRL_INVALID_HANDLE;
+	hJob = new_job(-1);
+	/* the first sample follows the reply */
+	g_events.subscribe(vm->vm, get_obj(hJob, MOCK_JOB)->done +
+			fleet().latency);
+	return hJob;
+}
+
+PRL_HANDLE PrlVm_UnsubscribeFromPerfStats(PRL_HANDLE hVm)
+{
+	MockPtr vm = get_obj(hVm, MOCK_VM);
+
+	if (!vm)
+		return PRL_INVALID_HANDLE;
+	g_events.unsubscribe(vm->vm);
+	return new_job(-1);
+}
+
+PRL_RESULT PrlEvent_GetType(PRL_HANDLE hEvent, PRL_EVENT_TYPE *pnEventType)
+{
+	GET_OBJ(evt, hEvent, MOCK_EVENT)
+
+	*pnEventType = (PRL_EVENT_TYPE) evt->idx;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlEvent_GetVm(PRL_HANDLE hEvent, PRL_HANDLE_PTR phVm)
+{
+	GET_OBJ(evt, hEvent, MOCK_EVENT)
+
+	*phVm = new_handle(new MockObj(MOCK_VM, evt->vm));
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlEvent_GetIssuerId(PRL_HANDLE hEvent, PRL_STR sIssuerId,
+		PRL_UINT32_PTR pnIssuerIdBufLength)
+{
+	GET_OBJ(evt, hEvent, MOCK_EVENT)
+
+	return copy_str(vm_uuid(evt->vm), sIssuerId, pnIssuerIdBufLength);
+}
+
+PRL_RESULT PrlEvent_GetParamsCount(PRL_HANDLE hEvent,
+		PRL_UINT32_PTR pnParamsCount)
+{
+	GET_OBJ(evt, hEvent, MOCK_EVENT)
+
+	*pnParamsCount = stats_count();
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlEvent_GetParam(PRL_HANDLE hEvent, PRL_UINT32 nIndex,
+		PRL_HANDLE_PTR phEventParam)
+{
+	GET_OBJ(evt, hEvent, MOCK_EVENT)
+
+	if (nIndex >= stats_count())
+		return PRL_ERR_INVALID_ARG;
+	*phEventParam = new_handle(new MockObj(MOCK_EVT_PRM, evt->vm, nIndex));
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlEvtPrm_GetName(PRL_HANDLE hEvtParam, PRL_STR sParamName,
+		PRL_UINT32_PTR pnParamNameBufLength)
+{
+	GET_OBJ(prm, hEvtParam, MOCK_EVT_PRM)
+
+	return copy_str(stats_name(prm->idx), sParamName,
+			pnParamNameBufLength);
+}
+
+PRL_RESULT PrlEvtPrm_GetType(PRL_HANDLE hEvtParam,
+		PRL_PARAM_FIELD_DATA_TYPE *pnParamType)
+{
+	GET_OBJ(prm, hEvtParam, MOCK_EVT_PRM)
+
+	*pnParamType = PFD_UINT64;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlEvtPrm_ToString(PRL_HANDLE hEvtParam, PRL_STR sVal,
+		PRL_UINT32_PTR pnValBufLength)
+{
+	GET_OBJ(prm, hEvtParam, MOCK_EVT_PRM)
+
+	return copy_str(fmt("%llu", (unsigned long long)
+				stats_value(prm->vm, prm->idx)),
+			sVal, pnValBufLength);
+}
+
+PRL_RESULT PrlEvtPrm_ToUint32(PRL_HANDLE hEvtParam, PRL_UINT32_PTR pnVal)
+{
+	GET_OBJ(prm, hEvtParam, MOCK_EVT_PRM)
+
+	*pnVal = (PRL_UINT32) stats_value(prm->vm, prm->idx);
+	return PRL_ERR_SUCCESS;
+}
+
+/* Backups: the disks are read through the CBT maps */
+
+PRL_HANDLE PrlVm_BeginBackup(PRL_HANDLE hVm, PRL_UINT32 nFlags)
+{
+	MockPtr vm = get_obj(hVm, MOCK_VM);
+	MockResult *r;
+
+	(void)nFlags;
+	if (!vm)
+		return PRL_INVALID_HANDLE;
+	r = new MockResult(MOCK_BACKUP);
+	r->vms.push_back(vm->vm);
+	return new_job(-1, r);
+}
+
+PRL_RESULT PrlVmBackup_GetDisksCount(PRL_HANDLE hBackup,
+		PRL_UINT32_PTR pnCount)
+{
+	GET_OBJ(b, hBackup, MOCK_BACKUP)
+
+	*pnCount = fleet().disks;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmBackup_GetDisk(PRL_HANDLE hBackup, PRL_UINT32 nIndex,
+		PRL_HANDLE_PTR phDisk)
+{
+	GET_OBJ(b, hBackup, MOCK_BACKUP)
+
+	if (nIndex >= fleet().disks)
+		return PRL_ERR_INVALID_ARG;
+	*phDisk = new_handle(new MockObj(MOCK_DISK, b->vm, nIndex));
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlVmBackup_GetUuid(PRL_HANDLE hBackup, PRL_STR sUuid,
+		PRL_UINT32_PTR pnUuidBufLength)
+{
+	GET_OBJ(b, hBackup, MOCK_BACKUP)
+
+	return copy_str(backup_uuid(b->vm, fleet().backups), sUuid,
+			pnUuidBufLength);
+}
+
+PRL_HANDLE PrlVmBackup_Commit(PRL_HANDLE hBackup)
+{
+	if (!get_obj(hBackup, MOCK_BACKUP))
+		return PRL_INVALID_HANDLE;
+	return new_job(-1);
+}
+
+PRL_HANDLE PrlVmBackup_Rollback(PRL_HANDLE hBackup)
+{
+	if (!get_obj(hBackup, MOCK_BACKUP))
+		return PRL_INVALID_HANDLE;
+	return new_job(-1);
+}
+
+/* Without a backup UUID the map has all the allocated blocks */
+PRL_RESULT PrlDisk_GetChangesMap_Local(PRL_HANDLE hDisk, PRL_CONST_STR sPitUuid,
+		PRL_VOID_PTR pReserved, PRL_HANDLE_PTR phMap)
+{
+	GET_OBJ(disk, hDisk, MOCK_DISK)
+	MockObj *map = new MockObj(MOCK_DISKMAP, disk->vm, disk->idx);
+
+	(void)pReserved;
+	map->full = (sPitUuid == NULL || *sPitUuid == '\0');
+	*phMap = new_handle(map);
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlDiskMap_GetGranularity(PRL_HANDLE hMap, PRL_UINT32_PTR pnSize)
+{
+	GET_OBJ(map, hMap, MOCK_DISKMAP)
+
+	*pnSize = MOCK_GRANULARITY;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlDiskMap_GetSize(PRL_HANDLE hMap, PRL_UINT32_PTR pnSize)
+{
+	GET_OBJ(map, hMap, MOCK_DISKMAP)
+
+	*pnSize = fleet().disk_blocks;
+	return PRL_ERR_SUCCESS;
+}
+
+PRL_RESULT PrlDiskMap_Read(PRL_HANDLE hMap, PRL_VOID_PTR pBuffer,
+		PRL_UINT32_PTR pnSize)
+{
+	GET_OBJ(map, hMap, MOCK_DISKMAP)
+	unsigned int blocks = fleet().disk_blocks;
+	unsigned int bytes = (blocks + 7) / 8;
+	unsigned char *buf = (unsigned char *) pBuffer;
+
+	if (*pnSize < bytes) {
+		*pnSize = bytes;
+		return PRL_ERR_INVALID_ARG;
+	}
+	memset(buf, 0, bytes);
+	for (unsigned int b = 0; b < blocks; b++) {
+		uint64_t seed = block_seed(map->vm, map->idx, b);
+
+		if (map->full ? block_allocated(seed) : block_changed(seed))
+			buf[b >> 3] |= 1 << (b & 7);
+	}
+	*pnSize = bytes;
+	return PRL_ERR_SUCCESS;
+}
+
+/* The image content: the unallocated blocks are zero, an allocated one
+ * is filled with its seed
+ */
+PRL_RESULT PrlDisk_Read(PRL_HANDLE hDisk, PRL_VOID_PTR pBuf, PRL_UINT32 nSize,
+		PRL_UINT64 nOffset)
+{
+	GET_OBJ(disk, hDisk, MOCK_DISK)
+	uint64_t off = nOffset * 512;
+	uint64_t end = off + nSize;
+	char *buf = (char *) pBuf;
+
+	if (end > (uint64_t) fleet().disk_blocks * MOCK_GRANULARITY)
+		return PRL_ERR_INVALID_ARG;
+	if (fleet().read_latency.count())
+		std::this_thread::sleep_for(fleet().read_latency);
+	while (off < end) {
+		uint64_t block = off / MOCK_GRANULARITY;
+		uint64_t len = std::min(end, (block + 1) * MOCK_GRANULARITY) - off;
+		uint64_t seed = block_seed(disk->vm, disk->idx, block);
+
+		if (block_allocated(seed))
+			memset(buf, (int) (seed >> 16) | 1, len);
+		else
+			memset(buf, 0, len);
+		buf += len;
+		off += len;
+	}
+	return PRL_ERR_SUCCESS;
+}
+
+} /* extern "C" */
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+#
+# This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+# it and/or modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of the License,
+# or (at your option) any later version.
+#
+# Emits MockUnimpl.c: a stub for every SDK call of the objects which the
+# mock does not serve, so that prlctl-bench links without libprl_sdk.
+# A stub fails with PRL_ERR_UNIMPLEMENTED, see mock_unimplemented().
+#
+# usage: gen_unimpl.sh <MockSdk.o> <prlctl objects>...
+
+mock=$1
+shift
+
+nm -g --defined-only "$mock" | awk '{ print $3 }' | sort -u > "$mock.syms"
+
+echo "/* Generated by gen_unimpl.sh, do not edit */"
+echo
+echo "extern unsigned long mock_unimplemented(const char *name);"
+nm -u "$@" | awk '$1 == "U" { print $2 }' | grep '^Prl[A-Za-z]*_' |
+	sort -u | comm -23 - "$mock.syms" |
+	while read sym; do
+		echo
+		echo "unsigned long $sym()"
+		echo "{"
+		echo "	return mock_unimplemented(\"$sym\");"
+		echo "}"
+	done
+
+rm -f "$mock.syms"